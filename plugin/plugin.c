@@ -16,6 +16,7 @@
  * Copyright 2019 Saso Kiselkov. All rights reserved.
  */
 
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -46,12 +47,20 @@ typedef struct {
 	char		filename[512];
 	bool_t		load;
 	bool_t		loaded;
+	/* object is only used for depth passes, build a pos-only stream */
+	bool_t		pos_stream;
+	float		occluder_tol;
+	double		mem_bytes;
+	double		mem_peak;
 
 	struct {
 		dr_t	filename;
 		dr_t	pos_offset[3];
+		dr_t	occluder_tol;
 		dr_t	load;
 		dr_t	loaded;
+		dr_t	mem_bytes;
+		dr_t	mem_peak;
 	} drs;
 } obj_data_t;
 
@@ -63,6 +72,9 @@ typedef struct {
 	double		wiper_angle[MAX_WIPERS];
 	bool_t		wiper_moving[MAX_WIPERS];
 
+	double		mem_bytes;
+	double		mem_peak;
+
 	struct {
 		dr_t	slant_factor;
 
@@ -100,6 +112,9 @@ typedef struct {
 		dr_t	wiper_radius_inner[MAX_WIPERS];
 		dr_t	wiper_angle[MAX_WIPERS];
 		dr_t	wiper_moving[MAX_WIPERS];
+
+		dr_t	mem_bytes;
+		dr_t	mem_peak;
 	} drs;
 } glass_data_t;
 
@@ -108,6 +123,8 @@ static char plugindir[512];
 
 #define	MAX_GLASS		4
 #define	MAX_Z_DEPTH_OBJS	20
+/* microseconds per flight loop, see resolve_obj_drs */
+#define	DR_RESOLVE_BUDGET	200
 
 static librain_glass_t	glass_info[MAX_GLASS];
 static glass_data_t	glass_data[MAX_GLASS];
@@ -119,6 +136,7 @@ static int		num_glass_use = 0;
 static bool_t		verbose = B_FALSE;
 static bool_t		debug_draw = B_FALSE;
 static bool_t		wipers_visible = B_FALSE;
+static int		low_res_div = 1;
 
 static struct {
 	dr_t		librain_do_init;
@@ -127,8 +145,23 @@ static struct {
 	dr_t		verbose;
 	dr_t		debug_draw;
 	dr_t		wipers_visible;
+	dr_t		low_res_div;
 } drs;
 
+/* librain_mem statistics, refreshed from the flight loop */
+static struct {
+	double		bytes[LIBRAIN_MEM_NUM_CATS];
+	double		peak[LIBRAIN_MEM_NUM_CATS];
+	double		total_bytes[2];		/* indexed by `gpu' */
+	double		total_peak[2];
+	struct {
+		dr_t	bytes[LIBRAIN_MEM_NUM_CATS];
+		dr_t	peak[LIBRAIN_MEM_NUM_CATS];
+		dr_t	total_bytes[2];
+		dr_t	total_peak[2];
+	} drs;
+} mem;
+
 static void
 wiper_cb(dr_t *dr, void *value_p)
 {
@@ -149,6 +182,39 @@ debug_draw_cb(dr_t *dr, void *value_p)
 		librain_set_debug_draw(*(int *)value_p);
 }
 
+static void
+low_res_div_cb(dr_t *dr, void *value_p)
+{
+	int *div_p = value_p;
+
+	UNUSED(dr);
+	ASSERT(div_p != NULL);
+	/* only full, half and quarter resolution are supported */
+	if (*div_p >= 4)
+		*div_p = 4;
+	else if (*div_p >= 2)
+		*div_p = 2;
+	else
+		*div_p = 1;
+	if (librain_inited)
+		librain_set_low_res_div(*div_p);
+}
+
+static void
+occluder_tol_cb(dr_t *dr, void *value_p)
+{
+	float *tol_p = value_p;
+
+	UNUSED(dr);
+	ASSERT(tol_p != NULL);
+	/* anything other than a positive tolerance disables the occluder */
+	if (!isfinite(*tol_p) || *tol_p < 0) {
+		logMsg("librain data error: occluder_tol must be a finite "
+		    "number greater than or equal to 0");
+		*tol_p = 0;
+	}
+}
+
 static void
 load_obj_cb(dr_t *dr, void *value_p)
 {
@@ -172,7 +238,12 @@ load_obj_cb(dr_t *dr, void *value_p)
 		od->loaded = B_FALSE;
 	}
 	if (value != 0 && strlen(od->filename) > 0) {
-		od->obj = obj8_parse(od->filename, od->pos_offset);
+		obj8_parse_opts_t opts = {
+		    .occluder_tol = od->occluder_tol,
+		    .pos_buf = od->pos_stream
+		};
+
+		od->obj = obj8_parse2(od->filename, od->pos_offset, &opts);
 		od->loaded = (od->obj != NULL);
 		if (od->loaded && verbose)
 			logMsg("loaded object %s", obj8_get_filename(od->obj));
@@ -245,6 +316,7 @@ librain_init_cb(dr_t *dr, void *value_p)
 				logMsg("librain_init success");
 			librain_set_debug_draw(debug_draw);
 			librain_set_wipers_visible(wipers_visible);
+			librain_set_low_res_div(low_res_div);
 		} else {
 			value = B_FALSE;
 		}
@@ -342,6 +414,11 @@ obj_data_init(obj_data_t *od, const char *prefix)
 	    "%s/pos_offset/y", prefix);
 	dr_create_f64(&od->drs.pos_offset[2], &od->pos_offset.z, B_TRUE,
 	    "%s/pos_offset/z", prefix);
+	dr_create_f_cfg(&od->drs.occluder_tol, &od->occluder_tol,
+	    (dr_cfg_t){
+	        .writable = true,
+	        .write_cb = occluder_tol_cb,
+	    }, "%s/occluder_tol", prefix);
 	dr_create_i_cfg(&od->drs.load, (int *)&od->load,
 	    (dr_cfg_t){
 	        .writable = true,
@@ -350,6 +427,10 @@ obj_data_init(obj_data_t *od, const char *prefix)
 	    }, "%s/load", prefix);
 	dr_create_i(&od->drs.loaded, (int *)&od->loaded, B_FALSE,
 	    "%s/loaded", prefix);
+	dr_create_f64(&od->drs.mem_bytes, &od->mem_bytes, B_FALSE,
+	    "%s/mem/bytes", prefix);
+	dr_create_f64(&od->drs.mem_peak, &od->mem_peak, B_FALSE,
+	    "%s/mem/peak", prefix);
 }
 
 static void
@@ -360,8 +441,11 @@ obj_data_fini(obj_data_t *od)
 	dr_delete(&od->drs.filename);
 	for (int i = 0; i < 3; i++)
 		dr_delete(&od->drs.pos_offset[i]);
+	dr_delete(&od->drs.occluder_tol);
 	dr_delete(&od->drs.load);
 	dr_delete(&od->drs.loaded);
+	dr_delete(&od->drs.mem_bytes);
+	dr_delete(&od->drs.mem_peak);
 	memset(od, 0, sizeof (*od));
 }
 
@@ -386,6 +470,10 @@ glass_data_init(unsigned glass_i)
 
 	dr_create_f64(&gd->drs.slant_factor, &glass->slant_factor, B_TRUE,
 	    "librain/glass_%d/slant_factor", glass_i);
+	dr_create_f64(&gd->drs.mem_bytes, &gd->mem_bytes, B_FALSE,
+	    "librain/glass_%d/mem/bytes", glass_i);
+	dr_create_f64(&gd->drs.mem_peak, &gd->mem_peak, B_FALSE,
+	    "librain/glass_%d/mem/peak", glass_i);
 
 	dr_create_f64(&gd->drs.thrust_point_x, &glass->thrust_point.x, B_TRUE,
 	    "librain/glass_%d/thrust_point/x", glass_i);
@@ -544,6 +632,8 @@ glass_data_fini(unsigned glass_i)
 	dr_delete(&gd->drs.max_thrust);
 
 	dr_delete(&gd->drs.slant_factor);
+	dr_delete(&gd->drs.mem_bytes);
+	dr_delete(&gd->drs.mem_peak);
 
 	obj_data_fini(&gd->obj_data);
 
@@ -557,6 +647,109 @@ glass_data_fini(unsigned glass_i)
 	memset(gd, 0, sizeof (*gd));
 }
 
+/*
+ * Dataref lookups for the objects' animations are done from here, so they
+ * never hit the drawing callback. We spend at most DR_RESOLVE_BUDGET
+ * microseconds per flight loop on them.
+ */
+static void
+resolve_obj_drs(void)
+{
+	uint64_t deadline = microclock() + DR_RESOLVE_BUDGET;
+
+	for (int i = 0; i < MAX_GLASS; i++) {
+		obj8_t *obj = glass_data[i].obj_data.obj;
+
+		if (obj != NULL) {
+			(void)obj8_drset_resolve(obj8_get_drset(obj),
+			    deadline);
+		}
+	}
+	for (int i = 0; i < MAX_Z_DEPTH_OBJS; i++) {
+		obj8_t *obj = z_depth_objs[i].obj;
+
+		if (obj != NULL) {
+			(void)obj8_drset_resolve(obj8_get_drset(obj),
+			    deadline);
+		}
+	}
+}
+
+static void
+mem_drs_init(void)
+{
+	for (int i = 0; i < LIBRAIN_MEM_NUM_CATS; i++) {
+		const char *name = librain_mem_cat_name(i);
+
+		dr_create_f64(&mem.drs.bytes[i], &mem.bytes[i], B_FALSE,
+		    "librain/mem/%s/bytes", name);
+		dr_create_f64(&mem.drs.peak[i], &mem.peak[i], B_FALSE,
+		    "librain/mem/%s/peak", name);
+	}
+	for (int gpu = 0; gpu < 2; gpu++) {
+		const char *name = (gpu ? "gpu_total" : "cpu_total");
+
+		dr_create_f64(&mem.drs.total_bytes[gpu],
+		    &mem.total_bytes[gpu], B_FALSE, "librain/mem/%s/bytes",
+		    name);
+		dr_create_f64(&mem.drs.total_peak[gpu],
+		    &mem.total_peak[gpu], B_FALSE, "librain/mem/%s/peak",
+		    name);
+	}
+}
+
+static void
+mem_drs_fini(void)
+{
+	for (int i = 0; i < LIBRAIN_MEM_NUM_CATS; i++) {
+		dr_delete(&mem.drs.bytes[i]);
+		dr_delete(&mem.drs.peak[i]);
+	}
+	for (int gpu = 0; gpu < 2; gpu++) {
+		dr_delete(&mem.drs.total_bytes[gpu]);
+		dr_delete(&mem.drs.total_peak[gpu]);
+	}
+}
+
+static void
+update_obj_mem_drs(obj_data_t *od)
+{
+	librain_mem_stat_t st = { 0 };
+
+	if (od->obj != NULL)
+		st = obj8_get_mem_stat(od->obj);
+	od->mem_bytes = st.bytes;
+	od->mem_peak = st.peak;
+}
+
+static void
+update_mem_drs(void)
+{
+	for (int i = 0; i < LIBRAIN_MEM_NUM_CATS; i++) {
+		librain_mem_stat_t st = librain_mem_get_stat(i);
+
+		mem.bytes[i] = st.bytes;
+		mem.peak[i] = st.peak;
+	}
+	for (int gpu = 0; gpu < 2; gpu++) {
+		librain_mem_stat_t st = librain_mem_get_total(gpu);
+
+		mem.total_bytes[gpu] = st.bytes;
+		mem.total_peak[gpu] = st.peak;
+	}
+	for (int i = 0; i < MAX_GLASS; i++) {
+		librain_mem_stat_t st = { 0 };
+
+		if (librain_inited)
+			st = librain_get_glass_mem_stat(&glass_info[i]);
+		glass_data[i].mem_bytes = st.bytes;
+		glass_data[i].mem_peak = st.peak;
+		update_obj_mem_drs(&glass_data[i].obj_data);
+	}
+	for (int i = 0; i < MAX_Z_DEPTH_OBJS; i++)
+		update_obj_mem_drs(&z_depth_objs[i]);
+}
+
 static float
 wiper_floop(float delta_t, float time2, int counter, void *refcon)
 {
@@ -565,6 +758,8 @@ wiper_floop(float delta_t, float time2, int counter, void *refcon)
 	UNUSED(counter);
 	UNUSED(refcon);
 
+	resolve_obj_drs();
+	update_mem_drs();
 	if (!librain_inited)
 		return (1);
 
@@ -653,6 +848,7 @@ XPluginStart(char *name, char *sig, char *desc)
 
 		snprintf(prefix, sizeof (prefix), "librain/z_depth_obj_%d", i);
 		obj_data_init(&z_depth_objs[i], prefix);
+		z_depth_objs[i].pos_stream = B_TRUE;
 	}
 
 	dr_create_i_cfg(&drs.librain_do_init, (int *)&librain_do_init,
@@ -678,6 +874,12 @@ XPluginStart(char *name, char *sig, char *desc)
 	        .writable = true,
 	        .write_cb = wiper_cb,
 	    }, "librain/wipers_visible");
+	dr_create_i_cfg(&drs.low_res_div, &low_res_div,
+	    (dr_cfg_t){
+	        .writable = true,
+	        .write_cb = low_res_div_cb,
+	    }, "librain/low_res_div");
+	mem_drs_init();
 
 	return (1);
 errout:
@@ -693,12 +895,14 @@ XPluginStop(void)
 		librain_inited = B_FALSE;
 	}
 
+	dr_delete(&drs.low_res_div);
 	dr_delete(&drs.wipers_visible);
 	dr_delete(&drs.debug_draw);
 	dr_delete(&drs.verbose);
 	dr_delete(&drs.librain_do_init);
 	dr_delete(&drs.librain_inited);
 	dr_delete(&drs.num_glass_use);
+	mem_drs_fini();
 
 	for (int i = 0; i < MAX_GLASS; i++)
 		glass_data_fini(i);
@@ -0,0 +1,38 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+*/
+/*
+ * Copyright 2023 Saso Kiselkov. All rights reserved.
+ */
+
+#version 460 core
+
+layout(location = 0) uniform mat4	pvm;
+
+/*
+ * Position-only variant of generic.vert for depth-only passes. Not reading
+ * vtx_norm and vtx_tex0 lets obj8 feed us from its packed position buffer.
+ */
+layout(location = 0) in vec3		vtx_pos;
+
+layout(location = 0) out vec3		tex_norm;
+layout(location = 1) out vec2		tex_coord;
+
+void
+main()
+{
+	tex_norm = vec3(0.0);
+	tex_coord = vec2(0.0);
+	gl_Position = pvm * vec4(vtx_pos, 1.0);
+}
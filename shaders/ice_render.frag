@@ -28,6 +28,7 @@ layout(location = 12) uniform sampler2D	bg;
 layout(location = 13) uniform vec3	sun_dir;
 layout(location = 14) uniform float	sun_pitch;
 layout(location = 15) uniform mat4	acf_orient;
+layout(location = 19) uniform vec4	vp;
 
 /* from vertex shader */
 layout(location = 0) in vec3		tex_norm;
@@ -41,8 +42,8 @@ layout(location = 0) out vec4		color_out;
 void
 main()
 {
-	vec2 bg_sz = textureSize(bg, 0);
-	vec4 bg_pixel = texture(bg, gl_FragCoord.xy / bg_sz);
+	/* bg covers the viewport, but may be at a reduced resolution */
+	vec4 bg_pixel = texture(bg, (gl_FragCoord.xy - vp.xy) / vp.zw);
 	float white = bg_pixel.r + bg_pixel.g + bg_pixel.b;
 	vec2 norm_pixel = texture(norm, tex_coord).rg - vec2(0.5);
 	float depth_val = clamp(texture(depth, tex_coord).r, 0, 1.5);
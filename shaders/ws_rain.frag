@@ -36,6 +36,10 @@ layout(location = 15) uniform vec2	wiper_pivot[MAX_WIPERS];
 layout(location = 17) uniform float	wiper_radius_outer[MAX_WIPERS];
 layout(location = 19) uniform float	wiper_radius_inner[MAX_WIPERS];
 layout(location = 21) uniform float	wiper_pos[MAX_WIPERS];
+#if	!COMPUTE_VARIANT
+/* screenshot pixels per screen pixel, see librain_set_low_res */
+layout(location = 23) uniform float	px_scale;
+#endif
 
 layout(location = 0) in vec3		tex_norm;
 layout(location = 1) in vec2		tex_coord;
@@ -87,7 +91,12 @@ main()
 	float depth = texture(depth_tex, tex_coord).r;
 	vec2 norm_v = (2.0 * texture(norm_tex, tex_coord).xy) - 1.0;
 	vec2 displace = norm_v * displace_lim;
+#if	COMPUTE_VARIANT
+	/* displace_lim is derived from the screenshot size, so it scales */
 	vec4 bg_pixel = get_pixel(gl_FragCoord.xy + displace);
+#else
+	vec4 bg_pixel = get_pixel(gl_FragCoord.xy + displace * px_scale);
+#endif
 	float displace_fract = length(displace) / darkening_fact;
 
 #if	RAIN_DEBUG
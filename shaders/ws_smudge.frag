@@ -26,6 +26,8 @@ layout(location = 11) uniform sampler2D	screenshot_tex;
 layout(location = 12) uniform vec2	screenshot_tex_sz;
 layout(location = 13) uniform sampler2D	ws_tex;
 layout(location = 14) uniform vec4	vp;
+layout(location = 15) uniform bool	low_res;
+layout(location = 16) uniform float	blur_scale;
 
 layout(location = 0) in vec3		tex_norm;
 layout(location = 1) in vec2		tex_coord;
@@ -39,6 +41,7 @@ layout(location = 0) out vec4		color_out;
 	0.02, 0.04, 0.08, 0.04, 0.02, \
 	0.01, 0.02, 0.04, 0.02, 0.01 \
 )
+const float kernel[25] = KERNEL;
 
 vec4
 get_pixel(vec2 pos)
@@ -51,6 +54,30 @@ get_pixel(vec2 pos)
 	return (texture(ws_tex, pos));
 }
 
+/*
+ * Reduced resolution variant, rendered into a private texture which
+ * ws_upsample then scales back up. ws_tex was cleared to zero before
+ * ws_rain, so its alpha channel holds the glass coverage, which we use
+ * to avoid pulling black in from around the glass' edges. Our output
+ * alpha carries the water depth (offset so that 0 still means "no
+ * glass") to guide the upsample.
+ */
+void
+smudge_low_res(float depth_rat)
+{
+	vec4 sum = vec4(0.0);
+
+	for (int y = -2; y <= 2; y++) {
+		for (int x = -2; x <= 2; x++) {
+			sum += get_pixel(gl_FragCoord.xy - vp.xy +
+			    depth_rat * blur_scale * vec2(x, y)) *
+			    kernel[(y + 2) * 5 + (x + 2)];
+		}
+	}
+	color_out = vec4(sum.rgb / max(sum.a, 1.0 / 255.0),
+	    0.5 + 0.5 * clamp(depth_rat, 0.0, 1.0));
+}
+
 void
 main()
 {
@@ -58,6 +85,11 @@ main()
 	float depth = depth_val.r;
 	float depth_rat = depth / max_depth;
 
+	if (low_res) {
+		smudge_low_res(depth_rat);
+		return;
+	}
+
 #define	BLUR_I(x, y, coeff_i) \
 	(get_pixel(gl_FragCoord.xy - vp.xy + \
 	    depth_rat * vec2(float(x), float(y))) * KERNEL[coeff_i])
@@ -0,0 +1,98 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+*/
+/*
+ * Copyright 2023 Saso Kiselkov. All rights reserved.
+ */
+
+#version 460 core
+#extension GL_GOOGLE_include_directive: require
+
+#include "consts.glsl"
+
+/*
+ * Composites the reduced resolution ws_smudge output back onto the
+ * screen. This is a joint bilateral upsample: the four nearest low-res
+ * texels are weighted bilinearly, texels outside of the glass (alpha 0)
+ * are dropped, so the glass' edges don't pick up the surroundings, and
+ * texels whose water depth differs from the full-res depth here are
+ * de-emphasized, so droplet edges stay sharp.
+ */
+
+layout(location = 10) uniform sampler2D	depth_tex;
+layout(location = 11) uniform sampler2D	ws_tex;
+layout(location = 12) uniform vec4	vp;
+
+layout(location = 0) in vec3		tex_norm;
+layout(location = 1) in vec2		tex_coord;
+
+layout(location = 0) out vec4		color_out;
+
+/* water depth difference at which a texel's weight is halved */
+const float	depth_sigma = 0.1;
+/* keeps covered texels usable when they fall on a bilinear zero */
+const float	min_bilin_w = 0.001;
+
+float
+tap(ivec2 pos, ivec2 sz, float depth_rat, float bilin_w, inout vec3 sum)
+{
+	vec4 px = texelFetch(ws_tex, clamp(pos, ivec2(0), sz - 1), 0);
+	float w;
+
+	if (px.a < 0.25)
+		return (0.0);
+	w = bilin_w * depth_sigma /
+	    (depth_sigma + abs((2.0 * px.a - 1.0) - depth_rat));
+	sum += px.rgb * w;
+
+	return (w);
+}
+
+void
+main()
+{
+	ivec2 sz = textureSize(ws_tex, 0);
+	float depth_rat = clamp(texture(depth_tex, tex_coord).r / max_depth,
+	    0.0, 1.0);
+	vec2 pos = ((gl_FragCoord.xy - vp.xy) / vp.zw) * vec2(sz) - 0.5;
+	ivec2 base = ivec2(floor(pos));
+	vec2 f = pos - floor(pos);
+	vec3 sum = vec3(0.0);
+	float w_sum = 0.0;
+
+	for (int y = 0; y <= 1; y++) {
+		for (int x = 0; x <= 1; x++) {
+			float bilin_w = (x == 0 ? 1.0 - f.x : f.x) *
+			    (y == 0 ? 1.0 - f.y : f.y);
+			w_sum += tap(base + ivec2(x, y), sz, depth_rat,
+			    max(bilin_w, min_bilin_w), sum);
+		}
+	}
+	/*
+	 * Thin slivers of glass can miss all four texels at low res, so
+	 * widen the search to the surrounding ring before giving up.
+	 */
+	if (w_sum == 0.0) {
+		for (int y = -1; y <= 2; y++) {
+			for (int x = -1; x <= 2; x++) {
+				w_sum += tap(base + ivec2(x, y), sz,
+				    depth_rat, 1.0, sum);
+			}
+		}
+	}
+	if (w_sum == 0.0)
+		discard;
+
+	color_out = vec4(sum / w_sum, 1.0);
+}
@@ -38,6 +38,7 @@
 #include <acfutils/time.h>
 
 #include "librain_glpriv.h"
+#include "librain_mem.h"
 #include "librain.h"
 #include "../shaders/droplets_data.h"
 
@@ -53,11 +54,15 @@
 #define	GLASS_NAME(gi)	\
 	(gi->glass->name == NULL ? "<unnamed>" : gi->glass->name)
 #define	MIPLEVELS		8
+/* displace_lim of the non-compute ws_rain shader, in full-res pixels */
+#define	WS_RAIN_DISPLACE_LIM	200
+#define	WS_SMUDGE_BLUR_MARGIN	4	/* pixels */
 
 TEXSZ_MK_TOKEN(librain_water_depth_tex);
 TEXSZ_MK_TOKEN(librain_water_norm_tex);
 TEXSZ_MK_TOKEN(librain_ws_temp_tex);
 TEXSZ_MK_TOKEN(librain_ws_smudge_tex);
+TEXSZ_MK_TOKEN(librain_ws_lowres_tex);
 TEXSZ_MK_TOKEN(librain_screenshot_tex);
 
 typedef enum {
@@ -101,12 +106,15 @@ static XPLMHostApplicationID	host_id = 0;
 
 static bool_t		inited = B_FALSE;
 static bool_t		debug_draw = B_FALSE;
+static bool_t		z_depth_coarsest_lod = B_FALSE;
 static bool_t		wipers_visible = B_FALSE;
 
 static GLuint	screenshot_tex = 0;
 static GLuint	screenshot_fbo = 0;
 static GLuint	ws_smudge_tex = 0;
 static GLuint	ws_smudge_fbo = 0;
+static GLuint	ws_lowres_tex = 0;
+static GLuint	ws_lowres_fbo = 0;
 static GLint	cur_vp[4] = { -1, -1, DFL_VP_SIZE, DFL_VP_SIZE };
 static GLint	saved_vp[4] = { -1, -1, -1, -1 };
 static bool	cached_rev_float_z = false;
@@ -117,6 +125,15 @@ static GLint	saved_depth_func;
 static GLfloat	saved_depth_clear;
 static GLint	saved_front_face;
 static GLint	ss_texsz[2] = { DFL_VP_SIZE, DFL_VP_SIZE };
+/* viewport divisor ss_texsz was computed with, see librain_set_low_res */
+static unsigned	ss_div = 1;
+static unsigned	low_res_div = 1;
+/*
+ * Part of the screenshot texture (x0, y0, x1, y1 in texels) which the
+ * glass can show this eye. See update_ss_rect.
+ */
+static GLint	ss_rect[4] = { 0, 0, DFL_VP_SIZE, DFL_VP_SIZE };
+static bool_t	ss_scissor = B_FALSE;
 static float	last_rain_t = 0;
 static bool_t	rain_enabled = B_TRUE;
 
@@ -130,6 +147,7 @@ static double	precip_intens = 0;
 static float	last_run_t = 0;
 
 static GLint	z_depth_prog = 0;
+static GLint	z_depth_pos_prog = 0;
 static GLint	stencil_init_prog = 0;
 
 /* Captured matrix info during capture_mtx */
@@ -167,11 +185,14 @@ static GLint	ws_rain_prog = 0;
 static GLint	ws_rain_comp_prog = 0;
 static GLint	ws_smudge_prog = 0;
 static GLint	ws_smudge_comp_prog = 0;
+static GLint	ws_upsample_prog = 0;
+static GLint	ws_upsample_comp_prog = 0;
 static GLint	droplets_prog = 0;
 static GLint	droplets_paint_prog = 0;
 static GLint	tails_prog = 0;
 
 static shader_info_t generic_vert_info = { .filename = "generic.vert.spv" };
+static shader_info_t depth_vert_info = { .filename = "depth.vert.spv" };
 static shader_info_t ws_temp_frag_info = { .filename = "ws_temp.frag.spv" };
 static shader_info_t rain_stage1_frag_info =
     { .filename = "rain_stage1.frag.spv" };
@@ -186,6 +207,10 @@ static shader_info_t ws_smudge_frag_info =
     { .filename = "ws_smudge.frag.spv" };
 static shader_info_t ws_smudge_comp_frag_info =
     { .filename = "ws_smudge_comp.frag.spv" };
+static shader_info_t ws_upsample_frag_info =
+    { .filename = "ws_upsample.frag.spv" };
+static shader_info_t ws_upsample_comp_frag_info =
+    { .filename = "ws_upsample_comp.frag.spv" };
 static shader_info_t nil_frag_info = { .filename = "nil.frag.spv" };
 static shader_info_t droplets_comp_info = { .filename = "droplets.comp.spv" };
 static shader_info_t droplets_vert_info = { .filename = "droplets.vert.spv" };
@@ -243,6 +268,18 @@ static shader_prog_info_t ws_smudge_comp_prog_info = {
     .frag = &ws_smudge_comp_frag_info
 };
 
+static shader_prog_info_t ws_upsample_prog_info = {
+    .progname = "ws_upsample",
+    .vert = &generic_vert_info,
+    .frag = &ws_upsample_frag_info
+};
+
+static shader_prog_info_t ws_upsample_comp_prog_info = {
+    .progname = "ws_upsample_comp",
+    .vert = &generic_vert_info,
+    .frag = &ws_upsample_comp_frag_info
+};
+
 static shader_prog_info_t z_depth_prog_info = {
     .progname = "z_depth",
     .vert = &generic_vert_info,
@@ -250,6 +287,13 @@ static shader_prog_info_t z_depth_prog_info = {
     .attr_binds = default_vtx_attr_binds
 };
 
+static shader_prog_info_t z_depth_pos_prog_info = {
+    .progname = "z_depth_pos",
+    .vert = &depth_vert_info,
+    .frag = &nil_frag_info,
+    .attr_binds = default_vtx_attr_binds
+};
+
 static shader_prog_info_t stencil_init_prog_info = {
     .progname = "stencil_init",
     .vert = &stencil_vert_info,
@@ -407,6 +451,8 @@ typedef struct {
 	struct {
 		vect2_t		wp;
 	} compute;
+
+	librain_mem_acct_t	mem;
 } glass_info_t;
 
 static glass_info_t *glass_infos = NULL;
@@ -619,29 +665,160 @@ update_glob_data(const mat4 proj_matrix, const mat4 acf_matrix, const vec4 vp)
 static void
 update_ss_tex(void)
 {
-	if (cur_vp[2] == ss_texsz[0] && cur_vp[3] == ss_texsz[1])
+	GLint w = MAX(cur_vp[2] / (GLint)low_res_div, 1);
+	GLint h = MAX(cur_vp[3] / (GLint)low_res_div, 1);
+	GLint filter;
+
+	if (w == ss_texsz[0] && h == ss_texsz[1] && ss_div == low_res_div)
 		return;
 
 	IF_TEXSZ(TEXSZ_FREE(librain_screenshot_tex, GL_RGB, GL_UNSIGNED_BYTE,
 	    ss_texsz[0], ss_texsz[1]));
+	librain_mem_free(LIBRAIN_MEM_SCREENSHOT, NULL,
+	    librain_mem_tex_bytes(GL_RGB8, ss_texsz[0], ss_texsz[1], 1));
 	destroy_smudge_tex();
 
-	/* If the viewport size has changed, update the textures. */
-	ss_texsz[0] = cur_vp[2];
-	ss_texsz[1] = cur_vp[3];
+	/*
+	 * If the viewport size or the resolution divisor has changed,
+	 * update the textures.
+	 */
+	ss_texsz[0] = w;
+	ss_texsz[1] = h;
+	ss_div = low_res_div;
+	filter = (ss_div > 1 ? GL_LINEAR : GL_NEAREST);
 
 	glBindTexture(GL_TEXTURE_2D, screenshot_tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, ss_texsz[0], ss_texsz[1],
 	    0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
 
 	IF_TEXSZ(TEXSZ_ALLOC(librain_screenshot_tex, GL_RGB, GL_UNSIGNED_BYTE,
 	    ss_texsz[0], ss_texsz[1]));
+	librain_mem_alloc(LIBRAIN_MEM_SCREENSHOT, NULL,
+	    librain_mem_tex_bytes(GL_RGB8, ss_texsz[0], ss_texsz[1], 1));
 
 	setup_smudge_tex();
 
 	GLUTILS_ASSERT_NO_ERROR();
 }
 
+/*
+ * Grows `rect' (x0, y0, x1, y1 in viewport pixels) to include the screen
+ * footprint of the box `bmin' - `bmax'. Returns false if any corner of
+ * the box is behind the camera, as its footprint is then unbounded.
+ */
+static bool
+rect_add_box(double rect[4], vect3_t bmin, vect3_t bmax)
+{
+	for (int i = 0; i < 8; i++) {
+		vec4 p = {
+		    (i & 1) ? bmax.x : bmin.x,
+		    (i & 2) ? bmax.y : bmin.y,
+		    (i & 4) ? bmax.z : bmin.z,
+		    1
+		};
+		double x, y;
+
+		glm_mat4_mulv(glob_pvm, p, p);
+		if (p[3] <= 1e-6)
+			return (false);
+		x = (p[0] / p[3] + 1) / 2 * cur_vp[2];
+		if (cached_rev_y)
+			y = (1 - p[1] / p[3]) / 2 * cur_vp[3];
+		else
+			y = (p[1] / p[3] + 1) / 2 * cur_vp[3];
+		rect[0] = MIN(rect[0], x);
+		rect[1] = MIN(rect[1], y);
+		rect[2] = MAX(rect[2], x);
+		rect[3] = MAX(rect[3], y);
+	}
+	return (true);
+}
+
+static bool
+glass_add_rect(const glass_info_t *gi, double rect[4])
+{
+	const librain_glass_t *glass = gi->glass;
+	double glass_rect[4] = { INFINITY, INFINITY, -INFINITY, -INFINITY };
+	double margin_x, margin_y;
+	vect3_t bmin, bmax;
+
+	if (glass->group_ids == NULL) {
+		if (!obj8_get_bounds(glass->obj, NULL, &bmin, &bmax) ||
+		    !rect_add_box(glass_rect, bmin, bmax))
+			return (false);
+	} else {
+		for (int i = 0; glass->group_ids[i] != NULL; i++) {
+			if (!obj8_get_bounds(glass->obj, glass->group_ids[i],
+			    &bmin, &bmax) ||
+			    !rect_add_box(glass_rect, bmin, bmax))
+				return (false);
+		}
+	}
+	/*
+	 * The rain pass looks up the screenshot up to displace_lim away
+	 * from the glass (see ws_rain.frag) and the smudge blur reaches
+	 * a little further still.
+	 */
+	if (gi->qual.use_compute) {
+		margin_x = cur_vp[3] / 10.0;
+		margin_y = cur_vp[2] / 10.0;
+	} else {
+		margin_x = WS_RAIN_DISPLACE_LIM;
+		margin_y = WS_RAIN_DISPLACE_LIM;
+	}
+	margin_x += WS_SMUDGE_BLUR_MARGIN;
+	margin_y += WS_SMUDGE_BLUR_MARGIN;
+	rect[0] = MIN(rect[0], glass_rect[0] - margin_x);
+	rect[1] = MIN(rect[1], glass_rect[1] - margin_y);
+	rect[2] = MAX(rect[2], glass_rect[2] + margin_x);
+	rect[3] = MAX(rect[3], glass_rect[3] + margin_y);
+
+	return (true);
+}
+
+/*
+ * Computes ss_rect, the union of the screen footprints of all glass
+ * objects. Only this part of the screen gets copied into the screenshot
+ * texture and touched in the side buffers. If the footprint cannot be
+ * determined (objects still loading, animated geometry or glass behind
+ * the camera), we fall back to the whole viewport.
+ */
+static void
+update_ss_rect(void)
+{
+	double rect[4] = { INFINITY, INFINITY, -INFINITY, -INFINITY };
+
+	if (!ss_scissor)
+		goto full;
+	for (size_t i = 0; i < num_glass_infos; i++) {
+		if (!glass_add_rect(&glass_infos[i], rect))
+			goto full;
+	}
+	ss_rect[0] = clamp(floor(rect[0] / ss_div), 0, ss_texsz[0]);
+	ss_rect[1] = clamp(floor(rect[1] / ss_div), 0, ss_texsz[1]);
+	ss_rect[2] = clamp(ceil(rect[2] / ss_div), ss_rect[0], ss_texsz[0]);
+	ss_rect[3] = clamp(ceil(rect[3] / ss_div), ss_rect[1], ss_texsz[1]);
+	return;
+full:
+	ss_rect[0] = 0;
+	ss_rect[1] = 0;
+	ss_rect[2] = ss_texsz[0];
+	ss_rect[3] = ss_texsz[1];
+}
+
+/*
+ * Limits drawing into the screenshot-sized side buffers to ss_rect.
+ */
+static void
+ss_rect_scissor(void)
+{
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(ss_rect[0], ss_rect[1], ss_rect[2] - ss_rect[0],
+	    ss_rect[3] - ss_rect[1]);
+}
+
 GLint
 librain_get_current_fbo(void)
 {
@@ -696,9 +873,16 @@ librain_refresh_screenshot(void)
 
 	glBindFramebufferEXT(GL_READ_FRAMEBUFFER, old_fbo);
 	glBindFramebufferEXT(GL_DRAW_FRAMEBUFFER, screenshot_fbo);
-	glBlitFramebuffer(cur_vp[0], cur_vp[1], cur_vp[0] + cur_vp[2],
-	    cur_vp[1] + cur_vp[3], 0, 0, ss_texsz[0], ss_texsz[1],
-	    GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	/*
+	 * Only the part of the screen which the glass can show is copied,
+	 * see update_ss_rect. The rest of the texture keeps stale data.
+	 */
+	glBlitFramebuffer(cur_vp[0] + ss_rect[0] * ss_div,
+	    cur_vp[1] + ss_rect[1] * ss_div,
+	    cur_vp[0] + MIN(ss_rect[2] * (GLint)ss_div, cur_vp[2]),
+	    cur_vp[1] + MIN(ss_rect[3] * (GLint)ss_div, cur_vp[3]),
+	    ss_rect[0], ss_rect[1], ss_rect[2], ss_rect[3],
+	    GL_COLOR_BUFFER_BIT, (ss_div > 1 ? GL_LINEAR : GL_NEAREST));
 	glBindFramebufferEXT(GL_DRAW_FRAMEBUFFER, old_fbo);
 
 	glutils_debug_pop();
@@ -706,9 +890,27 @@ librain_refresh_screenshot(void)
 	GLUTILS_ASSERT_NO_ERROR();
 }
 
+static void
+z_depth_draw_group(obj8_t *obj, const char *group_id, GLuint prog)
+{
+	if (z_depth_coarsest_lod) {
+		obj8_draw_group_lod(obj, group_id, prog, glob_pvm,
+		    OBJ8_LOD_COARSEST);
+	} else {
+		obj8_draw_group(obj, group_id, prog, glob_pvm);
+	}
+}
+
 void
 librain_draw_z_depth(obj8_t *obj, const char **z_depth_group_ids)
 {
+	/*
+	 * Unless we're visualizing the UV mapping in debug mode, we only
+	 * need vertex positions, which lets obj8 use its position-only
+	 * vertex buffer, if the object has one (see obj8_parse_opts_t).
+	 */
+	GLuint prog = (debug_draw ? z_depth_prog : z_depth_pos_prog);
+
 	check_librain_init();
 
 	if (!prepare_ran)
@@ -719,24 +921,26 @@ librain_draw_z_depth(obj8_t *obj, const char **z_depth_group_ids)
 
 	if (!debug_draw)
 		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-	glUseProgram(z_depth_prog);
+	glUseProgram(prog);
 	glEnable(GL_DEPTH_TEST);
 	glDepthMask(GL_TRUE);
+	/* lets arena objects keep their bindings across the groups */
+	obj8_geom_arena_batch_begin();
 	if (z_depth_group_ids != NULL) {
 		for (int i = 0; z_depth_group_ids[i] != NULL; i++) {
 			glutils_debug_push(0, "librain_draw_z_depth(%s, %s)",
 			    lacf_basename(obj8_get_filename(obj)),
 			    z_depth_group_ids[i]);
-			obj8_draw_group(obj, z_depth_group_ids[i],
-			    z_depth_prog, glob_pvm);
+			z_depth_draw_group(obj, z_depth_group_ids[i], prog);
 			glutils_debug_pop();
 		}
 	} else {
 		glutils_debug_push(0, "librain_draw_z_depth(%s, NULL)",
 		    lacf_basename(obj8_get_filename(obj)));
-		obj8_draw_group(obj, NULL, z_depth_prog, glob_pvm);
+		z_depth_draw_group(obj, NULL, prog);
 		glutils_debug_pop();
 	}
+	obj8_geom_arena_batch_end();
 	glUseProgram(0);
 	if (!debug_draw)
 		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
@@ -1340,13 +1544,96 @@ wiper_debug_add(GLuint prog, const glass_info_t *gi, int i)
 	return (B_TRUE);
 }
 
+static void
+draw_glass_obj(const glass_info_t *gi, GLuint prog, const char *pass)
+{
+	if (gi->glass->group_ids != NULL) {
+		for (int i = 0; gi->glass->group_ids[i] != NULL; i++) {
+			glutils_debug_push(0, "%s(%s)", pass,
+			    gi->glass->group_ids[i]);
+			obj8_draw_group(gi->glass->obj,
+			    gi->glass->group_ids[i], prog, glob_pvm);
+			glutils_debug_pop();
+		}
+	} else {
+		glutils_debug_push(0, "%s(NULL)", pass);
+		obj8_draw_group(gi->glass->obj, NULL, prog, glob_pvm);
+		glutils_debug_pop();
+	}
+}
+
+/*
+ * Renders the prepped displaced texture and applies variable smudging
+ * based on water depth. `vp' is the viewport of the render target.
+ */
+static void
+draw_ws_smudge(const glass_info_t *gi, const GLint vp[4])
+{
+	GLuint prog =
+	    (gi->qual.use_compute ? ws_smudge_comp_prog : ws_smudge_prog);
+
+	glUseProgram(prog);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, screenshot_tex);
+	glUniform1i(glGetUniformLocation(prog, "screenshot_tex"), 0);
+	glUniform2f(glGetUniformLocation(prog, "screenshot_tex_sz"),
+	    ss_texsz[0], ss_texsz[1]);
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, ws_smudge_tex);
+	glUniform1i(glGetUniformLocation(prog, "ws_tex"), 1);
+
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, gi->water_depth_tex[!gi->water_depth_cur]);
+	glUniform1i(glGetUniformLocation(prog, "depth_tex"), 2);
+
+	glUniform4f(glGetUniformLocation(prog, "vp"),
+	    vp[0], vp[1], vp[2], vp[3]);
+	glUniform1i(glGetUniformLocation(prog, "low_res"), ss_div > 1);
+	glUniform1f(glGetUniformLocation(prog, "blur_scale"), 1.0 / ss_div);
+
+	draw_glass_obj(gi, prog, "ws_smudge");
+}
+
+/*
+ * Composites the reduced resolution smudge pass output in ws_lowres_tex
+ * onto the screen. See ws_upsample.frag.
+ */
+static void
+draw_ws_upsample(const glass_info_t *gi)
+{
+	GLuint prog =
+	    (gi->qual.use_compute ? ws_upsample_comp_prog : ws_upsample_prog);
+
+	glUseProgram(prog);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, gi->water_depth_tex[!gi->water_depth_cur]);
+	glUniform1i(glGetUniformLocation(prog, "depth_tex"), 0);
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, ws_lowres_tex);
+	glUniform1i(glGetUniformLocation(prog, "ws_tex"), 1);
+
+	glUniform4f(glGetUniformLocation(prog, "vp"),
+	    cur_vp[0], cur_vp[1], cur_vp[2], cur_vp[3]);
+
+	draw_glass_obj(gi, prog, "ws_upsample");
+}
+
 static void
 draw_ws_effects(glass_info_t *gi, GLint old_fbo)
 {
+	static const GLfloat zero[4] = { 0, 0, 0, 0 };
 	GLuint prog = (gi->qual.use_compute ? ws_rain_comp_prog : ws_rain_prog);
+	const GLint ss_vp[4] = { 0, 0, ss_texsz[0], ss_texsz[1] };
+	GLboolean scissor = glIsEnabled(GL_SCISSOR_TEST);
+	GLint scissor_box[4];
 
 	glutils_debug_push(0, "draw_ws_effects(%s)", GLASS_NAME(gi));
 
+	glGetIntegerv(GL_SCISSOR_BOX, scissor_box);
 	glEnable(GL_DEPTH_TEST);
 
 	/*
@@ -1355,6 +1642,13 @@ draw_ws_effects(glass_info_t *gi, GLint old_fbo)
 	 */
 	glBindFramebufferEXT(GL_FRAMEBUFFER, ws_smudge_fbo);
 	glViewport(0, 0, ss_texsz[0], ss_texsz[1]);
+	ss_rect_scissor();
+	/*
+	 * At reduced resolution, the smudge pass uses the alpha channel of
+	 * this buffer to tell where the glass is.
+	 */
+	if (ss_div > 1)
+		glClearBufferfv(GL_COLOR, 0, zero);
 
 	glUseProgram(prog);
 
@@ -1371,7 +1665,8 @@ draw_ws_effects(glass_info_t *gi, GLint old_fbo)
 	glUniform1i(glGetUniformLocation(prog, "depth_tex"), 2);
 
 	glUniform4f(glGetUniformLocation(prog, "vp"),
-	    cur_vp[0], cur_vp[1], cur_vp[2], cur_vp[3]);
+	    ss_vp[0], ss_vp[1], ss_vp[2], ss_vp[3]);
+	glUniform1f(glGetUniformLocation(prog, "px_scale"), 1.0 / ss_div);
 
 	if (wipers_visible) {
 		unsigned num_wipers = 0;
@@ -1385,23 +1680,31 @@ draw_ws_effects(glass_info_t *gi, GLint old_fbo)
 		glUniform1i(glGetUniformLocation(prog, "num_wipers"), 0);
 	}
 
-	if (gi->glass->group_ids != NULL) {
-		for (int i = 0; gi->glass->group_ids[i] != NULL; i++) {
-			glutils_debug_push(0, "ws_rain(%s)",
-			    gi->glass->group_ids[i]);
-			obj8_draw_group(gi->glass->obj, gi->glass->group_ids[i],
-			    prog, glob_pvm);
-			glutils_debug_pop();
-		}
-	} else {
-		glutils_debug_push(0, "ws_rain(NULL)");
-		obj8_draw_group(gi->glass->obj, NULL, prog, glob_pvm);
-		glutils_debug_pop();
+	draw_glass_obj(gi, prog, "ws_rain");
+
+	if (ss_div > 1) {
+		/*
+		 * Reduced resolution: the smudge pass also goes to a side
+		 * buffer. Its alpha output is the water depth, so it must
+		 * not be blended.
+		 */
+		GLboolean blend = glIsEnabled(GL_BLEND);
+
+		glBindFramebufferEXT(GL_FRAMEBUFFER, ws_lowres_fbo);
+		glClearBufferfv(GL_COLOR, 0, zero);
+		glDisable(GL_BLEND);
+		draw_ws_smudge(gi, ss_vp);
+		if (blend)
+			glEnable(GL_BLEND);
 	}
 
 	/* Restore old framebuffer */
 	glBindFramebufferEXT(GL_FRAMEBUFFER, old_fbo);
 	glViewport(cur_vp[0], cur_vp[1], cur_vp[2], cur_vp[3]);
+	glScissor(scissor_box[0], scissor_box[1], scissor_box[2],
+	    scissor_box[3]);
+	if (!scissor)
+		glDisable(GL_SCISSOR_TEST);
 
 #if	APL
 	/*
@@ -1412,42 +1715,13 @@ draw_ws_effects(glass_info_t *gi, GLint old_fbo)
 #endif
 
 	/*
-	 * Final stage: render the prepped displaced texture and apply
-	 * variable smudging based on water depth.
+	 * Final stage: either smudge straight onto the screen, or upsample
+	 * the reduced resolution smudge output.
 	 */
-	prog = (gi->qual.use_compute ? ws_smudge_comp_prog : ws_smudge_prog);
-	glUseProgram(prog);
-
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, screenshot_tex);
-	glUniform1i(glGetUniformLocation(prog, "screenshot_tex"), 0);
-	glUniform2f(glGetUniformLocation(prog, "screenshot_tex_sz"),
-	    ss_texsz[0], ss_texsz[1]);
-
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, ws_smudge_tex);
-	glUniform1i(glGetUniformLocation(prog, "ws_tex"), 1);
-
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, gi->water_depth_tex[!gi->water_depth_cur]);
-	glUniform1i(glGetUniformLocation(prog, "depth_tex"), 2);
-
-	glUniform4f(glGetUniformLocation(prog, "vp"),
-	    cur_vp[0], cur_vp[1], cur_vp[2], cur_vp[3]);
-
-	if (gi->glass->group_ids != NULL) {
-		for (int i = 0; gi->glass->group_ids[i] != NULL; i++) {
-			glutils_debug_push(0, "ws_smudge(%s)",
-			    gi->glass->group_ids[i]);
-			obj8_draw_group(gi->glass->obj,
-			    gi->glass->group_ids[i], prog, glob_pvm);
-			glutils_debug_pop();
-		}
-	} else {
-		glutils_debug_push(0, "ws_smudge(NULL)");
-		obj8_draw_group(gi->glass->obj, NULL, prog, glob_pvm);
-		glutils_debug_pop();
-	}
+	if (ss_div > 1)
+		draw_ws_upsample(gi);
+	else
+		draw_ws_smudge(gi, cur_vp);
 
 #if	APL
 	/*
@@ -1500,6 +1774,11 @@ setup_priv_depth_buf(unsigned w, unsigned h)
 		glBindTexture(GL_TEXTURE_2D, priv_depth_tex);
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, w, h, 0,
 		    GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		librain_mem_free(LIBRAIN_MEM_Z_DEPTH, NULL,
+		    librain_mem_tex_bytes(GL_DEPTH_COMPONENT32F,
+		    priv_depth_tex_w, priv_depth_tex_h, 1));
+		librain_mem_alloc(LIBRAIN_MEM_Z_DEPTH, NULL,
+		    librain_mem_tex_bytes(GL_DEPTH_COMPONENT32F, w, h, 1));
 		priv_depth_tex_w = w;
 		priv_depth_tex_h = h;
 	}
@@ -1616,6 +1895,7 @@ librain_draw_prepare_eye(unsigned call_index, bool_t force)
 	glClear(GL_DEPTH_BUFFER_BIT);
 
 	update_ss_tex();
+	update_ss_rect();
 	librain_refresh_screenshot();
 
 	GLUTILS_ASSERT_NO_ERROR();
@@ -1769,6 +2049,23 @@ librain_set_wiper_angle(const librain_glass_t *glass, unsigned wiper_nr,
 	    glass);
 }
 
+/*
+ * Returns the GPU memory held by a glass' textures and droplet buffers.
+ * Before librain_init (or for a glass which isn't part of the current
+ * setup) this returns zero.
+ */
+LIBRAIN_EXPORT librain_mem_stat_t
+librain_get_glass_mem_stat(const librain_glass_t *glass)
+{
+	ASSERT(glass != NULL);
+
+	for (size_t i = 0; i < num_glass_infos; i++) {
+		if (glass_infos[i].glass == glass)
+			return (librain_mem_acct_get(&glass_infos[i].mem));
+	}
+	return ((librain_mem_stat_t){ 0 });
+}
+
 static void
 validate_glass(const librain_glass_t *glass)
 {
@@ -1841,6 +2138,8 @@ glass_info_init_compute_phys(glass_info_t *gi)
 	    GL_DYNAMIC_DRAW);
 
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	librain_mem_alloc(LIBRAIN_MEM_DROPLETS, &gi->mem,
+	    droplet_bytes + vertex_bytes + tails_bytes);
 
 	free(droplets);
 	free(vertices);
@@ -1874,6 +2173,7 @@ glass_info_init_compute_visual_droplets(glass_info_t *gi)
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_bytes, indices,
 	    GL_STATIC_DRAW);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	librain_mem_alloc(LIBRAIN_MEM_DROPLETS, &gi->mem, index_bytes);
 
 	free(indices);
 }
@@ -1913,6 +2213,7 @@ glass_info_init_compute_visual_tails(glass_info_t *gi)
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_bytes, indices,
 	    GL_STATIC_DRAW);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	librain_mem_alloc(LIBRAIN_MEM_DROPLETS, &gi->mem, index_bytes);
 
 	free(indices);
 }
@@ -2026,6 +2327,9 @@ glass_info_init(glass_info_t *gi, const librain_glass_t *glass)
 		    0, 0, B_FALSE);
 		IF_TEXSZ(TEXSZ_ALLOC_INSTANCE(librain_ws_temp_tex, glass,
 		    NULL, 0, GL_RED, GL_FLOAT, WS_TEMP_TEX_W, WS_TEMP_TEX_H));
+		librain_mem_alloc(LIBRAIN_MEM_GLASS_TEX, &gi->mem,
+		    librain_mem_tex_bytes(GL_R32F, WS_TEMP_TEX_W,
+		    WS_TEMP_TEX_H, 1));
 	}
 
 	/*
@@ -2042,6 +2346,9 @@ glass_info_init(glass_info_t *gi, const librain_glass_t *glass)
 			IF_TEXSZ(TEXSZ_ALLOC_INSTANCE(librain_water_depth_tex,
 			    glass, NULL, 0, GL_R8, GL_UNSIGNED_BYTE,
 			    DEPTH_TEX_SZ(gi), DEPTH_TEX_SZ(gi)));
+			librain_mem_alloc(LIBRAIN_MEM_GLASS_TEX, &gi->mem,
+			    librain_mem_tex_bytes(GL_R8, DEPTH_TEX_SZ(gi),
+			    DEPTH_TEX_SZ(gi), 1));
 		} else {
 			setup_texture(gi->water_depth_tex[i], GL_R16F,
 			    DEPTH_TEX_SZ(gi), DEPTH_TEX_SZ(gi),
@@ -2049,6 +2356,9 @@ glass_info_init(glass_info_t *gi, const librain_glass_t *glass)
 			IF_TEXSZ(TEXSZ_ALLOC_INSTANCE(librain_water_depth_tex,
 			    glass, NULL, 0, GL_R16F, GL_FLOAT,
 			    DEPTH_TEX_SZ(gi), DEPTH_TEX_SZ(gi)));
+			librain_mem_alloc(LIBRAIN_MEM_GLASS_TEX, &gi->mem,
+			    librain_mem_tex_bytes(GL_R16F, DEPTH_TEX_SZ(gi),
+			    DEPTH_TEX_SZ(gi), 1));
 		}
 		/*
 		 * The stencil always matches the depth texture size exactly,
@@ -2078,6 +2388,9 @@ glass_info_init(glass_info_t *gi, const librain_glass_t *glass)
 		IF_TEXSZ(TEXSZ_ALLOC_INSTANCE(librain_water_depth_tex,
 		    glass, NULL, 0, GL_STENCIL_INDEX8, GL_UNSIGNED_BYTE,
 		    DEPTH_TEX_SZ(gi), DEPTH_TEX_SZ(gi)));
+		librain_mem_alloc(LIBRAIN_MEM_GLASS_TEX, &gi->mem,
+		    librain_mem_tex_bytes(APL ? GL_DEPTH24_STENCIL8 :
+		    GL_STENCIL_INDEX8, DEPTH_TEX_SZ(gi), DEPTH_TEX_SZ(gi), 1));
 	}
 
 	/*
@@ -2106,6 +2419,9 @@ glass_info_init(glass_info_t *gi, const librain_glass_t *glass)
 	IF_TEXSZ(TEXSZ_ALLOC_INSTANCE(librain_water_norm_tex, glass, NULL, 0,
 	    GL_STENCIL_INDEX8, GL_UNSIGNED_BYTE, NORM_TEX_SZ(gi),
 	    NORM_TEX_SZ(gi)));
+	librain_mem_alloc(LIBRAIN_MEM_GLASS_TEX, &gi->mem,
+	    librain_mem_tex_bytes(GL_RG8, NORM_TEX_SZ(gi), NORM_TEX_SZ(gi),
+	    MIPLEVELS));
 
 	free(temp_tex);
 
@@ -2190,6 +2506,8 @@ glass_info_fini(glass_info_t *gi)
 	    glDeleteBuffers(1, &gi->tails_vtx_buf));
 	DESTROY_OP(gi->tails_idx_buf, 0,
 	    glDeleteBuffers(1, &gi->tails_idx_buf));
+
+	librain_mem_release(&gi->mem);
 }
 
 static bool_t
@@ -2210,6 +2528,7 @@ static void
 water_effects_fini(void)
 {
 	DESTROY_OP(z_depth_prog, 0, glDeleteProgram(z_depth_prog));
+	DESTROY_OP(z_depth_pos_prog, 0, glDeleteProgram(z_depth_pos_prog));
 	DESTROY_OP(stencil_init_prog, 0, glDeleteProgram(stencil_init_prog));
 	DESTROY_OP(ws_temp_prog, 0, glDeleteProgram(ws_temp_prog));
 	DESTROY_OP(rain_stage1_prog, 0, glDeleteProgram(rain_stage1_prog));
@@ -2221,6 +2540,9 @@ water_effects_fini(void)
 	DESTROY_OP(ws_smudge_prog, 0, glDeleteProgram(ws_smudge_prog));
 	DESTROY_OP(ws_smudge_comp_prog, 0,
 	    glDeleteProgram(ws_smudge_comp_prog));
+	DESTROY_OP(ws_upsample_prog, 0, glDeleteProgram(ws_upsample_prog));
+	DESTROY_OP(ws_upsample_comp_prog, 0,
+	    glDeleteProgram(ws_upsample_comp_prog));
 	DESTROY_OP(droplets_prog, 0, glDeleteProgram(droplets_prog));
 	DESTROY_OP(droplets_paint_prog, 0,
 	    glDeleteProgram(droplets_paint_prog));
@@ -2344,13 +2666,17 @@ librain_reload_gl_progs(void)
 	}
 
 	if (!reload_gl_prog(&z_depth_prog, &z_depth_prog_info) ||
+	    !reload_gl_prog(&z_depth_pos_prog, &z_depth_pos_prog_info) ||
 	    !reload_gl_prog(&stencil_init_prog, &stencil_init_prog_info) ||
 	    !reload_gl_prog(&ws_temp_prog, &ws_temp_prog_info) ||
 	    !reload_gl_prog(&rain_stage1_prog, &rain_stage1_prog_info) ||
 	    !reload_gl_prog(&rain_stage2_prog, &rain_stage2_prog_info) ||
 	    !reload_gl_prog(&ws_rain_prog, &ws_rain_prog_info) ||
 	    !reload_gl_prog(&ws_smudge_prog, &ws_smudge_prog_info) ||
-	    !reload_gl_prog(&ws_smudge_comp_prog, &ws_smudge_comp_prog_info)) {
+	    !reload_gl_prog(&ws_smudge_comp_prog, &ws_smudge_comp_prog_info) ||
+	    !reload_gl_prog(&ws_upsample_prog, &ws_upsample_prog_info) ||
+	    !reload_gl_prog(&ws_upsample_comp_prog,
+	    &ws_upsample_comp_prog_info)) {
 		return (B_FALSE);
 	}
 
@@ -2410,6 +2736,26 @@ setup_smudge_tex(void)
 	setup_color_fbo_for_tex(ws_smudge_fbo, ws_smudge_tex, 0, 0, B_FALSE);
 	IF_TEXSZ(TEXSZ_ALLOC(librain_ws_smudge_tex, GL_RGBA, GL_UNSIGNED_BYTE,
 	    ss_texsz[0], ss_texsz[1]));
+	librain_mem_alloc(LIBRAIN_MEM_SMUDGE, NULL,
+	    librain_mem_tex_bytes(GL_RGBA8, ss_texsz[0], ss_texsz[1], 1));
+
+	if (ss_div > 1) {
+		/* Output of the reduced resolution ws_smudge pass */
+		ASSERT0(ws_lowres_tex);
+		ASSERT0(ws_lowres_fbo);
+		glGenTextures(1, &ws_lowres_tex);
+		glGenFramebuffers(1, &ws_lowres_fbo);
+		setup_texture_filter(ws_lowres_tex, 1, GL_RGBA8, ss_texsz[0],
+		    ss_texsz[1], GL_RGBA, GL_UNSIGNED_BYTE, NULL, GL_NEAREST,
+		    GL_NEAREST);
+		setup_color_fbo_for_tex(ws_lowres_fbo, ws_lowres_tex, 0, 0,
+		    B_FALSE);
+		IF_TEXSZ(TEXSZ_ALLOC(librain_ws_lowres_tex, GL_RGBA,
+		    GL_UNSIGNED_BYTE, ss_texsz[0], ss_texsz[1]));
+		librain_mem_alloc(LIBRAIN_MEM_SMUDGE, NULL,
+		    librain_mem_tex_bytes(GL_RGBA8, ss_texsz[0], ss_texsz[1],
+		    1));
+	}
 
 	GLUTILS_ASSERT_NO_ERROR();
 }
@@ -2420,9 +2766,22 @@ destroy_smudge_tex(void)
 	if (ws_smudge_tex != 0) {
 		IF_TEXSZ(TEXSZ_FREE(librain_ws_smudge_tex, GL_RGBA,
 		    GL_UNSIGNED_BYTE, ss_texsz[0], ss_texsz[1]));
+		librain_mem_free(LIBRAIN_MEM_SMUDGE, NULL,
+		    librain_mem_tex_bytes(GL_RGBA8, ss_texsz[0], ss_texsz[1],
+		    1));
 	}
 	DESTROY_OP(ws_smudge_fbo, 0, glDeleteFramebuffers(1, &ws_smudge_fbo));
 	DESTROY_OP(ws_smudge_tex, 0, glDeleteTextures(1, &ws_smudge_tex));
+
+	if (ws_lowres_tex != 0) {
+		IF_TEXSZ(TEXSZ_FREE(librain_ws_lowres_tex, GL_RGBA,
+		    GL_UNSIGNED_BYTE, ss_texsz[0], ss_texsz[1]));
+		librain_mem_free(LIBRAIN_MEM_SMUDGE, NULL,
+		    librain_mem_tex_bytes(GL_RGBA8, ss_texsz[0], ss_texsz[1],
+		    1));
+	}
+	DESTROY_OP(ws_lowres_fbo, 0, glDeleteFramebuffers(1, &ws_lowres_fbo));
+	DESTROY_OP(ws_lowres_tex, 0, glDeleteTextures(1, &ws_lowres_tex));
 }
 
 /*
@@ -2548,6 +2907,8 @@ librain_init(const char *the_shaderpath, const librain_glass_t *glass,
 	    0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
 	IF_TEXSZ(TEXSZ_ALLOC(librain_screenshot_tex, GL_RGB, GL_UNSIGNED_BYTE,
 	    ss_texsz[0], ss_texsz[1]));
+	librain_mem_alloc(LIBRAIN_MEM_SCREENSHOT, NULL,
+	    librain_mem_tex_bytes(GL_RGB8, ss_texsz[0], ss_texsz[1], 1));
 
 	glGenFramebuffers(1, &screenshot_fbo);
 	glBindFramebufferEXT(GL_FRAMEBUFFER, screenshot_fbo);
@@ -2611,12 +2972,18 @@ librain_fini(void)
 	if (screenshot_tex != 0) {
 		IF_TEXSZ(TEXSZ_FREE(librain_screenshot_tex, GL_RGB,
 		    GL_UNSIGNED_BYTE, ss_texsz[0], ss_texsz[1]));
+		librain_mem_free(LIBRAIN_MEM_SCREENSHOT, NULL,
+		    librain_mem_tex_bytes(GL_RGB8, ss_texsz[0], ss_texsz[1],
+		    1));
 	}
 	DESTROY_OP(screenshot_fbo, 0, glDeleteFramebuffers(1, &screenshot_fbo));
 	DESTROY_OP(screenshot_tex, 0, glDeleteTextures(1, &screenshot_tex));
 
 	destroy_smudge_tex();
 
+	librain_mem_free(LIBRAIN_MEM_Z_DEPTH, NULL,
+	    librain_mem_tex_bytes(GL_DEPTH_COMPONENT32F, priv_depth_tex_w,
+	    priv_depth_tex_h, 1));
 	DESTROY_OP(priv_depth_tex, 0, glDeleteTextures(1, &priv_depth_tex));
 	priv_depth_tex_w = 0;
 	priv_depth_tex_h = 0;
@@ -2627,6 +2994,11 @@ librain_fini(void)
 		cur_vp[i] = DFL_VP_SIZE;
 	ss_texsz[0] = DFL_VP_SIZE;
 	ss_texsz[1] = DFL_VP_SIZE;
+	ss_div = 1;
+	ss_rect[0] = 0;
+	ss_rect[1] = 0;
+	ss_rect[2] = DFL_VP_SIZE;
+	ss_rect[3] = DFL_VP_SIZE;
 
 	GLUTILS_ASSERT_NO_ERROR();
 
@@ -2668,6 +3040,61 @@ librain_set_debug_draw(bool_t flag)
 	debug_draw = flag;
 }
 
+/*
+ * By setting this flag to true, librain_draw_z_depth will only draw the
+ * coarsest LOD (the one with the furthest ATTR_LOD range) of objects
+ * which contain LODs. This is usually enough to occlude the rain effects
+ * and saves drawing the detailed geometry in the z-depth pass.
+ */
+void
+librain_set_z_depth_coarsest_lod(bool_t flag)
+{
+	check_librain_init();
+	z_depth_coarsest_lod = flag;
+}
+
+/*
+ * By setting this flag to true, the screenshot copy and the windshield
+ * refraction and smudge passes are rendered at half resolution and then
+ * composited back onto the screen with a depth- and edge-aware
+ * upsample. This cuts the fill-rate cost of the windshield effects,
+ * which is mostly useful in VR and on low-end GPUs.
+ */
+void
+librain_set_low_res(bool_t flag)
+{
+	librain_set_low_res_div(flag ? 2 : 1);
+}
+
+/*
+ * Same as librain_set_low_res, but lets the caller pick the viewport
+ * divisor: 1 (full resolution), 2 (half) or 4 (quarter). The render
+ * targets are resized on the next frame.
+ */
+void
+librain_set_low_res_div(unsigned div)
+{
+	check_librain_init();
+	ASSERT(div == 1 || div == 2 || div == 4);
+	low_res_div = div;
+}
+
+/*
+ * By setting this flag to true, only the part of the screen covered by
+ * the glass objects (plus a margin for the refraction displacement) is
+ * copied into the screenshot texture each frame. The rest of the texture
+ * then holds stale pixels, so this is off by default: surf_ice surfaces
+ * sample the texture returned by librain_get_screenshot_tex outside of
+ * the glass, as may the caller's own effects. Only enable this if
+ * nothing reads the texture outside of the glass footprint.
+ */
+void
+librain_set_screenshot_scissor(bool_t flag)
+{
+	check_librain_init();
+	ss_scissor = flag;
+}
+
 /*
  * By setting this flag to true, the library will draw a visible outline
  * around the wiper area and where the wipers are located. This can be
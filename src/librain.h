@@ -459,6 +459,12 @@ LIBRAIN_EXPORT void librain_set_enabled(bool_t flag);
 LIBRAIN_EXPORT void librain_set_wiper_angle(const librain_glass_t *glass,
     unsigned wiper_nr, double angle_radians, bool_t is_moving);
 
+/*
+ * Memory accounting (see librain_mem.h for library-wide totals).
+ */
+LIBRAIN_EXPORT librain_mem_stat_t librain_get_glass_mem_stat(
+    const librain_glass_t *glass);
+
 /*
  * Helper functions for more advanced effects rendering.
  */
@@ -468,6 +474,9 @@ LIBRAIN_EXPORT GLuint librain_get_screenshot_tex(void);
 LIBRAIN_EXPORT void librain_refresh_screenshot(void);
 LIBRAIN_EXPORT bool_t librain_reload_gl_progs(void);
 LIBRAIN_EXPORT void librain_set_low_res(bool_t flag);
+LIBRAIN_EXPORT void librain_set_low_res_div(unsigned div);
+LIBRAIN_EXPORT void librain_set_screenshot_scissor(bool_t flag);
+LIBRAIN_EXPORT void librain_set_z_depth_coarsest_lod(bool_t flag);
 
 /*
  * Debugging support.
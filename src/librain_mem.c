@@ -0,0 +1,239 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2023 Saso Kiselkov. All rights reserved.
+ */
+
+#include <acfutils/assert.h>
+#include <acfutils/helpers.h>
+
+#include "librain_mem.h"
+
+/*
+ * Allocations happen on the drawing thread as well as on the obj8 and
+ * objmgr background threads, so all counters are updated atomically.
+ * They can be used before librain_init and after librain_fini (e.g. by
+ * standalone obj8 users), so we don't keep any lock that would need
+ * setting up.
+ */
+static librain_mem_stat_t cats[LIBRAIN_MEM_NUM_CATS];
+/* indexed by librain_mem_cat_is_gpu */
+static librain_mem_stat_t totals[2];
+
+static const char *cat_names[LIBRAIN_MEM_NUM_CATS] = {
+	"glass_tex",
+	"droplets",
+	"screenshot",
+	"smudge",
+	"z_depth",
+	"ice_tex",
+	"ice_readback",
+	"obj8_buf",
+	"obj8_arena",
+	"obj8_cpu",
+	"objmgr_tex",
+	"objmgr_rtt",
+	"objmgr_pbo"
+};
+
+static void
+stat_add(librain_mem_stat_t *st, uint64_t bytes)
+{
+	uint64_t cur = __atomic_add_fetch(&st->bytes, bytes,
+	    __ATOMIC_RELAXED);
+	uint64_t peak = __atomic_load_n(&st->peak, __ATOMIC_RELAXED);
+
+	while (cur > peak && !__atomic_compare_exchange_n(&st->peak, &peak,
+	    cur, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+static void
+stat_sub(librain_mem_stat_t *st, uint64_t bytes)
+{
+	uint64_t old = __atomic_fetch_sub(&st->bytes, bytes,
+	    __ATOMIC_RELAXED);
+
+	ASSERT3U(old, >=, bytes);
+	UNUSED(old);
+}
+
+static librain_mem_stat_t
+stat_read(const librain_mem_stat_t *st)
+{
+	return ((librain_mem_stat_t){
+	    .bytes = __atomic_load_n(&st->bytes, __ATOMIC_RELAXED),
+	    .peak = __atomic_load_n(&st->peak, __ATOMIC_RELAXED)
+	});
+}
+
+const char *
+librain_mem_cat_name(librain_mem_cat_t cat)
+{
+	ASSERT3U(cat, <, LIBRAIN_MEM_NUM_CATS);
+	return (cat_names[cat]);
+}
+
+bool
+librain_mem_cat_is_gpu(librain_mem_cat_t cat)
+{
+	ASSERT3U(cat, <, LIBRAIN_MEM_NUM_CATS);
+	return (cat != LIBRAIN_MEM_OBJ8_CPU);
+}
+
+librain_mem_stat_t
+librain_mem_get_stat(librain_mem_cat_t cat)
+{
+	ASSERT3U(cat, <, LIBRAIN_MEM_NUM_CATS);
+	return (stat_read(&cats[cat]));
+}
+
+/*
+ * Returns the sum of all GPU (`gpu' = true) or CPU categories. The peak
+ * is that of the sum, not the sum of the individual peaks.
+ */
+librain_mem_stat_t
+librain_mem_get_total(bool gpu)
+{
+	return (stat_read(&totals[gpu]));
+}
+
+/*
+ * Resets the high-water marks of all categories and totals to their
+ * current values, e.g. after a quality settings change. Per-instance
+ * high-water marks are unaffected.
+ */
+void
+librain_mem_reset_peaks(void)
+{
+	for (int i = 0; i < LIBRAIN_MEM_NUM_CATS; i++) {
+		__atomic_store_n(&cats[i].peak, __atomic_load_n(
+		    &cats[i].bytes, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+	}
+	for (int i = 0; i < 2; i++) {
+		__atomic_store_n(&totals[i].peak, __atomic_load_n(
+		    &totals[i].bytes, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+	}
+}
+
+/*
+ * Accounts `bytes' against `cat' and, if not NULL, against the owner's
+ * `acct'. Everything an owner holds can later be given back at once
+ * using librain_mem_release.
+ */
+void
+librain_mem_alloc(librain_mem_cat_t cat, librain_mem_acct_t *acct,
+    size_t bytes)
+{
+	ASSERT3U(cat, <, LIBRAIN_MEM_NUM_CATS);
+
+	stat_add(&cats[cat], bytes);
+	stat_add(&totals[librain_mem_cat_is_gpu(cat)], bytes);
+	if (acct != NULL) {
+		stat_add(&acct->stat, bytes);
+		__atomic_add_fetch(&acct->held[cat], bytes,
+		    __ATOMIC_RELAXED);
+	}
+}
+
+void
+librain_mem_free(librain_mem_cat_t cat, librain_mem_acct_t *acct,
+    size_t bytes)
+{
+	ASSERT3U(cat, <, LIBRAIN_MEM_NUM_CATS);
+
+	stat_sub(&cats[cat], bytes);
+	stat_sub(&totals[librain_mem_cat_is_gpu(cat)], bytes);
+	if (acct != NULL) {
+		stat_sub(&acct->stat, bytes);
+		VERIFY3U(__atomic_fetch_sub(&acct->held[cat], bytes,
+		    __ATOMIC_RELAXED), >=, bytes);
+	}
+}
+
+/*
+ * Gives back everything still accounted against `acct'.
+ */
+void
+librain_mem_release(librain_mem_acct_t *acct)
+{
+	ASSERT(acct != NULL);
+
+	for (int i = 0; i < LIBRAIN_MEM_NUM_CATS; i++) {
+		uint64_t held = __atomic_load_n(&acct->held[i],
+		    __ATOMIC_RELAXED);
+
+		if (held != 0)
+			librain_mem_free(i, acct, held);
+	}
+}
+
+librain_mem_stat_t
+librain_mem_acct_get(const librain_mem_acct_t *acct)
+{
+	ASSERT(acct != NULL);
+	return (stat_read(&acct->stat));
+}
+
+static unsigned
+fmt_bytes_per_px(GLint int_fmt)
+{
+	switch (int_fmt) {
+	case GL_R8:
+	case GL_RED:
+	case GL_STENCIL_INDEX8:
+		return (1);
+	case GL_RG8:
+	case GL_RG:
+	case GL_R16F:
+		return (2);
+	case GL_RGB8:
+	case GL_RGB:
+		/* drivers pad 3-channel textures to 4 bytes */
+	case GL_RGBA8:
+	case GL_RGBA:
+	case GL_R32F:
+	case GL_RG16F:
+	case GL_DEPTH24_STENCIL8:
+	case GL_DEPTH_COMPONENT24:
+	case GL_DEPTH_COMPONENT32F:
+		return (4);
+	case GL_RGBA16F:
+	case GL_RG32F:
+		return (8);
+	case GL_RGBA32F:
+		return (16);
+	default:
+		VERIFY_MSG(0, "unknown internal format %x", int_fmt);
+	}
+}
+
+/*
+ * Returns the size of a `w' x `h' texture with `levels' mip levels.
+ */
+size_t
+librain_mem_tex_bytes(GLint int_fmt, unsigned w, unsigned h,
+    unsigned levels)
+{
+	size_t px = 0;
+
+	ASSERT3U(levels, >, 0);
+	if (w == 0 || h == 0)
+		return (0);
+	for (unsigned i = 0; i < levels; i++)
+		px += (size_t)MAX(w >> i, 1) * MAX(h >> i, 1);
+
+	return (px * fmt_bytes_per_px(int_fmt));
+}
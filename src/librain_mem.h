@@ -0,0 +1,91 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2023 Saso Kiselkov. All rights reserved.
+ */
+
+#ifndef	_LIBRAIN_MEM_H_
+#define	_LIBRAIN_MEM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <acfutils/glew.h>
+
+#include "librain_common.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Memory accounting. Every GPU resource (and the larger CPU-side copies
+ * of geometry) which librain allocates is counted in one of these
+ * categories, as well as against its owning glass, surf_ice surface or
+ * object, where there is one. Texture sizes are computed from their
+ * dimensions and formats, so they don't include any driver padding.
+ */
+typedef enum {
+	LIBRAIN_MEM_GLASS_TEX,		/* water & temperature textures */
+	LIBRAIN_MEM_DROPLETS,		/* compute droplet buffers */
+	LIBRAIN_MEM_SCREENSHOT,		/* screenshot texture */
+	LIBRAIN_MEM_SMUDGE,		/* windshield smudge texture */
+	LIBRAIN_MEM_Z_DEPTH,		/* private depth buffer */
+	LIBRAIN_MEM_ICE_TEX,		/* surf_ice textures */
+	LIBRAIN_MEM_ICE_READBACK,	/* surf_ice pixel pack buffers */
+	LIBRAIN_MEM_OBJ8_BUF,		/* per-object obj8 buffers */
+	LIBRAIN_MEM_OBJ8_ARENA,		/* shared obj8 geometry arena */
+	LIBRAIN_MEM_OBJ8_CPU,		/* retained obj8 geometry (CPU) */
+	LIBRAIN_MEM_OBJMGR_TEX,		/* resident objmgr textures */
+	LIBRAIN_MEM_OBJMGR_RTT,		/* objmgr render-to-texture */
+	LIBRAIN_MEM_OBJMGR_PBO,		/* objmgr texture upload buffers */
+	LIBRAIN_MEM_NUM_CATS
+} librain_mem_cat_t;
+
+typedef struct {
+	uint64_t	bytes;		/* currently allocated */
+	uint64_t	peak;		/* high-water mark of `bytes' */
+} librain_mem_stat_t;
+
+LIBRAIN_EXPORT const char *librain_mem_cat_name(librain_mem_cat_t cat);
+LIBRAIN_EXPORT bool librain_mem_cat_is_gpu(librain_mem_cat_t cat);
+LIBRAIN_EXPORT librain_mem_stat_t librain_mem_get_stat(
+    librain_mem_cat_t cat);
+LIBRAIN_EXPORT librain_mem_stat_t librain_mem_get_total(bool gpu);
+LIBRAIN_EXPORT void librain_mem_reset_peaks(void);
+
+/*
+ * librain internal
+ */
+typedef struct {
+	librain_mem_stat_t	stat;
+	uint64_t		held[LIBRAIN_MEM_NUM_CATS];
+} librain_mem_acct_t;
+
+void librain_mem_alloc(librain_mem_cat_t cat, librain_mem_acct_t *acct,
+    size_t bytes);
+void librain_mem_free(librain_mem_cat_t cat, librain_mem_acct_t *acct,
+    size_t bytes);
+void librain_mem_release(librain_mem_acct_t *acct);
+librain_mem_stat_t librain_mem_acct_get(const librain_mem_acct_t *acct);
+size_t librain_mem_tex_bytes(GLint int_fmt, unsigned w, unsigned h,
+    unsigned levels);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _LIBRAIN_MEM_H_ */
@@ -21,7 +21,10 @@
 #include <stdlib.h>
 #include <errno.h>
 
+#include <XPLMProcessing.h>
+
 #include <acfutils/assert.h>
+#include <acfutils/glctx.h>
 #include <acfutils/helpers.h>
 #include <acfutils/glutils.h>
 #include <acfutils/log.h>
@@ -29,26 +32,52 @@
 #include <acfutils/perf.h>
 #include <acfutils/safe_alloc.h>
 #include <acfutils/thread.h>
+#include <acfutils/time.h>
 
 #include "librain_glpriv.h"
 #include "obj8.h"
+#include "obj8_geom.h"
+#include "obj8_occl.h"
 #ifdef	DLLMODE
 #include "librain.h"
 #endif
 
 #define	ANIM_ALLOC_STEP	8
 /*
- * After rendering starts, we only try to lookup datarefs for a little
- * while. If within 10 draw cycles the dataref isn't populated, we give
- * up to avoid lags performing costly dataref lookups for datarefs that
- * are likely never going to show up.
+ * Retry interval limits for datarefs which haven't been found yet. The
+ * interval doubles after every failed attempt, so that datarefs published
+ * late by other plugins get picked up quickly, without us constantly
+ * hammering the dataref lookup for ones which never show up.
+ */
+#define	DR_LOOKUP_IVAL_MIN	MSEC2USEC(100)
+#define	DR_LOOKUP_IVAL_MAX	SEC2USEC(5)
+/*
+ * After MAX_DR_LOOKUPS failed attempts we give up on a dataref, as it is
+ * likely never going to show up. With the intervals above, that's after
+ * about 20 seconds.
+ */
+#define	MAX_DR_LOOKUPS		10
+/*
+ * Microseconds per flight loop spent on lazy lookups, see
+ * obj8_drset_resolve.
  */
-#define	MAX_DR_LOOKUPS	10
+#define	DR_LAZY_RESOLVE_BUDGET	200
 
 #define	INVALID_DRSET_IDX	UINT_MAX
+#define	LOD_BY_DIST		(OBJ8_LOD_COARSEST - 1)
+/* obj8_parse_stream chunk size */
+#define	READ_BUF_SZ		65536
+
+#define	ARENA_CHUNK_SZ		65536
+#define	ARENA_ALIGN		16
+#define	ARENA_ROUNDUP(x)	\
+	(((x) + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1))
+#define	ARENA_HDR_SZ		ARENA_ROUNDUP(sizeof (obj8_arena_chunk_t))
 
 TEXSZ_MK_TOKEN(obj8_vtx_buf);
 TEXSZ_MK_TOKEN(obj8_idx_buf);
+TEXSZ_MK_TOKEN(obj8_pos_buf);
+TEXSZ_MK_TOKEN(obj8_occl_buf);
 
 typedef enum {
 	OBJ8_CMD_GROUP,
@@ -59,25 +88,75 @@ typedef enum {
 	OBJ8_CMD_ATTR_LIGHT_LEVEL,
 	OBJ8_CMD_ATTR_DRAW_ENABLE,
 	OBJ8_CMD_ATTR_DRAW_DISABLE,
+	/* constant-folded ANIM_rotate/trans */
+	OBJ8_CMD_ANIM_STATIC,
 	OBJ8_NUM_CMDS
 } obj8_cmd_type_t;
 
 typedef struct {
 	unsigned	vtx_off;	/* offset into index table */
 	unsigned	n_vtx;		/* number of vertices in geometry */
+	unsigned	occl_off;	/* offset into occluder index table */
+	unsigned	occl_n_vtx;	/* number of vertices in occluder */
+	vec3		bounds[2];	/* min & max vertex position */
 	char		group_id[32];	/* Contents of X-GROUP-ID attribute */
 	bool_t		double_sided;
 	unsigned	manip_idx;
 	list_node_t	node;
 } obj8_geom_t;
 
+typedef struct {
+	float		min_dist;	/* meters */
+	float		max_dist;	/* meters */
+} obj8_lod_t;
+
+typedef enum {
+	BG_UPLOAD_NONE,		/* uploaded from the drawing thread */
+	BG_UPLOAD_QUEUED,	/* waiting for the background uploader */
+	BG_UPLOAD_RUNNING,	/* background upload in progress */
+	BG_UPLOAD_DONE		/* buffers created, fence pending */
+} bg_upload_t;
+
+typedef enum {
+	READBACK_NONE,
+	READBACK_REQUESTED,	/* waiting for the next draw to start it */
+	READBACK_PENDING	/* copy issued, fence pending */
+} readback_t;
+
+typedef struct obj8_arena_chunk_s {
+	struct obj8_arena_chunk_s	*next;
+	size_t				size;	/* bytes after header */
+	size_t				used;
+} obj8_arena_chunk_t;
+
+typedef struct {
+	obj8_arena_chunk_t	*head;		/* chunk being filled */
+	void			*last;		/* last allocation */
+} obj8_arena_t;
+
+/*
+ * Translation keys are kept interleaved, so that the keyframe array of the
+ * animation being parsed can always be grown in place in the arena.
+ */
+typedef struct {
+	double		value;
+	vect3_t		pos;
+} obj8_trans_key_t;
+
 typedef struct obj8_cmd_s {
 	obj8_cmd_type_t		type;
 	struct obj8_cmd_s	*parent;
 	unsigned		drset_idx;
+	unsigned		idx;	/* index into the draw caches */
+	/*
+	 * Constant local transform of an ANIM_STATIC command, unused by
+	 * all other commands. Kept unaligned, copy it to a mat4 before use.
+	 */
+	float			xform[4][4];
 	union {
 		struct {
 			list_t	cmds;
+			int	lod;	/* index into obj->lods, or -1 */
 		} group;
 		struct {
 			double	val[2];
@@ -90,10 +169,9 @@ typedef struct obj8_cmd_s {
 			vect3_t	axis;
 		} rotate;
 		struct {
-			size_t	n_pts;
-			size_t	n_pts_cap;
-			double	*values;
-			vect3_t	*pos;
+			size_t		n_pts;
+			size_t		n_pts_cap;
+			obj8_trans_key_t *keys;
 		} trans;
 		struct {
 			float	min_val;
@@ -124,31 +202,95 @@ struct obj8_s {
 	obj8_drset_t		*drset;
 	bool			drset_auto_update;
 
-	GLuint			last_prog;
-	/* uniforms */
-	GLint			pvm_loc;
-	GLint			light_level_loc;
-	GLint			manip_idx_loc;
-	/* vertex attributes */
-	GLint			pos_loc;
-	GLint			norm_loc;
-	GLint			tex0_loc;
 	/*
-	 * When using VAOs, it is critical that we NEVER attempt to draw from
-	 * a thread other than the one that originally generated the VAO,
-	 * because VAOs are thread-local and not shared even between shared
-	 * contexts.
+	 * VAOs aren't shared even between shared contexts, so every thread
+	 * which draws the object gets its own (see obj8_vao_cache_get),
+	 * while the buffers below are shared by all of them. Each thread's
+	 * slot also holds its program locations and its draw_cache_t.
 	 */
-	thread_id_t		upload_thread_id;
-	GLuint			vao;
+	obj8_vao_cache_t	vaos;
 	obj8_vtx_t		*vtx_table;
 	GLuint			vtx_buf;
 	unsigned		vtx_cap;
+	/*
+	 * Optional tightly packed copy of only the vertex positions. Used
+	 * in place of the full vertex buffer with programs which don't
+	 * read normals or texture coordinates (e.g. depth-only passes).
+	 * `want_pos_buf' is fixed at creation, before the loader starts.
+	 */
+	bool			want_pos_buf;
+	GLuint			pos_buf;
 	GLuint			*idx_table;
 	GLuint			idx_buf;
 	unsigned		idx_cap;
+	/*
+	 * Optional simplified occluder index list (see obj8_occl.c). Each
+	 * TRIS command references its part of it through `occl_off' and
+	 * `occl_n_vtx'. Used in place of the full mesh with programs which
+	 * only read vertex positions.
+	 */
+	float			occl_tol;
+	GLuint			*occl_idx_table;
+	GLuint			occl_idx_buf;
+	unsigned		occl_idx_cap;
+	/*
+	 * When the shared geometry arena is enabled at upload time, the
+	 * geometry is stored in it (see obj8_geom.c) instead of the
+	 * object's own buffers above.
+	 */
+	bool			in_arena;
+	obj8_geom_region_t	arena_vtx;
+	obj8_geom_region_t	arena_idx;
+	obj8_geom_region_t	arena_occl;
+	/*
+	 * The upload happens on the first draw of whichever thread gets
+	 * there first, serialized by `upload_lock'. `uploaded' is set last
+	 * (with release semantics), after which the buffers and the flags
+	 * below no longer change, so draws can check it without the lock.
+	 */
+	mutex_t			upload_lock;
+	bool			uploaded;
+	bool			has_pos;
+	bool			has_occl;
+	/*
+	 * Background upload state (see uploader_worker). `bg_upload' and
+	 * `upload_node' are protected by uploader.lock.
+	 */
+	bg_upload_t		bg_upload;
+	GLsync			upload_fence;
+	list_node_t		upload_node;
+	/*
+	 * CPU geometry retention after upload. Swapping out `vtx_table' and
+	 * `idx_table' after load completion, as well as `readback', are
+	 * protected by `lock'. The readback itself is driven from draws,
+	 * its buffer and fence are protected by `upload_lock'.
+	 */
+	obj8_retain_t		retain;
+	readback_t		readback;
+	GLuint			readback_buf;
+	GLsync			readback_fence;
+	/* own buffers and retained tables, not the shared arena */
+	librain_mem_acct_t	mem;
 	mat4			*matrix;
+	obj8_arena_t		arena;		/* holds the command tree */
 	obj8_cmd_t		*top;
+	unsigned		n_cmds;
+	/*
+	 * ATTR_LOD ranges. Each LOD's commands are held in a group directly
+	 * under `top', whose `group.lod' field points into this array.
+	 */
+	obj8_lod_t		*lods;
+	unsigned		n_lods;
+	/*
+	 * Map from drset index to the animation commands reading it, used
+	 * to invalidate only those parts of the transform cache affected
+	 * by changed datarefs. Entries of index `i' are stored at
+	 * dep_cmds[dep_off[i]] .. dep_cmds[dep_off[i + 1] - 1]. Built by
+	 * the loader and immutable afterwards.
+	 */
+	unsigned		*dep_off;
+	obj8_cmd_t		**dep_cmds;
+	unsigned		n_folded_cmds;
 
 	thread_t		loader;
 	mutex_t			lock;
@@ -158,32 +300,174 @@ struct obj8_s {
 	bool_t			load_stop;
 };
 
+/*
+ * Animation transform cache of a drawing thread, indexed by the
+ * commands' `idx'. The meaning of an entry depends on the command:
+ * GROUP: transform on entry into the group, relative to the object.
+ *	`dirty' means the transforms of the group's contents must be
+ *	recomputed on the next draw.
+ * ANIM_ROTATE/ANIM_TRANS: the local transform of the animation.
+ *	`dirty' means the animation must be re-evaluated.
+ * TRIS: accumulated transform to apply to the geometry.
+ * The matrices are kept unaligned, copy them to a mat4 before use.
+ */
+typedef struct {
+	uint64_t	dep_serial;	/* drset serial we last saw */
+	bool		*dirty;
+	float		(*xform)[4][4];
+} draw_cache_t;
+
+/*
+ * State of a single draw call, so that nothing on the object itself
+ * needs to be modified while drawing.
+ */
+typedef struct {
+	const char		*groupname;
+	const float		*dr_values;
+	const obj8_prog_locs_t	*locs;
+	draw_cache_t		*cache;
+	int			lod;		/* see lod_is_drawn */
+	float			dist;
+	int			coarsest_lod;
+	bool			draw_occl;
+} draw_ctx_t;
+
+/*
+ * The loader reads from exactly one of: a file (`fp'), a memory buffer
+ * (`src' points to our own copy of it in `read_buf'), or a reader
+ * callback (`src' points to `read_buf', refilled on demand).
+ */
 typedef struct {
 	FILE		*fp;
+	const char	*src;
+	size_t		src_len;
+	size_t		src_pos;
+	obj8_read_cb_t	read_cb;
+	obj8_close_cb_t	close_cb;
+	void		*read_userinfo;
+	char		*read_buf;
+	bool		read_error;
 	vect3_t		pos_offset;
 	vect3_t		cg_offset;
 	obj8_t		*obj;
 } obj8_load_info_t;
 
+static unsigned fold_static_cmds(const obj8_t *obj, obj8_cmd_t *group);
+static void compute_geom_bounds(obj8_t *obj, obj8_cmd_t *group);
+static void build_occluder(obj8_t *obj, obj8_cmd_t *group);
+static void uploader_enqueue(obj8_t *obj);
+static void build_anim_deps(obj8_t *obj);
+static void drset_unref(obj8_drset_t *drset, unsigned idx);
+static float drset_lazy_floop(float elapsed1, float elapsed2, int counter,
+    void *refcon);
+
+/*
+ * The command tree, including the animation keyframes, is allocated from
+ * a per-object arena. Allocations are handed out sequentially as the
+ * file is parsed, so the tree ends up laid out in traversal order, and
+ * the whole thing is freed in one go when the object is freed.
+ */
+static void *
+arena_alloc(obj8_arena_t *arena, size_t sz)
+{
+	obj8_arena_chunk_t *chunk = arena->head;
+	void *ptr;
+
+	sz = ARENA_ROUNDUP(sz);
+	if (chunk == NULL || chunk->size - chunk->used < sz) {
+		size_t chunk_sz = MAX(sz, ARENA_CHUNK_SZ);
+
+		chunk = safe_calloc(1, ARENA_HDR_SZ + chunk_sz);
+		chunk->size = chunk_sz;
+		chunk->next = arena->head;
+		arena->head = chunk;
+	}
+	ptr = (uint8_t *)chunk + ARENA_HDR_SZ + chunk->used;
+	chunk->used += sz;
+	arena->last = ptr;
+
+	return (ptr);
+}
+
+/*
+ * Grows an arena allocation. If `ptr' was the last allocation and there's
+ * room left in its chunk, it is simply extended in place. Otherwise the
+ * contents are copied to a new allocation (the old one is only reclaimed
+ * once the whole arena is freed).
+ */
+static void *
+arena_realloc(obj8_arena_t *arena, void *ptr, size_t old_sz, size_t new_sz)
+{
+	obj8_arena_chunk_t *chunk = arena->head;
+	void *new_ptr;
+
+	ASSERT3U(new_sz, >=, old_sz);
+	if (ptr == NULL)
+		return (arena_alloc(arena, new_sz));
+	old_sz = ARENA_ROUNDUP(old_sz);
+	new_sz = ARENA_ROUNDUP(new_sz);
+	if (ptr == arena->last &&
+	    chunk->size - chunk->used >= new_sz - old_sz) {
+		chunk->used += new_sz - old_sz;
+		return (ptr);
+	}
+	new_ptr = arena_alloc(arena, new_sz);
+	memcpy(new_ptr, ptr, old_sz);
+
+	return (new_ptr);
+}
+
+static void
+arena_free(obj8_arena_t *arena)
+{
+	obj8_arena_chunk_t *chunk, *next;
+
+	for (chunk = arena->head; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	memset(arena, 0, sizeof (*arena));
+}
+
+/*
+ * An array dataref referenced by one or more indexed drset entries. On
+ * every update we fetch the range of elements covering all entries using
+ * a single dr_getvf32 call, instead of one call per entry.
+ */
+typedef struct {
+	char		dr_name[128];	/* base name, without "[N]" */
+	dr_t		dr;
+	int		off_min;
+	int		off_max;
+	float		*values;	/* off_max - off_min + 1 elements */
+
+	avl_node_t	tree_node;
+} drset_arr_t;
+
 typedef struct {
 	unsigned	index;
 	int		dr_offset;
 	char		dr_name[128];
-	bool		dr_found;
-	unsigned	dr_lookup_done;
+	bool		dr_found;	/* protected by drset->lock */
+	/* lookup state, protected by drset->resolve_lock */
+	uint64_t	next_lookup_t;	/* microclock() of next lookup */
+	uint64_t	lookup_ival;
+	unsigned	n_lookups;
+	/*
+	 * Number of obj8_drset_add calls for this entry, less the ones
+	 * whose users have since been optimized away. Entries nobody uses
+	 * anymore, or which have no dataref at all, are never looked up.
+	 */
+	unsigned	refs;
+	bool		no_lookup;
 	dr_t		dr;
 	float		trig_delta;
+	drset_arr_t	*arr;		/* set if dr_offset >= 0 */
 
 	avl_node_t	tree_node;
 	list_node_t	list_node;
 } drset_dr_t;
 
-static inline bool
-use_vaos(void)
-{
-	return (GLEW_VERSION_3_0);
-}
-
 static void
 obj8_geom_init(obj8_geom_t *geom, const char *group_id, bool_t double_sided,
     unsigned manip_idx, unsigned off, unsigned len, GLuint vtx_cap,
@@ -205,12 +489,15 @@ obj8_geom_init(obj8_geom_t *geom, const char *group_id, bool_t double_sided,
 }
 
 static obj8_cmd_t *
-obj8_cmd_alloc(obj8_cmd_type_t type, obj8_cmd_t *parent)
+obj8_cmd_alloc(obj8_t *obj, obj8_cmd_type_t type, obj8_cmd_t *parent)
 {
-	obj8_cmd_t *cmd = safe_calloc(1, sizeof (*cmd));
+	obj8_cmd_t *cmd = arena_alloc(&obj->arena, sizeof (*cmd));
+	mat4 ident = GLM_MAT4_IDENTITY_INIT;
 
 	cmd->type = type;
 	cmd->parent = parent;
+	cmd->idx = obj->n_cmds++;
+	memcpy(cmd->xform, ident, sizeof (ident));
 	if (parent != NULL) {
 		ASSERT3U(parent->type, ==, OBJ8_CMD_GROUP);
 		list_insert_tail(&parent->group.cmds, cmd);
@@ -220,6 +507,7 @@ obj8_cmd_alloc(obj8_cmd_type_t type, obj8_cmd_t *parent)
 	if (type == OBJ8_CMD_GROUP) {
 		list_create(&cmd->group.cmds, sizeof (obj8_cmd_t),
 		    offsetof(obj8_cmd_t, list_node));
+		cmd->group.lod = -1;
 	}
 
 	return (cmd);
@@ -230,7 +518,8 @@ parse_hide_show(obj8_t *obj, bool_t set_val, const char *fmt,
     const char *line, const char *filename, int linenr, obj8_cmd_t *parent)
 {
 	char dr_name[256] = { 0 };
-	obj8_cmd_t *cmd = obj8_cmd_alloc(OBJ8_CMD_ANIM_HIDE_SHOW, parent);
+	obj8_cmd_t *cmd = obj8_cmd_alloc(obj, OBJ8_CMD_ANIM_HIDE_SHOW,
+	    parent);
 	int n = sscanf(line, fmt, &cmd->hide_show.val[0],
 	    &cmd->hide_show.val[1], dr_name);
 
@@ -264,8 +553,8 @@ anim_group_check(obj8_cmd_t *cmd, obj8_cmd_type_t type, const char *name,
 }
 
 static bool_t
-parse_trans_key(const char *line, obj8_cmd_t *cmd, const char *filename,
-    int linenr)
+parse_trans_key(obj8_t *obj, const char *line, obj8_cmd_t *cmd,
+    const char *filename, int linenr)
 {
 	size_t n;
 
@@ -276,17 +565,16 @@ parse_trans_key(const char *line, obj8_cmd_t *cmd, const char *filename,
 	if (cmd->trans.n_pts_cap == cmd->trans.n_pts) {
 		int new_cap = cmd->trans.n_pts_cap + ANIM_ALLOC_STEP;
 
-		cmd->trans.values = safe_realloc(cmd->trans.values,
-		    new_cap * sizeof (*cmd->trans.values));
-		cmd->trans.pos = safe_realloc(cmd->trans.pos,
-		    new_cap * sizeof (*cmd->trans.pos));
+		cmd->trans.keys = arena_realloc(&obj->arena, cmd->trans.keys,
+		    cmd->trans.n_pts_cap * sizeof (*cmd->trans.keys),
+		    new_cap * sizeof (*cmd->trans.keys));
 		cmd->trans.n_pts_cap = new_cap;
 	}
 	n = cmd->trans.n_pts;
 	cmd->trans.n_pts++;
 	if (sscanf(line, "ANIM_trans_key %lf %lf %lf %lf",
-	    &cmd->trans.values[n], &cmd->trans.pos[n].x,
-	    &cmd->trans.pos[n].y, &cmd->trans.pos[n].z) != 4) {
+	    &cmd->trans.keys[n].value, &cmd->trans.keys[n].pos.x,
+	    &cmd->trans.keys[n].pos.y, &cmd->trans.keys[n].pos.z) != 4) {
 		logMsg("%s:%d: failed to parse ANIM_trans_key",
 		    filename, linenr);
 		return (B_FALSE);
@@ -296,8 +584,8 @@ parse_trans_key(const char *line, obj8_cmd_t *cmd, const char *filename,
 }
 
 static bool_t
-parse_rotate_key(const char *line, obj8_cmd_t *cmd, const char *filename,
-    int linenr)
+parse_rotate_key(obj8_t *obj, const char *line, obj8_cmd_t *cmd,
+    const char *filename, int linenr)
 {
 	size_t n;
 
@@ -308,7 +596,8 @@ parse_rotate_key(const char *line, obj8_cmd_t *cmd, const char *filename,
 	if (cmd->rotate.n_pts_cap == cmd->rotate.n_pts) {
 		int new_cap = cmd->rotate.n_pts_cap + ANIM_ALLOC_STEP;
 
-		cmd->rotate.pts = safe_realloc(cmd->rotate.pts,
+		cmd->rotate.pts = arena_realloc(&obj->arena, cmd->rotate.pts,
+		    cmd->rotate.n_pts_cap * sizeof (*cmd->rotate.pts),
 		    new_cap * sizeof (*cmd->rotate.pts));
 		cmd->rotate.n_pts_cap = new_cap;
 	}
@@ -583,6 +872,79 @@ check_line_prefix(const char *line, const char *prefix)
 	    (line[prefix_len] == '\0' || isspace(line[prefix_len])));
 }
 
+static bool
+src_fill(obj8_load_info_t *info)
+{
+	size_t n = 0;
+
+	if (info->read_cb == NULL || info->read_error)
+		return (false);
+	if (!info->read_cb(info->read_buf, READ_BUF_SZ, &n,
+	    info->read_userinfo)) {
+		info->read_error = true;
+		return (false);
+	}
+	if (n == 0)
+		return (false);
+	ASSERT3U(n, <=, READ_BUF_SZ);
+	info->src = info->read_buf;
+	info->src_len = n;
+	info->src_pos = 0;
+
+	return (true);
+}
+
+/*
+ * Reads the next line of the object's source into `line', growing it as
+ * necessary. Same semantics as lacf_getline: the line is returned with
+ * its trailing newline character, and the return value is its length,
+ * or -1 once we've run out of data.
+ */
+static ssize_t
+src_getline(obj8_load_info_t *info, char **line, size_t *cap)
+{
+	size_t n = 0;
+
+	if (info->fp != NULL)
+		return (lacf_getline(line, cap, info->fp));
+
+	for (;;) {
+		const char *start, *nl;
+		size_t take;
+
+		if (info->src_pos == info->src_len && !src_fill(info))
+			break;
+		start = &info->src[info->src_pos];
+		nl = memchr(start, '\n', info->src_len - info->src_pos);
+		take = (nl != NULL ? (size_t)(nl - start) + 1 :
+		    info->src_len - info->src_pos);
+		if (n + take + 1 > *cap) {
+			*cap = MAX(n + take + 1, 2 * (*cap));
+			*line = safe_realloc(*line, *cap);
+		}
+		memcpy(&(*line)[n], start, take);
+		n += take;
+		info->src_pos += take;
+		if (nl != NULL)
+			break;
+	}
+	if (n == 0)
+		return (-1);
+	(*line)[n] = '\0';
+
+	return (n);
+}
+
+static void
+src_close(obj8_load_info_t *info)
+{
+	if (info->fp != NULL)
+		fclose(info->fp);
+	if (info->close_cb != NULL)
+		info->close_cb(info->read_userinfo);
+	free(info->read_buf);
+}
+
 static void
 obj8_parse_worker(void *userinfo)
 {
@@ -604,22 +966,20 @@ obj8_parse_worker(void *userinfo)
 
 	obj8_load_info_t *info;
 	const char	*filename;
-	FILE		*fp;
 	vect3_t		pos_offset;
 
 	ASSERT(userinfo != NULL);
 	info = userinfo;
-	fp = info->fp;
 	obj = info->obj;
 	filename = obj->filename;
 	pos_offset = info->pos_offset;
 
-	obj->top = cur_cmd = obj8_cmd_alloc(OBJ8_CMD_GROUP, NULL);
+	obj->top = cur_cmd = obj8_cmd_alloc(obj, OBJ8_CMD_GROUP, NULL);
 
 	offset = vect3_add(pos_offset, info->cg_offset);
 	glm_translate_make(*obj->matrix, (vec3){offset.x, offset.y, offset.z});
 
-	for (int linenr = 1; lacf_getline(&line, &cap, fp) > 0 &&
+	for (int linenr = 1; src_getline(info, &line, &cap) > 0 &&
 	    !obj->load_stop; linenr++) {
 		strip_space(line);
 
@@ -696,13 +1056,39 @@ obj8_parse_worker(void *userinfo)
 				    filename, linenr);
 				goto errout;
 			}
-			cmd = obj8_cmd_alloc(OBJ8_CMD_TRIS, cur_cmd);
+			cmd = obj8_cmd_alloc(obj, OBJ8_CMD_TRIS, cur_cmd);
 			obj8_geom_init(&cmd->tris, group_id, double_sided,
 			    cur_manip, off, len, vtx_cap, idx_table, idx_cap);
 		} else if (check_line_prefix(line, "ANIM_begin")) {
-			cur_cmd = obj8_cmd_alloc(OBJ8_CMD_GROUP, cur_cmd);
+			cur_cmd = obj8_cmd_alloc(obj, OBJ8_CMD_GROUP,
+			    cur_cmd);
+		} else if (check_line_prefix(line, "ATTR_LOD")) {
+			obj8_lod_t *lod;
+
+			if (cur_anim != NULL || (cur_cmd != obj->top &&
+			    cur_cmd->group.lod == -1)) {
+				logMsg("%s:%d: invalid ATTR_LOD, not at the "
+				    "top level of the object.", filename,
+				    linenr);
+				goto errout;
+			}
+			obj->lods = safe_realloc(obj->lods,
+			    (obj->n_lods + 1) * sizeof (*obj->lods));
+			lod = &obj->lods[obj->n_lods];
+			memset(lod, 0, sizeof (*lod));
+			if (sscanf(line, "ATTR_LOD %f %f", &lod->min_dist,
+			    &lod->max_dist) != 2) {
+				logMsg("%s:%d: failed to parse ATTR_LOD",
+				    filename, linenr);
+				goto errout;
+			}
+			cur_cmd = obj8_cmd_alloc(obj, OBJ8_CMD_GROUP,
+			    obj->top);
+			cur_cmd->group.lod = obj->n_lods;
+			obj->n_lods++;
 		} else if (check_line_prefix(line, "ANIM_end")) {
-			if (cur_cmd->parent == NULL) {
+			if (cur_cmd->parent == NULL ||
+			    cur_cmd->group.lod != -1) {
 				logMsg("%s:%d: invalid ANIM_end, not inside "
 				    "an animation group.", filename, linenr);
 				goto errout;
@@ -734,7 +1120,8 @@ obj8_parse_worker(void *userinfo)
 				    "ANIM_trans_begin", filename, linenr);
 				goto errout;
 			}
-			cmd = obj8_cmd_alloc(OBJ8_CMD_ANIM_TRANS, cur_cmd);
+			cmd = obj8_cmd_alloc(obj, OBJ8_CMD_ANIM_TRANS,
+			    cur_cmd);
 			cmd->drset_idx = obj8_drset_add(obj->drset, dr_name, 0);
 			cur_anim = cmd;
 		} else if (check_line_prefix(line, "ANIM_rotate_begin")) {
@@ -747,7 +1134,8 @@ obj8_parse_worker(void *userinfo)
 				    "anim group", filename, linenr);
 				goto errout;
 			}
-			cmd = obj8_cmd_alloc(OBJ8_CMD_ANIM_ROTATE, cur_cmd);
+			cmd = obj8_cmd_alloc(obj, OBJ8_CMD_ANIM_ROTATE,
+			    cur_cmd);
 			if (sscanf(line, "ANIM_rotate_begin %lf %lf %lf %255s",
 			    &cmd->rotate.axis.x, &cmd->rotate.axis.y,
 			    &cmd->rotate.axis.z, dr_name) != 4) {
@@ -767,30 +1155,30 @@ obj8_parse_worker(void *userinfo)
 			}
 			cur_anim = NULL;
 		} else if (check_line_prefix(line, "ANIM_trans_key")) {
-			if (!parse_trans_key(line, cur_anim, filename, linenr))
+			if (!parse_trans_key(obj, line, cur_anim, filename,
+			    linenr))
 				goto errout;
 		} else if (check_line_prefix(line, "ANIM_rotate_key")) {
-			if (!parse_rotate_key(line, cur_anim, filename, linenr))
+			if (!parse_rotate_key(obj, line, cur_anim, filename,
+			    linenr))
 				goto errout;
 		} else if (check_line_prefix(line, "ANIM_trans")) {
 			char dr_name[256] = { 0 };
 			obj8_cmd_t *cmd;
+			obj8_trans_key_t *keys;
 			int l;
 
-			cmd = obj8_cmd_alloc(OBJ8_CMD_ANIM_TRANS, cur_cmd);
+			cmd = obj8_cmd_alloc(obj, OBJ8_CMD_ANIM_TRANS,
+			    cur_cmd);
 			cmd->trans.n_pts = 2;
 			cmd->trans.n_pts_cap = 2;
-			cmd->trans.values =
-			    safe_calloc(sizeof (*cmd->trans.values), 2);
-			cmd->trans.pos = safe_calloc(sizeof (*cmd->trans.pos),
-			    2);
+			keys = cmd->trans.keys = arena_alloc(&obj->arena,
+			    2 * sizeof (*cmd->trans.keys));
 			l = sscanf(line, "ANIM_trans %lf %lf %lf %lf %lf %lf "
 			    "%lf %lf %255s",
-			    &cmd->trans.pos[0].x, &cmd->trans.pos[0].y,
-			    &cmd->trans.pos[0].z, &cmd->trans.pos[1].x,
-			    &cmd->trans.pos[1].y, &cmd->trans.pos[1].z,
-			    &cmd->trans.values[0], &cmd->trans.values[1],
-			    dr_name);
+			    &keys[0].pos.x, &keys[0].pos.y, &keys[0].pos.z,
+			    &keys[1].pos.x, &keys[1].pos.y, &keys[1].pos.z,
+			    &keys[0].value, &keys[1].value, dr_name);
 			if (l < 6) {
 				logMsg("%s:%d: failed to parse ANIM_trans (%d)",
 				    filename, linenr, l);
@@ -801,11 +1189,12 @@ obj8_parse_worker(void *userinfo)
 			char dr_name[256] = { 0 };
 			obj8_cmd_t *cmd;
 
-			cmd = obj8_cmd_alloc(OBJ8_CMD_ANIM_ROTATE, cur_cmd);
+			cmd = obj8_cmd_alloc(obj, OBJ8_CMD_ANIM_ROTATE,
+			    cur_cmd);
 			cmd->rotate.n_pts = 2;
 			cmd->rotate.n_pts_cap = 2;
-			cmd->rotate.pts = safe_calloc(sizeof (*cmd->rotate.pts),
-			    2);
+			cmd->rotate.pts = arena_alloc(&obj->arena,
+			    2 * sizeof (*cmd->rotate.pts));
 			if (sscanf(line, "ANIM_rotate %lf %lf %lf %lf %lf "
 			    "%lf %lf %255s",
 			    &cmd->rotate.axis.x, &cmd->rotate.axis.y,
@@ -825,7 +1214,7 @@ obj8_parse_worker(void *userinfo)
 			 * The dataref name is optional, so skip creating
 			 * the command if it is empty.
 			 */
-			obj8_cmd_t *cmd = obj8_cmd_alloc(
+			obj8_cmd_t *cmd = obj8_cmd_alloc(obj,
 			    OBJ8_CMD_ATTR_LIGHT_LEVEL, cur_cmd);
 			if (sscanf(line, "ATTR_light_level %f %f %255s",
 			    &min_val, &max_val, dr_name) == 3) {
@@ -838,10 +1227,10 @@ obj8_parse_worker(void *userinfo)
 				    obj->drset, NULL, 0);
 			}
 		} else if (check_line_prefix(line, "ATTR_draw_enable")) {
-			(void)obj8_cmd_alloc(OBJ8_CMD_ATTR_DRAW_ENABLE,
+			(void)obj8_cmd_alloc(obj, OBJ8_CMD_ATTR_DRAW_ENABLE,
 			    cur_cmd);
 		} else if (check_line_prefix(line, "ATTR_draw_disable")) {
-			(void)obj8_cmd_alloc(OBJ8_CMD_ATTR_DRAW_DISABLE,
+			(void)obj8_cmd_alloc(obj, OBJ8_CMD_ATTR_DRAW_DISABLE,
 			    cur_cmd);
 		} else if (check_line_prefix(line, "ATTR_manip_none")) {
 			cur_manip = -1;
@@ -905,6 +1294,10 @@ obj8_parse_worker(void *userinfo)
 			}
 		}
 	}
+	if (info->read_error) {
+		logMsg("%s: error reading object data", filename);
+		goto errout;
+	}
 
 	obj->vtx_table = vtx_table;
 	obj->idx_table = idx_table;
@@ -914,10 +1307,16 @@ obj8_parse_worker(void *userinfo)
 
 	free(line);
 
-	fclose(info->fp);
+	src_close(info);
 	free(info);
 
+	obj->n_folded_cmds = fold_static_cmds(obj, obj->top);
+	compute_geom_bounds(obj, obj->top);
+	if (obj->occl_tol > 0)
+		build_occluder(obj, obj->top);
 	obj8_drset_mark_complete(obj->drset);
+	build_anim_deps(obj);
+	uploader_enqueue(obj);
 
 	mutex_enter(&obj->lock);
 	obj->load_complete = B_TRUE;
@@ -930,7 +1329,7 @@ errout:
 	free(idx_table);
 	free(line);
 
-	fclose(info->fp);
+	src_close(info);
 	free(info);
 
 	mutex_enter(&obj->lock);
@@ -940,8 +1339,13 @@ errout:
 	mutex_exit(&obj->lock);
 }
 
+/*
+ * Creates the object and starts its loader. Takes ownership of `info',
+ * which must have its data source already set up.
+ */
 static obj8_t *
-obj8_parse_fp(FILE *fp, const char *filename, vect3_t pos_offset)
+obj8_parse_impl(obj8_load_info_t *info, const char *filename,
+    vect3_t pos_offset, const obj8_parse_opts_t *opts)
 {
 	obj8_t *obj = safe_calloc(1, sizeof (*obj));
 	{
@@ -954,17 +1358,20 @@ obj8_parse_fp(FILE *fp, const char *filename, vect3_t pos_offset)
 	obj->matrix = safe_aligned_calloc(MAT4_ALLOC_ALIGN, 1, sizeof (mat4));
 	mutex_init(&obj->lock);
 	cv_init(&obj->cv);
+	mutex_init(&obj->upload_lock);
 	obj->filename = safe_strdup(filename);
 	obj->light_level_override = NAN;
 	obj->drset_auto_update = true;
 	obj->drset = obj8_drset_new();
 
-	obj->pos_loc = -1;
-	obj->norm_loc = -1;
-	obj->tex0_loc = -1;
+	if (opts != NULL) {
+		/* a bogus tolerance simply disables occluder reduction */
+		if (isfinite(opts->occluder_tol) && opts->occluder_tol > 0)
+			obj->occl_tol = opts->occluder_tol;
+		obj->retain = opts->retain;
+		obj->want_pos_buf = opts->pos_buf;
+	}
 
-	obj8_load_info_t *info = safe_calloc(1, sizeof (*info));
-	info->fp = fp;
 	info->pos_offset = pos_offset;
 	info->obj = obj;
 	info->cg_offset = VECT3(0, -obj->cgY_orig, -obj->cgZ_orig);
@@ -985,213 +1392,971 @@ wait_load_complete(obj8_t *obj)
 	}
 }
 
-static bool_t
-upload_data(obj8_t *obj)
+static GLfloat *
+pack_positions(const obj8_t *obj)
 {
-	if (!obj->load_complete)
-		return (B_FALSE);
-	wait_load_complete(obj);
-	/*
-	 * Once the initial data load is complete, upload the tables and
-	 * dispose of the in-memory copies as they are no longer needed.
-	 */
-	if (obj->vtx_buf == 0 && !obj->load_error) {
-		ASSERT(obj->vtx_table != NULL);
-		ASSERT(obj->idx_table != NULL);
+	GLfloat *pos = safe_malloc(obj->vtx_cap * 3 * sizeof (*pos));
 
-		obj->upload_thread_id = curthread_id;
-		if (use_vaos()) {
-			ASSERT0(obj->vao);
-			glGenVertexArrays(1, &obj->vao);
-			if (obj->vao != 0) {
-				glBindVertexArray(obj->vao);
-			} else {
-				// On macOS, even though GLEW can find the
-				// glGenVertexArrays function, if we're in
-				// a compatibility context, this function
-				// simply errors out. So just swallow the
-				// error and carry on without a VAO.
-				glutils_reset_errors();
-			}
-		}
-		glGenBuffers(1, &obj->vtx_buf);
-		glBindBuffer(GL_ARRAY_BUFFER, obj->vtx_buf);
-		if (GLEW_ARB_buffer_storage) {
-			glBufferStorage(GL_ARRAY_BUFFER, obj->vtx_cap *
-			    sizeof (obj8_vtx_t), obj->vtx_table, 0);
-		} else {
-			glBufferData(GL_ARRAY_BUFFER, obj->vtx_cap *
-			    sizeof (obj8_vtx_t), obj->vtx_table,
-			    GL_STATIC_DRAW);
-		}
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-		IF_TEXSZ(TEXSZ_ALLOC_BYTES_INSTANCE(obj8_vtx_buf, obj,
-		    obj->filename, 0, obj->vtx_cap * sizeof (obj8_vtx_t)));
-		free(obj->vtx_table);
-		obj->vtx_table = NULL;
-
-		glGenBuffers(1, &obj->idx_buf);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj->idx_buf);
-		if (GLEW_ARB_buffer_storage) {
-			glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, obj->idx_cap *
-			    sizeof (GLuint), obj->idx_table, 0);
-		} else {
-			glBufferData(GL_ELEMENT_ARRAY_BUFFER, obj->idx_cap *
-			    sizeof (GLuint), obj->idx_table, GL_STATIC_DRAW);
-		}
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-		IF_TEXSZ(TEXSZ_ALLOC_BYTES_INSTANCE(obj8_idx_buf, obj,
-		    obj->filename, 0, obj->idx_cap * sizeof (GLuint)));
-		free(obj->idx_table);
-		obj->idx_table = NULL;
+	ASSERT(obj->vtx_table != NULL);
+	for (unsigned i = 0; i < obj->vtx_cap; i++)
+		memcpy(&pos[i * 3], obj->vtx_table[i].pos, 3 * sizeof (*pos));
 
-		GLUTILS_ASSERT_NO_ERROR();
-	}
-	return (!obj->load_error);
+	return (pos);
 }
 
-obj8_t *
-obj8_parse(const char *filename, vect3_t pos_offset)
+/*
+ * Creates a static buffer holding `sz' bytes of `data'. We use the copy
+ * target for the upload, because element array bindings are VAO state and
+ * these can also be called from the background uploader's context, where
+ * no VAO is bound.
+ */
+static GLuint
+create_static_buf(const void *data, size_t sz)
 {
-	FILE *fp;
-	obj8_t *obj;
+	GLuint buf;
 
-#ifdef	DLLMODE
-	/*
-	 * This is only required in DLL mode in order to get GLEw initialized.
-	 */
-	if (!librain_glob_init())
-		return (NULL);
-#endif	/* defined(DLLMODE) */
-	fp = fopen(filename, "rb");
+	glGenBuffers(1, &buf);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buf);
+	if (GLEW_ARB_buffer_storage) {
+		glBufferStorage(GL_COPY_WRITE_BUFFER, sz, data, 0);
+	} else {
+		glBufferData(GL_COPY_WRITE_BUFFER, sz, data, GL_STATIC_DRAW);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
 
-	if (fp == NULL) {
-		logMsg("Can't open %s: %s", filename, strerror(errno));
-		return (NULL);
+	return (buf);
+}
+
+/*
+ * Uploads the geometry into the object's own buffers. The tables are
+ * left in place, upload_data disposes of them.
+ */
+static void
+upload_bufs(obj8_t *obj)
+{
+	obj->vtx_buf = create_static_buf(obj->vtx_table,
+	    obj->vtx_cap * sizeof (obj8_vtx_t));
+	IF_TEXSZ(TEXSZ_ALLOC_BYTES_INSTANCE(obj8_vtx_buf, obj,
+	    obj->filename, 0, obj->vtx_cap * sizeof (obj8_vtx_t)));
+	librain_mem_alloc(LIBRAIN_MEM_OBJ8_BUF, &obj->mem,
+	    obj->vtx_cap * sizeof (obj8_vtx_t));
+
+	if (obj->want_pos_buf) {
+		GLfloat *pos = pack_positions(obj);
+
+		obj->pos_buf = create_static_buf(pos,
+		    obj->vtx_cap * 3 * sizeof (*pos));
+		IF_TEXSZ(TEXSZ_ALLOC_BYTES_INSTANCE(obj8_pos_buf, obj,
+		    obj->filename, 0, obj->vtx_cap * 3 * sizeof (*pos)));
+		librain_mem_alloc(LIBRAIN_MEM_OBJ8_BUF, &obj->mem,
+		    obj->vtx_cap * 3 * sizeof (*pos));
+		free(pos);
+		obj->has_pos = true;
 	}
-	/* obj8_parse_fp takes ownership of the file handle */
-	obj = obj8_parse_fp(fp, filename, pos_offset);
 
-	return (obj);
+	obj->idx_buf = create_static_buf(obj->idx_table,
+	    obj->idx_cap * sizeof (GLuint));
+	IF_TEXSZ(TEXSZ_ALLOC_BYTES_INSTANCE(obj8_idx_buf, obj,
+	    obj->filename, 0, obj->idx_cap * sizeof (GLuint)));
+	librain_mem_alloc(LIBRAIN_MEM_OBJ8_BUF, &obj->mem,
+	    obj->idx_cap * sizeof (GLuint));
+
+	if (obj->occl_idx_table != NULL) {
+		obj->occl_idx_buf = create_static_buf(obj->occl_idx_table,
+		    obj->occl_idx_cap * sizeof (GLuint));
+		IF_TEXSZ(TEXSZ_ALLOC_BYTES_INSTANCE(obj8_occl_buf, obj,
+		    obj->filename, 0, obj->occl_idx_cap * sizeof (GLuint)));
+		librain_mem_alloc(LIBRAIN_MEM_OBJ8_BUF, &obj->mem,
+		    obj->occl_idx_cap * sizeof (GLuint));
+		obj->has_occl = true;
+	}
 }
 
+/*
+ * Uploads the geometry into the shared geometry arena. The index tables
+ * remain relative to the object's vertices, we use base-vertex draws.
+ */
 static void
-obj8_cmd_free(obj8_cmd_t *cmd)
-{
-	switch (cmd->type) {
-	case OBJ8_CMD_GROUP: {
-		obj8_cmd_t *subcmd;
-
-		while ((subcmd = list_remove_head(&cmd->group.cmds)) != NULL)
-			obj8_cmd_free(subcmd);
-		list_destroy(&cmd->group.cmds);
-		break;
-	}
-	case OBJ8_CMD_TRIS:
-	case OBJ8_CMD_ANIM_HIDE_SHOW:
-		break;
-	case OBJ8_CMD_ANIM_TRANS:
-		free(cmd->trans.values);
-		free(cmd->trans.pos);
-		break;
-	case OBJ8_CMD_ANIM_ROTATE:
-		free(cmd->rotate.pts);
-		break;
-	case OBJ8_CMD_ATTR_LIGHT_LEVEL:
-	case OBJ8_CMD_ATTR_DRAW_ENABLE:
-	case OBJ8_CMD_ATTR_DRAW_DISABLE:
-		break;
-	default:
-		VERIFY_FAIL();
+upload_data_arena(obj8_t *obj)
+{
+	GLfloat *pos = (obj->want_pos_buf ? pack_positions(obj) : NULL);
+
+	obj8_geom_alloc_vtx(&obj->arena_vtx, obj->vtx_table, pos,
+	    obj->vtx_cap);
+	obj->has_pos = (pos != NULL);
+	free(pos);
+	obj8_geom_alloc_idx(&obj->arena_idx, obj->idx_table, obj->idx_cap);
+	if (obj->occl_idx_table != NULL) {
+		obj8_geom_alloc_idx(&obj->arena_occl, obj->occl_idx_table,
+		    obj->occl_idx_cap);
+		obj->has_occl = true;
 	}
-	free(cmd);
+	obj->in_arena = true;
 }
 
-bool
-obj8_needs_upload(const obj8_t *obj)
+/*
+ * Background geometry uploader. When enabled, objects are uploaded into
+ * their own buffers by a worker thread with a GL context shared with the
+ * drawing context, as soon as the loader has finished parsing them. The
+ * upload is followed by a fence, which the drawing thread polls before
+ * first use, so the first frame to show an object doesn't need to push
+ * its geometry to the GPU. Only the VAOs, which are context-local, are
+ * still created on the drawing thread.
+ */
+static struct {
+	/*
+	 * Set last in obj8_uploader_init and cleared first in
+	 * obj8_uploader_fini. Loader threads check it without the lock,
+	 * so it's only accessed through uploader_active/uploader_set_active.
+	 */
+	bool		inited;
+	glctx_t		*ctx;
+	thread_t	thread;
+	mutex_t		lock;
+	condvar_t	cv;		/* wakes up the worker */
+	condvar_t	done_cv;	/* signaled after every upload */
+	list_t		queue;
+	bool		stop;
+} uploader = { .inited = false };
+
+static inline bool
+uploader_active(void)
 {
-	ASSERT(obj != NULL);
-	return (obj->load_complete && !obj->load_error && obj->vtx_buf == 0);
+	return (__atomic_load_n(&uploader.inited, __ATOMIC_ACQUIRE));
 }
 
-static unsigned
-extract_tris_group(const obj8_t *obj, const obj8_cmd_t *cmd,
-    obj8_vtx_t *data, unsigned cap)
+static inline void
+uploader_set_active(bool flag)
 {
-	int n_vtx = 0;
+	__atomic_store_n(&uploader.inited, flag, __ATOMIC_RELEASE);
+}
 
-	ASSERT(obj != NULL);
-	ASSERT(cmd != NULL);
-	ASSERT3U(cmd->type, ==, OBJ8_CMD_GROUP);
-	ASSERT(data != NULL || cap == 0);
+static void
+uploader_worker(void *unused)
+{
+	UNUSED(unused);
 
-	for (const obj8_cmd_t *subcmd = list_head(&cmd->group.cmds);
-	    subcmd != NULL; subcmd = list_next(&cmd->group.cmds, subcmd)) {
-		switch (subcmd->type) {
-		case OBJ8_CMD_GROUP: {
-			unsigned n = extract_tris_group(obj, subcmd, data, cap);
-			data = MIN(data + n, data + cap);
-			if (cap > n) {
-				cap -= n;
-			} else {
-				cap = 0;
-			}
-			n_vtx += n;
-			break;
-		}
-		case OBJ8_CMD_TRIS:
-			for (unsigned i = 0; i < subcmd->tris.n_vtx; i++) {
-				if (cap != 0) {
-					*data = obj->vtx_table[obj->idx_table[
-					    subcmd->tris.vtx_off + i]];
-					data++;
-					cap--;
-				}
-			}
-			n_vtx += subcmd->tris.n_vtx;
-			break;
-		default:
-			break;
+	VERIFY(glctx_make_current(uploader.ctx));
+
+	mutex_enter(&uploader.lock);
+	while (!uploader.stop) {
+		obj8_t *obj = list_remove_head(&uploader.queue);
+
+		if (obj == NULL) {
+			cv_wait(&uploader.cv, &uploader.lock);
+			continue;
 		}
+		obj->bg_upload = BG_UPLOAD_RUNNING;
+		mutex_exit(&uploader.lock);
+
+		upload_bufs(obj);
+		obj->upload_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE,
+		    0);
+		/* make sure the fence gets submitted, so it can signal */
+		glFlush();
+
+		mutex_enter(&uploader.lock);
+		obj->bg_upload = BG_UPLOAD_DONE;
+		cv_broadcast(&uploader.done_cv);
 	}
-	return (n_vtx);
+	mutex_exit(&uploader.lock);
+
+	glctx_make_current(NULL);
 }
 
-int
-obj8_get_triangle_data(obj8_t *obj, obj8_vtx_t *data, unsigned cap)
+/*
+ * Called by the loader once the object's tables are complete.
+ */
+static void
+uploader_enqueue(obj8_t *obj)
 {
-	ASSERT(obj != NULL);
-	ASSERT(data != NULL || cap == 0);
-	// wait for the data load to complete
-	mutex_enter(&obj->lock);
-	while (!obj->load_complete) {
-		cv_wait(&obj->cv, &obj->lock);
-	}
-	mutex_exit(&obj->lock);
-	// data load error?
-	if (obj->load_error) {
-		memset(data, 0, cap * sizeof (*data));
-		return (-1);
+	if (!uploader_active())
+		return;
+	mutex_enter(&uploader.lock);
+	ASSERT3U(obj->bg_upload, ==, BG_UPLOAD_NONE);
+	obj->bg_upload = BG_UPLOAD_QUEUED;
+	list_insert_tail(&uploader.queue, obj);
+	cv_broadcast(&uploader.cv);
+	mutex_exit(&uploader.lock);
+}
+
+/*
+ * Makes sure the background uploader is done with `obj', so it can be
+ * freed. The loader must have already exited.
+ */
+static void
+uploader_cancel(obj8_t *obj)
+{
+	if (uploader_active()) {
+		mutex_enter(&uploader.lock);
+		while (obj->bg_upload == BG_UPLOAD_RUNNING)
+			cv_wait(&uploader.done_cv, &uploader.lock);
+		if (obj->bg_upload == BG_UPLOAD_QUEUED) {
+			list_remove(&uploader.queue, obj);
+			obj->bg_upload = BG_UPLOAD_NONE;
+		}
+		mutex_exit(&uploader.lock);
 	}
-	// no data present anymore?
-	if (obj->vtx_table == NULL || obj->idx_table == NULL) {
-		memset(data, 0, cap * sizeof (*data));
-		return (0);
+	if (obj->upload_fence != NULL) {
+		glDeleteSync(obj->upload_fence);
+		obj->upload_fence = NULL;
 	}
-	return (extract_tris_group(obj, obj->top, data, cap));
 }
 
-void
-obj8_free(obj8_t *obj)
-{
-	ASSERT(obj != NULL);
+/*
+ * Checks whether a background upload has completed and the GPU has
+ * consumed the data. Never blocks.
+ */
+static bool
+bg_upload_complete(obj8_t *obj)
+{
+	bool done;
+
+	/* after uploader_fini, the state can no longer change */
+	if (uploader_active()) {
+		mutex_enter(&uploader.lock);
+		done = (obj->bg_upload == BG_UPLOAD_DONE);
+		mutex_exit(&uploader.lock);
+	} else {
+		done = (obj->bg_upload == BG_UPLOAD_DONE);
+	}
+	if (!done)
+		return (false);
+
+	ASSERT(obj->upload_fence != NULL);
+	if (glClientWaitSync(obj->upload_fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+		return (false);
+	glDeleteSync(obj->upload_fence);
+	obj->upload_fence = NULL;
+
+	return (true);
+}
+
+/*
+ * Starts the background geometry uploader. This must be called from the
+ * drawing thread with its GL context current, as that is the context
+ * with which the uploader's context is shared. Objects whose loading
+ * completes after this call are uploaded in the background. Returns
+ * false if the shared context couldn't be created, in which case objects
+ * continue to be uploaded on first draw.
+ */
+bool
+obj8_uploader_init(void)
+{
+	glctx_t *cur;
+
+	ASSERT(!uploader_active());
+
+	cur = glctx_get_current();
+	if (cur == NULL) {
+		logMsg("Can't start OBJ8 uploader: no current GL context");
+		return (false);
+	}
+	uploader.ctx = glctx_create_invisible(glctx_get_xplane_win_ptr(),
+	    cur, 3, 2, B_FALSE, B_FALSE);
+	glctx_destroy(cur);
+	if (uploader.ctx == NULL) {
+		logMsg("Can't start OBJ8 uploader: failed to create shared "
+		    "GL context");
+		return (false);
+	}
+	mutex_init(&uploader.lock);
+	cv_init(&uploader.cv);
+	cv_init(&uploader.done_cv);
+	list_create(&uploader.queue, sizeof (obj8_t),
+	    offsetof(obj8_t, upload_node));
+	uploader.stop = false;
+	VERIFY(thread_create(&uploader.thread, uploader_worker, NULL));
+	/* publishes all of the above to loader threads */
+	uploader_set_active(true);
+
+	return (true);
+}
+
+/*
+ * Stops the background uploader. Objects which haven't been picked up by
+ * it yet revert to being uploaded on first draw. Must not be called while
+ * objects are still being loaded.
+ */
+void
+obj8_uploader_fini(void)
+{
+	obj8_t *obj;
+
+	if (!uploader_active())
+		return;
+	uploader_set_active(false);
+
+	mutex_enter(&uploader.lock);
+	uploader.stop = true;
+	cv_broadcast(&uploader.cv);
+	mutex_exit(&uploader.lock);
+	thread_join(&uploader.thread);
+
+	while ((obj = list_remove_head(&uploader.queue)) != NULL)
+		obj->bg_upload = BG_UPLOAD_NONE;
+	list_destroy(&uploader.queue);
+	mutex_destroy(&uploader.lock);
+	cv_destroy(&uploader.cv);
+	cv_destroy(&uploader.done_cv);
+	glctx_destroy(uploader.ctx);
+	memset(&uploader, 0, sizeof (uploader));
+}
+
+static bool_t
+upload_data(obj8_t *obj)
+{
+	if (!obj->load_complete)
+		return (B_FALSE);
+	wait_load_complete(obj);
+	if (obj->load_error)
+		return (B_FALSE);
+	if (__atomic_load_n(&obj->uploaded, __ATOMIC_ACQUIRE))
+		return (B_TRUE);
+	/*
+	 * Once the initial data load is complete, upload the tables and
+	 * dispose of the in-memory copies, unless we've been asked to
+	 * retain them.
+	 * `bg_upload' only leaves BG_UPLOAD_NONE in the loader, before it
+	 * signals load completion, so it's safe to check it unlocked here.
+	 */
+	mutex_enter(&obj->upload_lock);
+	if (!obj->uploaded) {
+		ASSERT(obj->vtx_table != NULL);
+		ASSERT(obj->idx_table != NULL);
+
+		if (obj->bg_upload != BG_UPLOAD_NONE) {
+			if (!bg_upload_complete(obj)) {
+				mutex_exit(&obj->upload_lock);
+				return (B_FALSE);
+			}
+		} else if (obj8_geom_arena_active()) {
+			upload_data_arena(obj);
+		} else {
+			upload_bufs(obj);
+		}
+
+		if (obj->retain != OBJ8_RETAIN_CPU) {
+			mutex_enter(&obj->lock);
+			free(obj->vtx_table);
+			obj->vtx_table = NULL;
+			free(obj->idx_table);
+			obj->idx_table = NULL;
+			mutex_exit(&obj->lock);
+		} else {
+			librain_mem_alloc(LIBRAIN_MEM_OBJ8_CPU, &obj->mem,
+			    obj->vtx_cap * sizeof (obj8_vtx_t) +
+			    obj->idx_cap * sizeof (GLuint));
+		}
+		free(obj->occl_idx_table);
+		obj->occl_idx_table = NULL;
+
+		GLUTILS_ASSERT_NO_ERROR();
+		__atomic_store_n(&obj->uploaded, true, __ATOMIC_RELEASE);
+	}
+	mutex_exit(&obj->upload_lock);
+
+	return (B_TRUE);
+}
+
+static void
+readback_install(obj8_t *obj, const void *data)
+{
+	size_t vtx_sz = obj->vtx_cap * sizeof (obj8_vtx_t);
+	size_t idx_sz = obj->idx_cap * sizeof (GLuint);
+	obj8_vtx_t *vtx_table = safe_calloc(MAX(obj->vtx_cap, 1),
+	    sizeof (*vtx_table));
+	GLuint *idx_table = safe_calloc(MAX(obj->idx_cap, 1),
+	    sizeof (*idx_table));
+
+	if (data != NULL) {
+		memcpy(vtx_table, data, vtx_sz);
+		memcpy(idx_table, (const uint8_t *)data + vtx_sz, idx_sz);
+	}
+	mutex_enter(&obj->lock);
+	ASSERT3P(obj->vtx_table, ==, NULL);
+	obj->vtx_table = vtx_table;
+	obj->idx_table = idx_table;
+	obj->readback = READBACK_NONE;
+	mutex_exit(&obj->lock);
+	librain_mem_alloc(LIBRAIN_MEM_OBJ8_CPU, &obj->mem, vtx_sz + idx_sz);
+}
+
+static readback_t
+readback_state(obj8_t *obj)
+{
+	readback_t state;
+
+	mutex_enter(&obj->lock);
+	state = obj->readback;
+	mutex_exit(&obj->lock);
+
+	return (state);
+}
+
+/*
+ * Advances the readback by one step. Must be called with `upload_lock'
+ * held.
+ */
+static void
+readback_step(obj8_t *obj)
+{
+	size_t vtx_sz = obj->vtx_cap * sizeof (obj8_vtx_t);
+	size_t idx_sz = obj->idx_cap * sizeof (GLuint);
+	GLuint vtx_buf = obj->vtx_buf, idx_buf = obj->idx_buf;
+	size_t vtx_off = 0, idx_off = 0;
+	readback_t state = readback_state(obj);
+
+	if (state == READBACK_PENDING) {
+		void *data = NULL;
+
+		ASSERT(obj->readback_fence != NULL);
+		if (glClientWaitSync(obj->readback_fence, 0, 0) ==
+		    GL_TIMEOUT_EXPIRED)
+			return;
+		glDeleteSync(obj->readback_fence);
+		obj->readback_fence = NULL;
+		glBindBuffer(GL_COPY_READ_BUFFER, obj->readback_buf);
+		if (vtx_sz + idx_sz != 0) {
+			data = glMapBufferRange(GL_COPY_READ_BUFFER, 0,
+			    vtx_sz + idx_sz, GL_MAP_READ_BIT);
+		}
+		readback_install(obj, data);
+		if (data != NULL)
+			glUnmapBuffer(GL_COPY_READ_BUFFER);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glDeleteBuffers(1, &obj->readback_buf);
+		obj->readback_buf = 0;
+		librain_mem_free(LIBRAIN_MEM_OBJ8_BUF, &obj->mem,
+		    vtx_sz + idx_sz);
+		return;
+	}
+	if (state != READBACK_REQUESTED)
+		return;
+
+	/*
+	 * Our regions mustn't move until the copies below are issued
+	 * (a later compaction retires the buffers behind a fence).
+	 */
+	if (obj->in_arena) {
+		obj8_geom_arena_enter();
+		vtx_buf = obj8_geom_get_buf(OBJ8_GEOM_BUF_VTX);
+		idx_buf = obj8_geom_get_buf(OBJ8_GEOM_BUF_IDX);
+		vtx_off = obj->arena_vtx.off * sizeof (obj8_vtx_t);
+		idx_off = obj->arena_idx.off * sizeof (GLuint);
+	}
+	if (!GLEW_VERSION_3_2) {
+		uint8_t *data = safe_malloc(vtx_sz + idx_sz + 1);
+
+		/* the arena requires GL 3.2 */
+		ASSERT(!obj->in_arena);
+		glBindBuffer(GL_ARRAY_BUFFER, vtx_buf);
+		glGetBufferSubData(GL_ARRAY_BUFFER, vtx_off, vtx_sz, data);
+		glBindBuffer(GL_ARRAY_BUFFER, idx_buf);
+		glGetBufferSubData(GL_ARRAY_BUFFER, idx_off, idx_sz,
+		    &data[vtx_sz]);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		readback_install(obj, data);
+		free(data);
+		return;
+	}
+	ASSERT0(obj->readback_buf);
+	glGenBuffers(1, &obj->readback_buf);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, obj->readback_buf);
+	glBufferData(GL_COPY_WRITE_BUFFER, vtx_sz + idx_sz, NULL,
+	    GL_STREAM_READ);
+	librain_mem_alloc(LIBRAIN_MEM_OBJ8_BUF, &obj->mem, vtx_sz + idx_sz);
+	glBindBuffer(GL_COPY_READ_BUFFER, vtx_buf);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+	    vtx_off, 0, vtx_sz);
+	glBindBuffer(GL_COPY_READ_BUFFER, idx_buf);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+	    idx_off, vtx_sz, idx_sz);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	if (obj->in_arena)
+		obj8_geom_arena_exit();
+	obj->readback_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	mutex_enter(&obj->lock);
+	obj->readback = READBACK_PENDING;
+	mutex_exit(&obj->lock);
+}
+
+/*
+ * Drives the OBJ8_RETAIN_READBACK geometry readback from the drawing
+ * threads. On request, the object's vertex and index data are copied
+ * on the GPU into a staging buffer, which is then mapped on a later
+ * draw, once its fence has signaled. Without sync object support, we
+ * fall back to a blocking read.
+ */
+static void
+readback_service(obj8_t *obj)
+{
+	if (obj->retain != OBJ8_RETAIN_READBACK ||
+	    readback_state(obj) == READBACK_NONE)
+		return;
+	mutex_enter(&obj->upload_lock);
+	readback_step(obj);
+	mutex_exit(&obj->upload_lock);
+}
+
+obj8_t *
+obj8_parse(const char *filename, vect3_t pos_offset)
+{
+	return (obj8_parse2(filename, pos_offset, NULL));
+}
+
+/*
+ * Same as obj8_parse, but allows passing additional load-time options.
+ * `opts' may be NULL, in which case the defaults are used.
+ */
+obj8_t *
+obj8_parse2(const char *filename, vect3_t pos_offset,
+    const obj8_parse_opts_t *opts)
+{
+	FILE *fp;
+	obj8_load_info_t *info;
+
+#ifdef	DLLMODE
+	/*
+	 * This is only required in DLL mode in order to get GLEw initialized.
+	 */
+	if (!librain_glob_init())
+		return (NULL);
+#endif	/* defined(DLLMODE) */
+	fp = fopen(filename, "rb");
+
+	if (fp == NULL) {
+		logMsg("Can't open %s: %s", filename, strerror(errno));
+		return (NULL);
+	}
+	info = safe_calloc(1, sizeof (*info));
+	info->fp = fp;
+
+	return (obj8_parse_impl(info, filename, pos_offset, opts));
+}
+
+/*
+ * Parses an object from a memory buffer, such as an asset mapped from an
+ * archive. Since the object is parsed asynchronously and the caller has
+ * no way of telling when the loader is done with the data, `buf' is
+ * copied, so it can be released as soon as this function returns. The
+ * copy only lives until the object is loaded. `name' takes the place of
+ * the filename: it is used in log messages and texture paths in the
+ * object are resolved relative to it. See obj8_parse2 for `opts'.
+ */
+obj8_t *
+obj8_parse_mem(const void *buf, size_t len, const char *name,
+    vect3_t pos_offset, const obj8_parse_opts_t *opts)
+{
+	obj8_load_info_t *info;
+
+	ASSERT(buf != NULL || len == 0);
+	ASSERT(name != NULL);
+#ifdef	DLLMODE
+	if (!librain_glob_init())
+		return (NULL);
+#endif	/* defined(DLLMODE) */
+	info = safe_calloc(1, sizeof (*info));
+	info->read_buf = safe_malloc(MAX(len, 1));
+	if (len != 0)
+		memcpy(info->read_buf, buf, len);
+	info->src = info->read_buf;
+	info->src_len = len;
+
+	return (obj8_parse_impl(info, name, pos_offset, opts));
+}
+
+/*
+ * Parses an object from data supplied by `read_cb', e.g. while it is
+ * being decompressed from an archive. The callbacks are invoked from the
+ * object's loader thread. `close_cb' is optional, if provided it is
+ * called once the loader is done with the reader. If this function
+ * returns NULL, the callbacks aren't called at all. See obj8_parse_mem
+ * for the meaning of `name' and obj8_parse2 for `opts'.
+ */
+obj8_t *
+obj8_parse_stream(obj8_read_cb_t read_cb, obj8_close_cb_t close_cb,
+    void *userinfo, const char *name, vect3_t pos_offset,
+    const obj8_parse_opts_t *opts)
+{
+	obj8_load_info_t *info;
+
+	ASSERT(read_cb != NULL);
+	ASSERT(name != NULL);
+#ifdef	DLLMODE
+	if (!librain_glob_init())
+		return (NULL);
+#endif	/* defined(DLLMODE) */
+	info = safe_calloc(1, sizeof (*info));
+	info->read_cb = read_cb;
+	info->close_cb = close_cb;
+	info->read_userinfo = userinfo;
+	info->read_buf = safe_malloc(READ_BUF_SZ);
+
+	return (obj8_parse_impl(info, name, pos_offset, opts));
+}
+
+bool
+obj8_needs_upload(const obj8_t *obj)
+{
+	ASSERT(obj != NULL);
+	return (obj->load_complete && !obj->load_error &&
+	    !__atomic_load_n(&obj->uploaded, __ATOMIC_ACQUIRE));
+}
+
+/*
+ * Returns true once the object's geometry is on the GPU, i.e. drawing
+ * it actually produces output.
+ */
+bool
+obj8_is_uploaded(const obj8_t *obj)
+{
+	ASSERT(obj != NULL);
+	return (__atomic_load_n(&obj->uploaded, __ATOMIC_ACQUIRE));
+}
+
+static void
+bounds_init(vec3 bounds[2])
+{
+	for (int i = 0; i < 3; i++) {
+		bounds[0][i] = INFINITY;
+		bounds[1][i] = -INFINITY;
+	}
+}
+
+static void
+bounds_add(vec3 bounds[2], const float pos[3])
+{
+	for (int i = 0; i < 3; i++) {
+		bounds[0][i] = MIN(bounds[0][i], pos[i]);
+		bounds[1][i] = MAX(bounds[1][i], pos[i]);
+	}
+}
+
+static bool
+group_bounds(const obj8_t *obj, const obj8_cmd_t *group,
+    const char *groupname, const mat4 xform_in, bool dynamic, vec3 bounds[2])
+{
+	mat4 xform;
+
+	ASSERT3U(group->type, ==, OBJ8_CMD_GROUP);
+	memcpy(xform, xform_in, sizeof (xform));
+
+	for (const obj8_cmd_t *subcmd = list_head(&group->group.cmds);
+	    subcmd != NULL; subcmd = list_next(&group->group.cmds, subcmd)) {
+		switch (subcmd->type) {
+		case OBJ8_CMD_GROUP:
+			if (!group_bounds(obj, subcmd, groupname, xform,
+			    dynamic, bounds))
+				return (false);
+			break;
+		case OBJ8_CMD_TRIS: {
+			const obj8_geom_t *geom = &subcmd->tris;
+
+			if (geom->n_vtx == 0 || (groupname != NULL &&
+			    strcmp(geom->group_id, groupname) != 0))
+				break;
+			/* we can't tell where an animation will move it */
+			if (dynamic)
+				return (false);
+			for (int i = 0; i < 8; i++) {
+				vec4 p = {
+				    geom->bounds[i & 1][0],
+				    geom->bounds[(i >> 1) & 1][1],
+				    geom->bounds[(i >> 2) & 1][2], 1
+				};
+				glm_mat4_mulv(xform, p, p);
+				bounds_add(bounds, p);
+			}
+			break;
+		}
+		case OBJ8_CMD_ANIM_STATIC: {
+			mat4 m;
+
+			memcpy(m, subcmd->xform, sizeof (m));
+			glm_mat4_mul(xform, m, xform);
+			break;
+		}
+		case OBJ8_CMD_ANIM_ROTATE:
+		case OBJ8_CMD_ANIM_TRANS:
+			dynamic = true;
+			break;
+		default:
+			break;
+		}
+	}
+
+	return (true);
+}
+
+/*
+ * Returns the bounding box of the object's geometry (or only of the
+ * geometry in `groupname', if not NULL), in the space which the `mvp'
+ * matrix passed to obj8_draw_group applies to. Static animations are
+ * taken into account, but hide/show animations and LODs aren't, so the
+ * box may be larger than what's actually drawn. Returns false if any of
+ * the geometry is moved by a dataref-driven animation, if there is no
+ * matching geometry, or while the object is still loading.
+ */
+bool
+obj8_get_bounds(const obj8_t *obj, const char *groupname, vect3_t *min_p,
+    vect3_t *max_p)
+{
+	vec3 bounds[2];
+	mat4 xform;
+
+	ASSERT(obj != NULL);
+	ASSERT(min_p != NULL);
+	ASSERT(max_p != NULL);
+
+	if (!obj->load_complete || obj->load_error)
+		return (false);
+	bounds_init(bounds);
+	memcpy(xform, *obj->matrix, sizeof (xform));
+	if (!group_bounds(obj, obj->top, groupname, xform, false, bounds) ||
+	    bounds[0][0] > bounds[1][0])
+		return (false);
+	*min_p = VECT3(bounds[0][0], bounds[0][1], bounds[0][2]);
+	*max_p = VECT3(bounds[1][0], bounds[1][1], bounds[1][2]);
+
+	return (true);
+}
+
+/*
+ * Returns the memory taken up by the object's own GPU buffers and any
+ * geometry retained on the CPU (see obj8_retain_t). Objects uploaded
+ * into the shared geometry arena are only accounted for as part of the
+ * arena (LIBRAIN_MEM_OBJ8_ARENA).
+ */
+librain_mem_stat_t
+obj8_get_mem_stat(const obj8_t *obj)
+{
+	ASSERT(obj != NULL);
+	return (librain_mem_acct_get(&obj->mem));
+}
+
+typedef struct {
+	const char	*group_id;
+	bool		animated;
+	const float	*dr_values;
+	obj8_vtx_t	*data;
+	unsigned	cap;
+	unsigned	n_vtx;
+} extract_info_t;
+
+static inline float cmd_dr_read(obj8_cmd_t *cmd, const float *dr_values);
+static inline void anim_rotate_mtx(const obj8_t *obj, obj8_cmd_t *subcmd,
+    const float *dr_values, mat4 m);
+static void anim_trans_mtx(obj8_cmd_t *subcmd, const float *dr_values,
+    mat4 m);
+
+static void
+extract_vtx(const mat4 xform, const obj8_vtx_t *in, obj8_vtx_t *out)
+{
+	vec4 pos = { in->pos[0], in->pos[1], in->pos[2], 1 };
+	/* w = 0, so normals only pick up the rotation */
+	vec4 norm = { in->norm[0], in->norm[1], in->norm[2], 0 };
+
+	glm_mat4_mulv((vec4 *)xform, pos, pos);
+	glm_mat4_mulv((vec4 *)xform, norm, norm);
+	*out = *in;
+	memcpy(out->pos, pos, sizeof (out->pos));
+	memcpy(out->norm, norm, sizeof (out->norm));
+}
+
+/*
+ * Collects the triangles of a command group. When extracting animated
+ * geometry, we evaluate the animations from scratch, rather than using
+ * the transform caches, which belong to the drawing threads. Hidden
+ * geometry is then skipped, as is every LOD other than the first one.
+ */
+static void
+extract_tris_group(const obj8_t *obj, obj8_cmd_t *cmd, const mat4 xform_in,
+    extract_info_t *ei)
+{
+	mat4 xform;
+	bool hide = false;
+
+	ASSERT(obj != NULL);
+	ASSERT(cmd != NULL);
+	ASSERT3U(cmd->type, ==, OBJ8_CMD_GROUP);
+
+	memcpy(xform, xform_in, sizeof (xform));
+	for (obj8_cmd_t *subcmd = list_head(&cmd->group.cmds);
+	    subcmd != NULL; subcmd = list_next(&cmd->group.cmds, subcmd)) {
+		switch (subcmd->type) {
+		case OBJ8_CMD_GROUP:
+			if (hide || (ei->animated && subcmd->group.lod > 0))
+				break;
+			extract_tris_group(obj, subcmd, xform, ei);
+			break;
+		case OBJ8_CMD_TRIS:
+			if (hide || (ei->group_id != NULL &&
+			    strcmp(subcmd->tris.group_id, ei->group_id) != 0))
+				break;
+			for (unsigned i = 0; i < subcmd->tris.n_vtx; i++) {
+				const obj8_vtx_t *vtx = &obj->vtx_table[
+				    obj->idx_table[subcmd->tris.vtx_off + i]];
+
+				if (ei->n_vtx < ei->cap) {
+					if (ei->animated) {
+						extract_vtx(xform, vtx,
+						    &ei->data[ei->n_vtx]);
+					} else {
+						ei->data[ei->n_vtx] = *vtx;
+					}
+				}
+				ei->n_vtx++;
+			}
+			break;
+		case OBJ8_CMD_ANIM_HIDE_SHOW: {
+			double val;
+
+			if (!ei->animated)
+				break;
+			val = cmd_dr_read(subcmd, ei->dr_values);
+			if (subcmd->hide_show.val[0] <= val &&
+			    subcmd->hide_show.val[1] >= val)
+				hide = !subcmd->hide_show.set_val;
+			break;
+		}
+		case OBJ8_CMD_ANIM_ROTATE:
+		case OBJ8_CMD_ANIM_TRANS:
+		case OBJ8_CMD_ANIM_STATIC: {
+			mat4 m;
+
+			if (!ei->animated)
+				break;
+			if (subcmd->type == OBJ8_CMD_ANIM_ROTATE) {
+				anim_rotate_mtx(obj, subcmd, ei->dr_values,
+				    m);
+			} else if (subcmd->type == OBJ8_CMD_ANIM_TRANS) {
+				anim_trans_mtx(subcmd, ei->dr_values, m);
+			} else {
+				memcpy(m, subcmd->xform, sizeof (m));
+			}
+			glm_mat4_mul(xform, m, xform);
+			break;
+		}
+		default:
+			break;
+		}
+	}
+}
+
+int
+obj8_get_triangle_data(obj8_t *obj, obj8_vtx_t *data, unsigned cap)
+{
+	return (obj8_get_triangle_data2(obj, NULL, false, data, cap));
+}
+
+/*
+ * Extracts the object's triangles as a flat list of vertices, three per
+ * triangle, into `data'. Returns the total number of vertices available,
+ * which can exceed `cap', in which case only the first `cap' vertices
+ * are stored. Returns -1 if the object failed to load.
+ *
+ * `group_id' optionally limits the extraction to geometry tagged with a
+ * matching X-GROUP-ID. If `animated' is true, the vertices are moved by
+ * the animation transforms for the drset's current dataref values,
+ * hidden geometry is skipped and only the most detailed LOD is used.
+ * Otherwise, all geometry is returned in its untransformed state.
+ *
+ * Once the object has been uploaded, this returns 0 unless the object
+ * was loaded with a retention policy (see obj8_retain_t). With
+ * OBJ8_RETAIN_READBACK, it also returns 0 until the readback completes.
+ */
+int
+obj8_get_triangle_data2(obj8_t *obj, const char *group_id, bool animated,
+    obj8_vtx_t *data, unsigned cap)
+{
+	extract_info_t ei = {
+	    .group_id = group_id, .animated = animated,
+	    .data = data, .cap = cap
+	};
+	float *dr_values = NULL;
+	mat4 xform = GLM_MAT4_IDENTITY_INIT;
+
+	ASSERT(obj != NULL);
+	ASSERT(data != NULL || cap == 0);
+	// wait for the data load to complete
+	mutex_enter(&obj->lock);
+	while (!obj->load_complete) {
+		cv_wait(&obj->cv, &obj->lock);
+	}
+	mutex_exit(&obj->lock);
+	// data load error?
+	if (obj->load_error) {
+		memset(data, 0, cap * sizeof (*data));
+		return (-1);
+	}
+	if (animated) {
+		size_t n_drs = obj8_drset_get_all(obj->drset, NULL, 0);
+
+		dr_values = safe_calloc(MAX(n_drs, 1), sizeof (*dr_values));
+		obj8_drset_get_all(obj->drset, dr_values, n_drs);
+		ei.dr_values = dr_values;
+	}
+	mutex_enter(&obj->lock);
+	// no data present anymore?
+	if (obj->vtx_table == NULL || obj->idx_table == NULL) {
+		if (obj->retain == OBJ8_RETAIN_READBACK &&
+		    obj->readback == READBACK_NONE)
+			obj->readback = READBACK_REQUESTED;
+		mutex_exit(&obj->lock);
+		free(dr_values);
+		memset(data, 0, cap * sizeof (*data));
+		return (0);
+	}
+	extract_tris_group(obj, obj->top, xform, &ei);
+	mutex_exit(&obj->lock);
+	free(dr_values);
+
+	return (ei.n_vtx);
+}
+
+static draw_cache_t *
+draw_cache_alloc(const obj8_t *obj)
+{
+	draw_cache_t *cache = safe_calloc(1, sizeof (*cache));
+	mat4 ident = GLM_MAT4_IDENTITY_INIT;
+	unsigned n = MAX(obj->n_cmds, 1);
+
+	/* everything starts out dirty, so the first draw computes it all */
+	cache->dirty = safe_malloc(n * sizeof (*cache->dirty));
+	cache->xform = safe_malloc(n * sizeof (*cache->xform));
+	for (unsigned i = 0; i < n; i++) {
+		cache->dirty[i] = true;
+		memcpy(cache->xform[i], ident, sizeof (ident));
+	}
+	return (cache);
+}
+
+static void
+draw_cache_free(draw_cache_t *cache)
+{
+	if (cache == NULL)
+		return;
+	free(cache->dirty);
+	free(cache->xform);
+	free(cache);
+}
 
-	obj8_cmd_free(obj->top);
+void
+obj8_free(obj8_t *obj)
+{
+	ASSERT(obj != NULL);
 
 	obj->load_stop = B_TRUE;
 	thread_join(&obj->loader);
+	uploader_cancel(obj);
+	/* Releases the entire command tree */
+	arena_free(&obj->arena);
 	mutex_destroy(&obj->lock);
 	cv_destroy(&obj->cv);
+	mutex_destroy(&obj->upload_lock);
 
 	if (obj->vtx_buf != 0) {
 		glDeleteBuffers(1, &obj->vtx_buf);
@@ -1204,16 +2369,48 @@ obj8_free(obj8_t *obj)
 		IF_TEXSZ(TEXSZ_FREE_BYTES_INSTANCE(obj8_idx_buf, obj,
 		    obj->idx_cap * sizeof (GLuint)));
 	}
-	if (obj->vao != 0) {
-		glDeleteVertexArrays(1, &obj->vao);
+	draw_cache_free(obj8_vao_cache_release(&obj->vaos));
+	/*
+	 * Threads which haven't called obj8_release_vaos leak their VAOs,
+	 * but at least their transform caches can go.
+	 */
+	for (unsigned i = 0; i < OBJ8_VAO_CACHE_SLOTS; i++)
+		draw_cache_free(obj->vaos.slots[i].draw_state);
+	if (obj->pos_buf != 0) {
+		glDeleteBuffers(1, &obj->pos_buf);
+		IF_TEXSZ(TEXSZ_FREE_BYTES_INSTANCE(obj8_pos_buf, obj,
+		    obj->vtx_cap * 3 * sizeof (GLfloat)));
+	}
+	if (obj->readback_buf != 0) {
+		glDeleteBuffers(1, &obj->readback_buf);
+		librain_mem_free(LIBRAIN_MEM_OBJ8_BUF, &obj->mem,
+		    obj->vtx_cap * sizeof (obj8_vtx_t) +
+		    obj->idx_cap * sizeof (GLuint));
+	}
+	if (obj->readback_fence != NULL)
+		glDeleteSync(obj->readback_fence);
+	if (obj->occl_idx_buf != 0) {
+		glDeleteBuffers(1, &obj->occl_idx_buf);
+		IF_TEXSZ(TEXSZ_FREE_BYTES_INSTANCE(obj8_occl_buf, obj,
+		    obj->occl_idx_cap * sizeof (GLuint)));
 	}
+	if (obj->in_arena) {
+		obj8_geom_free_vtx(&obj->arena_vtx);
+		obj8_geom_free_idx(&obj->arena_idx);
+		obj8_geom_free_idx(&obj->arena_occl);
+	}
+	free(obj->occl_idx_table);
 	free(obj->idx_table);
+	librain_mem_release(&obj->mem);
 	free(obj->filename);
 	free(obj->tex_filename);
 	free(obj->norm_filename);
 	free(obj->lit_filename);
 
 	free(obj->manips);
+	free(obj->lods);
+	free(obj->dep_off);
+	free(obj->dep_cmds);
 
 	obj8_drset_destroy(obj->drset);
 
@@ -1221,6 +2418,22 @@ obj8_free(obj8_t *obj)
 	ZERO_FREE(obj);
 }
 
+/*
+ * An object can be drawn from any thread whose GL context shares objects
+ * with the context the object was uploaded in. Each such thread gets its
+ * own VAOs and transform cache for the object on its first draw. Since
+ * VAOs can only be deleted in the context which created them, obj8_free
+ * only deletes the calling thread's VAOs. Every other thread which has
+ * drawn the object must call this function (with its context current)
+ * before the object is freed, otherwise its VAOs are leaked.
+ */
+void
+obj8_release_vaos(obj8_t *obj)
+{
+	ASSERT(obj != NULL);
+	draw_cache_free(obj8_vao_cache_release(&obj->vaos));
+}
+
 static inline float
 cmd_dr_read(obj8_cmd_t *cmd, const float *dr_values)
 {
@@ -1232,12 +2445,34 @@ cmd_dr_read(obj8_cmd_t *cmd, const float *dr_values)
 }
 
 static void
-geom_draw(const obj8_t *obj, const obj8_geom_t *geom, const mat4 pvm)
+geom_draw(const obj8_t *obj, const draw_ctx_t *ctx, const obj8_geom_t *geom,
+    const mat4 pvm)
 {
-	glUniformMatrix4fv(obj->pvm_loc, 1, GL_FALSE, (void *)pvm);
-	glUniform1f(obj->manip_idx_loc, geom->manip_idx);
-	glDrawElements(GL_TRIANGLES, geom->n_vtx, GL_UNSIGNED_INT,
-	    (void *)(geom->vtx_off * sizeof (GLuint)));
+	unsigned off, n;
+
+	if (ctx->draw_occl) {
+		off = geom->occl_off;
+		n = geom->occl_n_vtx;
+		if (obj->in_arena)
+			off += obj->arena_occl.off;
+	} else {
+		off = geom->vtx_off;
+		n = geom->n_vtx;
+		if (obj->in_arena)
+			off += obj->arena_idx.off;
+	}
+	if (n == 0)
+		return;
+
+	glUniformMatrix4fv(ctx->locs->pvm_loc, 1, GL_FALSE, (void *)pvm);
+	glUniform1f(ctx->locs->manip_idx_loc, geom->manip_idx);
+	if (obj->in_arena) {
+		glDrawElementsBaseVertex(GL_TRIANGLES, n, GL_UNSIGNED_INT,
+		    (void *)(off * sizeof (GLuint)), obj->arena_vtx.off);
+	} else {
+		glDrawElements(GL_TRIANGLES, n, GL_UNSIGNED_INT,
+		    (void *)(off * sizeof (GLuint)));
+	}
 }
 
 static inline double
@@ -1293,52 +2528,336 @@ rotation_get_angle(const obj8_t *obj, obj8_cmd_t *cmd, const float *dr_values)
 }
 
 static inline void
-handle_cmd_anim_rotate(const obj8_t *obj, obj8_cmd_t *subcmd, mat4 pvm,
-    const float *dr_values)
+anim_rotate_mtx(const obj8_t *obj, obj8_cmd_t *subcmd, const float *dr_values,
+    mat4 m)
 {
-	glm_rotate(pvm, DEG2RAD(rotation_get_angle(obj, subcmd, dr_values)),
+	glm_rotate_make(m,
+	    DEG2RAD(rotation_get_angle(obj, subcmd, dr_values)),
 	    (vec3){ subcmd->rotate.axis.x,
 	    subcmd->rotate.axis.y, subcmd->rotate.axis.z });
 }
 
 static void
-handle_cmd_anim_trans(obj8_cmd_t *subcmd, mat4 pvm, const float *dr_values)
+anim_trans_mtx(obj8_cmd_t *subcmd, const float *dr_values, mat4 m)
 {
 	double val;
 	vec3 xlate = {0, 0, 0};
 
 	ASSERT(subcmd != NULL);
-	ASSERT(pvm != NULL);
+	ASSERT(m != NULL);
 	val = cmd_dr_read(subcmd, dr_values);
 
 	if (subcmd->trans.n_pts == 1) {
 		/*
 		 * single-point translations simply set position
 		 */
-		xlate[0] = subcmd->trans.pos[0].x;
-		xlate[1] = subcmd->trans.pos[0].y;
-		xlate[2] = subcmd->trans.pos[0].z;
+		xlate[0] = subcmd->trans.keys[0].pos.x;
+		xlate[1] = subcmd->trans.keys[0].pos.y;
+		xlate[2] = subcmd->trans.keys[0].pos.z;
 	}
 	for (size_t i = 0; i + 1 < subcmd->trans.n_pts; i++) {
-		double v1 = MIN(subcmd->trans.values[i],
-		    subcmd->trans.values[i + 1]);
-		double v2 = MAX(subcmd->trans.values[i],
-		    subcmd->trans.values[i + 1]);
+		const obj8_trans_key_t *k1 = &subcmd->trans.keys[i];
+		const obj8_trans_key_t *k2 = &subcmd->trans.keys[i + 1];
+		double v1 = MIN(k1->value, k2->value);
+		double v2 = MAX(k1->value, k2->value);
 		if (v1 <= val && val <= v2) {
 			double rat = (v2 - v1 != 0.0 ?
 			    (val - v1) / (v2 - v1) : 0.0);
 
-			xlate[0] = wavg(subcmd->trans.pos[i].x,
-			    subcmd->trans.pos[i + 1].x, rat);
-			xlate[1] = wavg(subcmd->trans.pos[i].y,
-			    subcmd->trans.pos[i + 1].y, rat);
-			xlate[2] = wavg(subcmd->trans.pos[i].z,
-			    subcmd->trans.pos[i + 1].z, rat);
+			xlate[0] = wavg(k1->pos.x, k2->pos.x, rat);
+			xlate[1] = wavg(k1->pos.y, k2->pos.y, rat);
+			xlate[2] = wavg(k1->pos.z, k2->pos.z, rat);
+			break;
+		}
+	}
+
+	glm_translate_make(m, xlate);
+}
+
+/*
+ * Applies an animation command to the running object-space transform
+ * `xform'. The animation's local transform is only re-evaluated if the
+ * datarefs it depends on have changed, otherwise the cached one is used.
+ */
+static void
+apply_anim_cmd(const obj8_t *obj, const draw_ctx_t *ctx, obj8_cmd_t *subcmd,
+    mat4 xform)
+{
+	draw_cache_t *cache = ctx->cache;
+	mat4 m;
+
+	if (subcmd->type == OBJ8_CMD_ANIM_STATIC) {
+		memcpy(m, subcmd->xform, sizeof (m));
+	} else if (cache->dirty[subcmd->idx]) {
+		if (subcmd->type == OBJ8_CMD_ANIM_ROTATE) {
+			anim_rotate_mtx(obj, subcmd, ctx->dr_values, m);
+		} else {
+			ASSERT3U(subcmd->type, ==, OBJ8_CMD_ANIM_TRANS);
+			anim_trans_mtx(subcmd, ctx->dr_values, m);
+		}
+		memcpy(cache->xform[subcmd->idx], m, sizeof (m));
+		cache->dirty[subcmd->idx] = false;
+	} else {
+		memcpy(m, cache->xform[subcmd->idx], sizeof (m));
+	}
+	glm_mat4_mul(xform, m, xform);
+}
+
+/*
+ * An animation's input is constant if it has no dataref, in which case
+ * it always reads as zero.
+ */
+static bool
+cmd_input_is_const(const obj8_t *obj, const obj8_cmd_t *cmd)
+{
+	const char *name;
+
+	if (cmd->drset_idx == INVALID_DRSET_IDX)
+		return (true);
+	name = obj8_drset_get_dr_name(obj->drset, cmd->drset_idx);
+	return (name[0] == '\0' || strcmp(name, "none") == 0);
+}
+
+static bool
+anim_is_const(const obj8_t *obj, const obj8_cmd_t *cmd)
+{
+	if (cmd_input_is_const(obj, cmd))
+		return (true);
+	if (cmd->type == OBJ8_CMD_ANIM_TRANS) {
+		/*
+		 * Outside of the key range the translation is zero, so
+		 * multiple keys are only constant if they're all zero.
+		 */
+		if (cmd->trans.n_pts <= 1)
+			return (true);
+		for (size_t i = 0; i < cmd->trans.n_pts; i++) {
+			if (cmd->trans.keys[i].pos.x != 0 ||
+			    cmd->trans.keys[i].pos.y != 0 ||
+			    cmd->trans.keys[i].pos.z != 0)
+				return (false);
+		}
+		return (true);
+	} else {
+		size_t n = cmd->rotate.n_pts;
+
+		ASSERT3U(cmd->type, ==, OBJ8_CMD_ANIM_ROTATE);
+		if (n <= 1 ||
+		    cmd->rotate.pts[0].x == cmd->rotate.pts[n - 1].x)
+			return (true);
+		for (size_t i = 1; i < n; i++) {
+			if (cmd->rotate.pts[i].y != cmd->rotate.pts[0].y)
+				return (false);
+		}
+		return (true);
+	}
+}
+
+static bool
+mtx_is_ident(const mat4 m)
+{
+	for (int i = 0; i < 4; i++) {
+		for (int j = 0; j < 4; j++) {
+			if (m[i][j] != (i == j ? 1 : 0))
+				return (false);
+		}
+	}
+	return (true);
+}
+
+/*
+ * Drops the drset entry of an animation command which is being folded
+ * or removed, so the resolver doesn't keep looking up its dataref.
+ */
+static void
+cmd_drop_dr(const obj8_t *obj, obj8_cmd_t *cmd)
+{
+	ASSERT(cmd->type == OBJ8_CMD_ANIM_ROTATE ||
+	    cmd->type == OBJ8_CMD_ANIM_TRANS ||
+	    cmd->type == OBJ8_CMD_ANIM_HIDE_SHOW);
+	drset_unref(obj->drset, cmd->drset_idx);
+	cmd->drset_idx = INVALID_DRSET_IDX;
+}
+
+/*
+ * Load-time optimization pass over a command group. Animations which
+ * always produce the same transform are evaluated once and turned into
+ * ANIM_STATIC commands, consecutive static transforms are merged, and
+ * commands with no effect (identity transforms, hide/show commands which
+ * never trigger, state changes at the end of a group and empty groups)
+ * are dropped. Subtrees without any dynamic animations thus end up with
+ * only static transforms, which never need to be re-evaluated. The
+ * drset entries of eliminated animations are released, see drset_unref.
+ * Returns the number of commands eliminated.
+ */
+static unsigned
+fold_static_cmds(const obj8_t *obj, obj8_cmd_t *group)
+{
+	unsigned n_elim = 0;
+	obj8_cmd_t *last_static = NULL;
+	obj8_cmd_t *subcmd, *next;
+
+	ASSERT(obj != NULL);
+	ASSERT(group != NULL);
+	ASSERT3U(group->type, ==, OBJ8_CMD_GROUP);
+
+	for (subcmd = list_head(&group->group.cmds); subcmd != NULL;
+	    subcmd = next) {
+		next = list_next(&group->group.cmds, subcmd);
+
+		switch (subcmd->type) {
+		case OBJ8_CMD_GROUP:
+			n_elim += fold_static_cmds(obj, subcmd);
+			if (list_head(&subcmd->group.cmds) == NULL) {
+				list_remove(&group->group.cmds, subcmd);
+				n_elim++;
+			} else {
+				last_static = NULL;
+			}
 			break;
+		case OBJ8_CMD_TRIS:
+			last_static = NULL;
+			break;
+		case OBJ8_CMD_ANIM_HIDE_SHOW:
+			if (cmd_input_is_const(obj, subcmd) &&
+			    (subcmd->hide_show.val[0] > 0 ||
+			    subcmd->hide_show.val[1] < 0)) {
+				cmd_drop_dr(obj, subcmd);
+				list_remove(&group->group.cmds, subcmd);
+				n_elim++;
+			}
+			break;
+		case OBJ8_CMD_ANIM_ROTATE:
+		case OBJ8_CMD_ANIM_TRANS: {
+			mat4 m;
+
+			if (!anim_is_const(obj, subcmd)) {
+				last_static = NULL;
+				break;
+			}
+			cmd_drop_dr(obj, subcmd);
+			if (subcmd->type == OBJ8_CMD_ANIM_ROTATE)
+				anim_rotate_mtx(obj, subcmd, NULL, m);
+			else
+				anim_trans_mtx(subcmd, NULL, m);
+			subcmd->type = OBJ8_CMD_ANIM_STATIC;
+			if (mtx_is_ident(m)) {
+				list_remove(&group->group.cmds, subcmd);
+				n_elim++;
+			} else if (last_static != NULL) {
+				mat4 prev;
+
+				memcpy(prev, last_static->xform,
+				    sizeof (prev));
+				glm_mat4_mul(prev, m, prev);
+				memcpy(last_static->xform, prev,
+				    sizeof (prev));
+				list_remove(&group->group.cmds, subcmd);
+				n_elim++;
+			} else {
+				memcpy(subcmd->xform, m, sizeof (m));
+				last_static = subcmd;
+			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+	/*
+	 * Transforms and local state changes after the last piece of
+	 * geometry in a group don't affect anything.
+	 */
+	for (subcmd = list_tail(&group->group.cmds); subcmd != NULL;
+	    subcmd = next) {
+		if (subcmd->type != OBJ8_CMD_ANIM_ROTATE &&
+		    subcmd->type != OBJ8_CMD_ANIM_TRANS &&
+		    subcmd->type != OBJ8_CMD_ANIM_STATIC &&
+		    subcmd->type != OBJ8_CMD_ANIM_HIDE_SHOW &&
+		    subcmd->type != OBJ8_CMD_ATTR_DRAW_ENABLE &&
+		    subcmd->type != OBJ8_CMD_ATTR_DRAW_DISABLE) {
+			break;
+		}
+		next = list_prev(&group->group.cmds, subcmd);
+		if (subcmd->type != OBJ8_CMD_ANIM_STATIC &&
+		    subcmd->type != OBJ8_CMD_ATTR_DRAW_ENABLE &&
+		    subcmd->type != OBJ8_CMD_ATTR_DRAW_DISABLE) {
+			cmd_drop_dr(obj, subcmd);
+		}
+		list_remove(&group->group.cmds, subcmd);
+		n_elim++;
+	}
+
+	return (n_elim);
+}
+
+/*
+ * Computes the untransformed bounding box of each TRIS command in
+ * `group', for use by obj8_get_bounds.
+ */
+static void
+compute_geom_bounds(obj8_t *obj, obj8_cmd_t *group)
+{
+	ASSERT3U(group->type, ==, OBJ8_CMD_GROUP);
+
+	for (obj8_cmd_t *cmd = list_head(&group->group.cmds); cmd != NULL;
+	    cmd = list_next(&group->group.cmds, cmd)) {
+		obj8_geom_t *geom = &cmd->tris;
+
+		if (cmd->type == OBJ8_CMD_GROUP) {
+			compute_geom_bounds(obj, cmd);
+			continue;
+		}
+		if (cmd->type != OBJ8_CMD_TRIS)
+			continue;
+		bounds_init(geom->bounds);
+		for (unsigned i = 0; i < geom->n_vtx; i++) {
+			bounds_add(geom->bounds, obj->vtx_table[
+			    obj->idx_table[geom->vtx_off + i]].pos);
 		}
 	}
+}
 
-	glm_translate(pvm, xlate);
+/*
+ * Builds the simplified occluder index list for all TRIS commands in
+ * `group'. Each TRIS command is simplified on its own, since all of its
+ * triangles are drawn with the same animation transform. This runs on
+ * the loader thread on every load, as there's no cached occluder next
+ * to the OBJ file, so it directly adds to the object's load time (see
+ * obj8_occl.c for what it costs).
+ */
+static void
+build_occluder(obj8_t *obj, obj8_cmd_t *group)
+{
+	ASSERT3U(group->type, ==, OBJ8_CMD_GROUP);
+
+	for (obj8_cmd_t *cmd = list_head(&group->group.cmds); cmd != NULL;
+	    cmd = list_next(&group->group.cmds, cmd)) {
+		GLuint *idx;
+		unsigned n;
+
+		if (obj->load_stop)
+			return;
+		if (cmd->type == OBJ8_CMD_GROUP) {
+			build_occluder(obj, cmd);
+			continue;
+		}
+		if (cmd->type != OBJ8_CMD_TRIS)
+			continue;
+		n = obj8_occl_simplify(obj->vtx_table, obj->vtx_cap,
+		    &obj->idx_table[cmd->tris.vtx_off], cmd->tris.n_vtx,
+		    obj->occl_tol, &idx);
+		cmd->tris.occl_off = obj->occl_idx_cap;
+		cmd->tris.occl_n_vtx = n;
+		if (n != 0) {
+			obj->occl_idx_table = safe_realloc(
+			    obj->occl_idx_table,
+			    (obj->occl_idx_cap + n) * sizeof (GLuint));
+			memcpy(&obj->occl_idx_table[obj->occl_idx_cap], idx,
+			    n * sizeof (GLuint));
+			obj->occl_idx_cap += n;
+		}
+		free(idx);
+	}
 }
 
 static inline bool
@@ -1348,30 +2867,96 @@ render_mode_is_manip_only(obj8_render_mode_t mode)
 	    mode == OBJ8_RENDER_MODE_MANIP_ONLY_ONE);
 }
 
-void
-obj8_draw_group_cmd(const obj8_t *obj, obj8_cmd_t *cmd, const char *groupname,
-    const mat4 pvm_in, const float *dr_values)
+/*
+ * Returns true if LOD `i' is to be drawn. `ctx->lod' is either an
+ * explicit LOD index, one of the special OBJ8_LOD_* values, or
+ * LOD_BY_DIST to select all LODs whose range includes `ctx->dist'.
+ */
+static bool
+lod_is_drawn(const obj8_t *obj, const draw_ctx_t *ctx, int i)
+{
+	ASSERT3S(i, >=, 0);
+	ASSERT3S(i, <, obj->n_lods);
+
+	switch (ctx->lod) {
+	case OBJ8_LOD_ALL:
+		return (true);
+	case OBJ8_LOD_COARSEST:
+		return (i == ctx->coarsest_lod);
+	case LOD_BY_DIST:
+		return (obj->lods[i].min_dist <= ctx->dist &&
+		    ctx->dist < obj->lods[i].max_dist);
+	default:
+		return (i == ctx->lod);
+	}
+}
+
+static int
+coarsest_lod(const obj8_t *obj)
+{
+	int coarsest = 0;
+
+	for (unsigned i = 1; i < obj->n_lods; i++) {
+		if (obj->lods[i].max_dist >= obj->lods[coarsest].max_dist)
+			coarsest = i;
+	}
+	return (coarsest);
+}
+
+/*
+ * Draws the contents of a group. `pvm_obj' is the object's projection-
+ * view-model matrix, to which we append the cached per-geometry animation
+ * transforms. The transforms in the group are only recomputed if the
+ * group has been marked dirty (because an animation inside of it has
+ * changed), or if `recompute' is set (because an animation in one of
+ * our parent groups has changed).
+ */
+static void
+draw_group_cmd(const obj8_t *obj, const draw_ctx_t *ctx, obj8_cmd_t *cmd,
+    const mat4 pvm_obj, bool recompute)
 {
+	draw_cache_t *cache = ctx->cache;
 	bool_t hide = B_FALSE, do_draw = B_TRUE;
-	mat4 pvm;
+	mat4 xform;
 
 	ASSERT(obj != NULL);
 	ASSERT(cmd != NULL);
 	ASSERT3U(cmd->type, ==, OBJ8_CMD_GROUP);
-	memcpy(pvm, pvm_in, sizeof (pvm));
+
+	recompute = (recompute || cache->dirty[cmd->idx]);
+	cache->dirty[cmd->idx] = false;
+	if (recompute)
+		memcpy(xform, cache->xform[cmd->idx], sizeof (xform));
 
 	for (obj8_cmd_t *subcmd = list_head(&cmd->group.cmds); subcmd != NULL;
 	    subcmd = list_next(&cmd->group.cmds, subcmd)) {
 		switch (subcmd->type) {
 		case OBJ8_CMD_GROUP:
+			if (recompute) {
+				memcpy(cache->xform[subcmd->idx], xform,
+				    sizeof (xform));
+			}
 			if (hide || (!do_draw &&
-			    !render_mode_is_manip_only(obj->render_mode))) {
+			    !render_mode_is_manip_only(obj->render_mode)) ||
+			    (subcmd->group.lod != -1 &&
+			    !lod_is_drawn(obj, ctx, subcmd->group.lod))) {
+				/*
+				 * Skipped groups must catch up with any
+				 * transform change once they are drawn again.
+				 */
+				if (recompute)
+					cache->dirty[subcmd->idx] = true;
 				break;
 			}
-			obj8_draw_group_cmd(obj, subcmd, groupname, pvm,
-			    dr_values);
+			draw_group_cmd(obj, ctx, subcmd, pvm_obj, recompute);
 			break;
-		case OBJ8_CMD_TRIS:
+		case OBJ8_CMD_TRIS: {
+			mat4 pvm;
+
+			if (recompute) {
+				memcpy(cache->xform[subcmd->idx], xform,
+				    sizeof (xform));
+			}
 			/* Don't draw if we're hidden */
 			if (hide)
 				break;
@@ -1405,18 +2990,22 @@ obj8_draw_group_cmd(const obj8_t *obj, obj8_cmd_t *cmd, const char *groupname,
 					break;
 				}
 			}
-			if (groupname == NULL ||
-			    strcmp(subcmd->tris.group_id, groupname) == 0) {
-				if (subcmd->tris.double_sided) {
-					glCullFace(GL_FRONT);
-					geom_draw(obj, &subcmd->tris, pvm);
-					glCullFace(GL_BACK);
-				}
-				geom_draw(obj, &subcmd->tris, pvm);
+			if (ctx->groupname != NULL &&
+			    strcmp(subcmd->tris.group_id,
+			    ctx->groupname) != 0)
+				break;
+			memcpy(pvm, cache->xform[subcmd->idx], sizeof (pvm));
+			glm_mat4_mul((vec4 *)pvm_obj, pvm, pvm);
+			if (subcmd->tris.double_sided) {
+				glCullFace(GL_FRONT);
+				geom_draw(obj, ctx, &subcmd->tris, pvm);
+				glCullFace(GL_BACK);
 			}
+			geom_draw(obj, ctx, &subcmd->tris, pvm);
 			break;
+		}
 		case OBJ8_CMD_ANIM_HIDE_SHOW: {
-			double val = cmd_dr_read(subcmd, dr_values);
+			double val = cmd_dr_read(subcmd, ctx->dr_values);
 
 			if (subcmd->hide_show.val[0] <= val &&
 			    subcmd->hide_show.val[1] >= val)
@@ -1424,14 +3013,15 @@ obj8_draw_group_cmd(const obj8_t *obj, obj8_cmd_t *cmd, const char *groupname,
 			break;
 		}
 		case OBJ8_CMD_ANIM_ROTATE:
-			handle_cmd_anim_rotate(obj, subcmd, pvm, dr_values);
-			break;
 		case OBJ8_CMD_ANIM_TRANS:
-			handle_cmd_anim_trans(subcmd, pvm, dr_values);
+		case OBJ8_CMD_ANIM_STATIC:
+			if (recompute)
+				apply_anim_cmd(obj, ctx, subcmd, xform);
 			break;
 		case OBJ8_CMD_ATTR_LIGHT_LEVEL:
 			if (isnan(obj->light_level_override)) {
-				float raw = cmd_dr_read(subcmd, dr_values);
+				float raw = cmd_dr_read(subcmd,
+				    ctx->dr_values);
 				float value = 0;
 				if (subcmd->attr_light_level.min_val <
 				    subcmd->attr_light_level.max_val) {
@@ -1440,7 +3030,8 @@ obj8_draw_group_cmd(const obj8_t *obj, obj8_cmd_t *cmd, const char *groupname,
 					    subcmd->attr_light_level.max_val,
 					    true);
 				}
-				glUniform1f(obj->light_level_loc, value);
+				glUniform1f(ctx->locs->light_level_loc,
+				    value);
 			}
 			break;
 		case OBJ8_CMD_ATTR_DRAW_ENABLE:
@@ -1455,66 +3046,252 @@ obj8_draw_group_cmd(const obj8_t *obj, obj8_cmd_t *cmd, const char *groupname,
 	}
 }
 
-static inline void
-enable_vtx_attr_ptrs(const obj8_t *obj)
+static inline void
+enable_vtx_attr_ptrs(const obj8_vao_t *vao, bool pos_only)
+{
+	if (pos_only) {
+		ASSERT3S(vao->norm_loc, ==, -1);
+		ASSERT3S(vao->tex0_loc, ==, -1);
+		glutils_enable_vtx_attr_ptr(vao->pos_loc, 3, GL_FLOAT,
+		    GL_FALSE, 3 * sizeof (GLfloat), 0);
+		return;
+	}
+	glutils_enable_vtx_attr_ptr(vao->pos_loc, 3, GL_FLOAT,
+	    GL_FALSE, sizeof (obj8_vtx_t), offsetof(obj8_vtx_t, pos));
+	glutils_enable_vtx_attr_ptr(vao->norm_loc, 3, GL_FLOAT,
+	    GL_FALSE, sizeof (obj8_vtx_t), offsetof(obj8_vtx_t, norm));
+	glutils_enable_vtx_attr_ptr(vao->tex0_loc, 2, GL_FLOAT,
+	    GL_FALSE, sizeof (obj8_vtx_t), offsetof(obj8_vtx_t, tex));
+}
+
+static inline void
+disable_vtx_attr_ptrs(const obj8_vao_t *vao)
+{
+	glutils_disable_vtx_attr_ptr(vao->pos_loc);
+	glutils_disable_vtx_attr_ptr(vao->norm_loc);
+	glutils_disable_vtx_attr_ptr(vao->tex0_loc);
+}
+
+static void
+setup_prog(obj8_prog_locs_t *locs, GLuint prog)
+{
+	if (locs->prog == prog)
+		return;
+	locs->prog = prog;
+	/* uniforms */
+	locs->pvm_loc = glGetUniformLocation(prog, "pvm");
+	locs->light_level_loc = glGetUniformLocation(prog,
+	    "ATTR_light_level");
+	locs->manip_idx_loc = glGetUniformLocation(prog, "manip_idx");
+	/* vertex attributes */
+	locs->pos_loc = glGetAttribLocation(prog, "vtx_pos");
+	locs->norm_loc = glGetAttribLocation(prog, "vtx_norm");
+	locs->tex0_loc = glGetAttribLocation(prog, "vtx_tex0");
+}
+
+/*
+ * Binds the vertex & index buffers and sets up the attribute pointers for
+ * `prog'. If the program only reads vertex positions and we have a
+ * position-only buffer, that is used instead of the full vertex buffer.
+ * Returns the attribute pointer set which was used. This is either one
+ * of the VAOs in the calling thread's `slot', or `scratch' if we've run
+ * out of slots. `batched_p' is set if the bindings are part of an arena
+ * draw batch (see obj8_geom_arena_batch_begin) and must be left in place.
+ */
+static obj8_vao_t *
+setup_arrays(obj8_t *obj, obj8_vao_slot_t *slot, obj8_prog_locs_t *locs,
+    GLuint prog, obj8_vao_t *scratch, bool *batched_p)
+{
+	bool pos_only;
+	obj8_vao_t *vao;
+	GLuint vtx_buf, idx_buf;
+	unsigned gen = 0;	/* our own buffers never change */
+
+	setup_prog(locs, prog);
+	pos_only = (obj->has_pos && locs->norm_loc == -1 &&
+	    locs->tex0_loc == -1);
+	if (obj->in_arena) {
+		vao = obj8_geom_get_vao(pos_only, scratch);
+		gen = obj8_geom_get_gen();
+		vtx_buf = obj8_geom_get_buf(pos_only ? OBJ8_GEOM_BUF_POS :
+		    OBJ8_GEOM_BUF_VTX);
+		idx_buf = obj8_geom_get_buf(OBJ8_GEOM_BUF_IDX);
+		/*
+		 * The array buffer only matters while establishing the
+		 * attribute pointers, and the element buffer binding is kept
+		 * in the VAO, so with a VAO, neither needs rebinding unless
+		 * the arena has replaced its buffers. Buffer names can be
+		 * reused, so we go by the arena's generation, not the names.
+		 */
+		*batched_p = obj8_geom_bind_vao(vao);
+		if (vao->id == 0 || vao->gen != gen)
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, idx_buf);
+	} else {
+		vao = obj8_vao_slot_get(slot, pos_only, scratch);
+		vtx_buf = (pos_only ? obj->pos_buf : obj->vtx_buf);
+		idx_buf = obj->idx_buf;
+		*batched_p = false;
+		/* our own VAO replaces any arena VAO left bound by a batch */
+		obj8_geom_batch_unbind();
+		if (vao->id != 0)
+			glBindVertexArray(vao->id);
+		glBindBuffer(GL_ARRAY_BUFFER, vtx_buf);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, idx_buf);
+	}
+	/*
+	 * Without a VAO, the pointers need to be established on every draw.
+	 * With a VAO, only if the program (and thus the attribute locations)
+	 * or the arena's buffers have changed, in which case we first
+	 * disable the old set.
+	 */
+	if (vao->id == 0 || vao->prog != prog || vao->gen != gen) {
+		if (vao->id != 0)
+			disable_vtx_attr_ptrs(vao);
+		if (obj->in_arena)
+			glBindBuffer(GL_ARRAY_BUFFER, vtx_buf);
+		vao->prog = prog;
+		vao->gen = gen;
+		vao->pos_loc = locs->pos_loc;
+		vao->norm_loc = locs->norm_loc;
+		vao->tex0_loc = locs->tex0_loc;
+		enable_vtx_attr_ptrs(vao, pos_only);
+	}
+
+	return (vao);
+}
+
+static void
+count_anim_deps(const obj8_cmd_t *cmd, unsigned *counts)
+{
+	ASSERT3U(cmd->type, ==, OBJ8_CMD_GROUP);
+	for (const obj8_cmd_t *subcmd = list_head(&cmd->group.cmds);
+	    subcmd != NULL; subcmd = list_next(&cmd->group.cmds, subcmd)) {
+		if (subcmd->type == OBJ8_CMD_GROUP) {
+			count_anim_deps(subcmd, counts);
+		} else if ((subcmd->type == OBJ8_CMD_ANIM_ROTATE ||
+		    subcmd->type == OBJ8_CMD_ANIM_TRANS) &&
+		    subcmd->drset_idx != INVALID_DRSET_IDX) {
+			counts[subcmd->drset_idx]++;
+		}
+	}
+}
+
+static void
+fill_anim_deps(obj8_t *obj, obj8_cmd_t *cmd, unsigned *fill)
 {
-	glutils_enable_vtx_attr_ptr(obj->pos_loc, 3, GL_FLOAT,
-	    GL_FALSE, sizeof (obj8_vtx_t), offsetof(obj8_vtx_t, pos));
-	glutils_enable_vtx_attr_ptr(obj->norm_loc, 3, GL_FLOAT,
-	    GL_FALSE, sizeof (obj8_vtx_t), offsetof(obj8_vtx_t, norm));
-	glutils_enable_vtx_attr_ptr(obj->tex0_loc, 2, GL_FLOAT,
-	    GL_FALSE, sizeof (obj8_vtx_t), offsetof(obj8_vtx_t, tex));
+	ASSERT3U(cmd->type, ==, OBJ8_CMD_GROUP);
+	for (obj8_cmd_t *subcmd = list_head(&cmd->group.cmds);
+	    subcmd != NULL; subcmd = list_next(&cmd->group.cmds, subcmd)) {
+		if (subcmd->type == OBJ8_CMD_GROUP) {
+			fill_anim_deps(obj, subcmd, fill);
+		} else if ((subcmd->type == OBJ8_CMD_ANIM_ROTATE ||
+		    subcmd->type == OBJ8_CMD_ANIM_TRANS) &&
+		    subcmd->drset_idx != INVALID_DRSET_IDX) {
+			unsigned idx = subcmd->drset_idx;
+			obj->dep_cmds[obj->dep_off[idx] + fill[idx]] = subcmd;
+			fill[idx]++;
+		}
+	}
 }
 
-static inline void
-disable_vtx_attr_ptrs(const obj8_t *obj)
+/*
+ * Builds the map from drset indices to the animation commands which
+ * depend on them. Called by the loader once the command tree and the
+ * drset are complete.
+ */
+static void
+build_anim_deps(obj8_t *obj)
 {
-	glutils_disable_vtx_attr_ptr(obj->pos_loc);
-	glutils_disable_vtx_attr_ptr(obj->norm_loc);
-	glutils_disable_vtx_attr_ptr(obj->tex0_loc);
+	unsigned n_drs = obj->drset->n_drs;
+	unsigned *counts;
+
+	ASSERT(obj->drset->complete);
+	ASSERT3P(obj->dep_off, ==, NULL);
+
+	counts = safe_calloc(n_drs + 1, sizeof (*counts));
+	obj->dep_off = safe_calloc(n_drs + 1, sizeof (*obj->dep_off));
+	count_anim_deps(obj->top, counts);
+	for (unsigned i = 0; i < n_drs; i++)
+		obj->dep_off[i + 1] = obj->dep_off[i] + counts[i];
+	obj->dep_cmds = safe_calloc(MAX(obj->dep_off[n_drs], 1),
+	    sizeof (*obj->dep_cmds));
+	memset(counts, 0, (n_drs + 1) * sizeof (*counts));
+	fill_anim_deps(obj, obj->top, counts);
+	free(counts);
 }
 
+/*
+ * Marks the animations which depend on datarefs that changed since the
+ * last time `cache' was brought up to date as dirty, so their transforms
+ * get recomputed on the next draw. All other transforms stay cached.
+ */
 static void
-setup_arrays(obj8_t *obj, GLuint prog)
+invalidate_anim_deps(const obj8_t *obj, draw_cache_t *cache)
 {
-	if (obj->last_prog != prog) {
-		// if using VAOs, disable old set first
-		if (obj->vao != 0) {
-			disable_vtx_attr_ptrs(obj);
+	obj8_drset_t *drset = obj->drset;
+
+	mutex_enter(&drset->lock);
+	if (drset->serial != cache->dep_serial) {
+		for (unsigned i = 0; i < drset->n_drs; i++) {
+			if (drset->change_serials[i] <= cache->dep_serial)
+				continue;
+			for (unsigned j = obj->dep_off[i];
+			    j < obj->dep_off[i + 1]; j++) {
+				const obj8_cmd_t *cmd = obj->dep_cmds[j];
+
+				cache->dirty[cmd->idx] = true;
+				cache->dirty[cmd->parent->idx] = true;
+			}
 		}
-		obj->last_prog = prog;
-		/* uniforms */
-		obj->pvm_loc = glGetUniformLocation(prog, "pvm");
-		obj->light_level_loc = glGetUniformLocation(prog,
-		    "ATTR_light_level");
-		obj->manip_idx_loc = glGetUniformLocation(prog, "manip_idx");
-		/* vertex attributes */
-		obj->pos_loc = glGetAttribLocation(prog, "vtx_pos");
-		obj->norm_loc = glGetAttribLocation(prog, "vtx_norm");
-		obj->tex0_loc = glGetAttribLocation(prog, "vtx_tex0");
-		// enable new set
-		enable_vtx_attr_ptrs(obj);
-	} else if (obj->vao == 0) {
-		// Only re-enable the known set of pointers if we're not
-		// using VAOs. Otherwise the array bindings will get
-		// re-established when rebinding the VAO.
-		enable_vtx_attr_ptrs(obj);
+		cache->dep_serial = drset->serial;
 	}
+	mutex_exit(&drset->lock);
 }
 
-void
-obj8_draw_group(obj8_t *obj, const char *groupname, GLuint prog,
-    const mat4 pvm_in)
+static void
+draw_group_impl(obj8_t *obj, const char *groupname, GLuint prog,
+    const mat4 pvm_in, int lod, float dist)
 {
 	mat4 pvm;
+	obj8_vao_slot_t *slot;
+	obj8_vao_t *vao, scratch;
+	obj8_prog_locs_t *locs, scratch_locs;
+	draw_ctx_t ctx = { .groupname = groupname, .lod = lod, .dist = dist };
+	bool batched;
 
 	ASSERT(prog != 0);
 
 	if (!upload_data(obj))
 		return;
+	readback_service(obj);
+	/*
+	 * Everything which drawing updates (program locations, VAOs and
+	 * the transform cache) lives in the calling thread's slot, so draws
+	 * from multiple threads don't need to be serialized. If we've run
+	 * out of slots, we start from scratch on every draw.
+	 */
+	slot = obj8_vao_cache_slot(&obj->vaos);
+	if (slot != NULL) {
+		if (slot->draw_state == NULL)
+			slot->draw_state = draw_cache_alloc(obj);
+		ctx.cache = slot->draw_state;
+		locs = &slot->locs;
+	} else {
+		ctx.cache = draw_cache_alloc(obj);
+		memset(&scratch_locs, 0, sizeof (scratch_locs));
+		locs = &scratch_locs;
+	}
+	ctx.locs = locs;
+	if (lod == OBJ8_LOD_COARSEST)
+		ctx.coarsest_lod = coarsest_lod(obj);
 
 	if (obj->drset_auto_update)
 		(void)obj8_drset_update(obj->drset);
+	/*
+	 * This must happen before we grab the values below. If the drset
+	 * gets updated in between, we simply invalidate again next time.
+	 */
+	invalidate_anim_deps(obj, ctx.cache);
 
 	enum { MAX_STACK_DRS = 128 };
 	float dr_values_stack[MAX_STACK_DRS];
@@ -1526,6 +3303,7 @@ obj8_draw_group(obj8_t *obj, const char *groupname, GLuint prog,
 		dr_values = dr_values_stack;
 	}
 	obj8_drset_get_all(obj->drset, dr_values, n_drs);
+	ctx.dr_values = dr_values;
 
 	glutils_debug_push(0, "obj8_draw_group(%s)",
 	    lacf_basename(obj->filename));
@@ -1536,39 +3314,107 @@ obj8_draw_group(obj8_t *obj, const char *groupname, GLuint prog,
 	 */
 	glDisableClientState(GL_VERTEX_ARRAY);
 #endif	/* APL */
-	if (obj->vao != 0) {
-		ASSERT(thread_equal(curthread_id, obj->upload_thread_id));
-		glBindVertexArray(obj->vao);
-	}
-	glBindBuffer(GL_ARRAY_BUFFER, obj->vtx_buf);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj->idx_buf);
-
-	setup_arrays(obj, prog);
+	vao = setup_arrays(obj, slot, locs, prog, &scratch, &batched);
+	/*
+	 * Depth-only programs (those not reading normals or texture
+	 * coordinates) get the simplified occluder mesh, if we have one.
+	 */
+	ctx.draw_occl = (obj->has_occl && locs->norm_loc == -1 &&
+	    locs->tex0_loc == -1);
+	if (ctx.draw_occl && !obj->in_arena)
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj->occl_idx_buf);
 
 	if (!isnan(obj->light_level_override))
-		glUniform1f(obj->light_level_loc, obj->light_level_override);
+		glUniform1f(locs->light_level_loc, obj->light_level_override);
 	else
-		glUniform1f(obj->light_level_loc, 0);
+		glUniform1f(locs->light_level_loc, 0);
 	glm_mat4_mul((vec4 *)pvm_in, *obj->matrix, pvm);
-	obj8_draw_group_cmd(obj, obj->top, groupname, pvm, dr_values);
+	draw_group_cmd(obj, &ctx, obj->top, pvm, false);
 
-	if (obj->vao != 0) {
-		glBindVertexArray(0);
-	} else {
-		disable_vtx_attr_ptrs(obj);
+	/* inside of an arena batch, the next object reuses the bindings */
+	if (!batched) {
+		if (vao->id != 0) {
+			glBindVertexArray(0);
+		} else {
+			disable_vtx_attr_ptrs(vao);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	}
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
 	glutils_debug_pop();
 
 	GLUTILS_ASSERT_NO_ERROR();
 
+	if (slot == NULL)
+		draw_cache_free(ctx.cache);
 	if (n_drs > ARRAY_NUM_ELEM(dr_values_stack)) {
 		free(dr_values);
 	}
 }
 
+/*
+ * Draws the object. If the object contains LODs, draws the LOD(s) which
+ * apply at zero distance from the camera.
+ */
+void
+obj8_draw_group(obj8_t *obj, const char *groupname, GLuint prog,
+    const mat4 pvm_in)
+{
+	draw_group_impl(obj, groupname, prog, pvm_in, LOD_BY_DIST, 0);
+}
+
+/*
+ * Same as obj8_draw_group, but draws the LOD(s) whose ATTR_LOD range
+ * contains `dist' (the camera's distance from the object in meters).
+ */
+void
+obj8_draw_group_dist(obj8_t *obj, const char *groupname, GLuint prog,
+    const mat4 pvm_in, float dist)
+{
+	ASSERT(!isnan(dist));
+	draw_group_impl(obj, groupname, prog, pvm_in, LOD_BY_DIST, dist);
+}
+
+/*
+ * Same as obj8_draw_group, but draws a specific LOD. `lod' is either an
+ * index between 0 and obj8_get_num_lods() - 1, OBJ8_LOD_COARSEST to draw
+ * the LOD with the furthest range, or OBJ8_LOD_ALL to draw all LODs.
+ * Geometry which isn't part of any LOD is always drawn.
+ */
+void
+obj8_draw_group_lod(obj8_t *obj, const char *groupname, GLuint prog,
+    const mat4 pvm_in, int lod)
+{
+	ASSERT(lod >= 0 || lod == OBJ8_LOD_ALL || lod == OBJ8_LOD_COARSEST);
+	draw_group_impl(obj, groupname, prog, pvm_in, lod, 0);
+}
+
+/*
+ * Returns the number of ATTR_LOD ranges in the object.
+ */
+unsigned
+obj8_get_num_lods(const obj8_t *obj)
+{
+	ASSERT(obj != NULL);
+	if (!obj->load_complete)
+		return (0);
+	return (obj->n_lods);
+}
+
+void
+obj8_get_lod_range(const obj8_t *obj, unsigned lod, float *min_dist,
+    float *max_dist)
+{
+	ASSERT(obj != NULL);
+	ASSERT(obj->load_complete);
+	ASSERT3U(lod, <, obj->n_lods);
+	if (min_dist != NULL)
+		*min_dist = obj->lods[lod].min_dist;
+	if (max_dist != NULL)
+		*max_dist = obj->lods[lod].max_dist;
+}
+
 /*
  * Applies a pre-transform matrix to all geometry in the OBJ. You can use
  * this when the simple pos_offset parameter in obj8_parse isn't enough.
@@ -1612,6 +3458,19 @@ obj8_set_render_mode2(obj8_t *obj, obj8_render_mode_t mode, int32_t arg)
 	obj->render_mode_arg = arg;
 }
 
+/*
+ * Returns the number of commands which were eliminated by constant folding
+ * of static animations at load time.
+ */
+unsigned
+obj8_get_num_folded_cmds(const obj8_t *obj)
+{
+	ASSERT(obj != NULL);
+	if (!obj->load_complete)
+		return (0);
+	return (obj->n_folded_cmds);
+}
+
 unsigned
 obj8_get_num_manips(const obj8_t *obj)
 {
@@ -1711,6 +3570,19 @@ drset_dr_compar(const void *a, const void *b)
 	return (0);
 }
 
+static int
+drset_arr_compar(const void *a, const void *b)
+{
+	const drset_arr_t *arr_a = a, *arr_b = b;
+	int res = strcmp(arr_a->dr_name, arr_b->dr_name);
+
+	if (res < 0)
+		return (-1);
+	if (res > 0)
+		return (1);
+	return (0);
+}
+
 obj8_drset_t *
 obj8_drset_new(void)
 {
@@ -1719,7 +3591,10 @@ obj8_drset_new(void)
 	    offsetof(drset_dr_t, tree_node));
 	list_create(&drset->list, sizeof (drset_dr_t),
 	    offsetof(drset_dr_t, list_node));
+	avl_create(&drset->arrays, drset_arr_compar, sizeof (drset_arr_t),
+	    offsetof(drset_arr_t, tree_node));
 	mutex_init(&drset->lock);
+	mutex_init(&drset->resolve_lock);
 	return (drset);
 }
 
@@ -1728,9 +3603,13 @@ obj8_drset_destroy(obj8_drset_t *drset)
 {
 	void *cookie = NULL;
 	drset_dr_t *dr;
+	drset_arr_t *arr;
 
 	if (drset == NULL)
 		return;
+	/* obj8_free calls us on the main thread */
+	if (drset->lazy_floop)
+		XPLMUnregisterFlightLoopCallback(drset_lazy_floop, drset);
 	/*
 	 * Nodes are held in the list, so just destroy the tree quickly.
 	 */
@@ -1740,8 +3619,17 @@ obj8_drset_destroy(obj8_drset_t *drset)
 	while ((dr = list_remove_head(&drset->list)) != NULL)
 		free(dr);
 	list_destroy(&drset->list);
+	cookie = NULL;
+	while ((arr = avl_destroy_nodes(&drset->arrays, &cookie)) != NULL) {
+		free(arr->values);
+		free(arr);
+	}
+	avl_destroy(&drset->arrays);
 	mutex_destroy(&drset->lock);
+	mutex_destroy(&drset->resolve_lock);
 	free(drset->values);
+	free(drset->trig_deltas);
+	free(drset->change_serials);
 
 	free(drset);
 }
@@ -1772,38 +3660,80 @@ obj8_drset_add(obj8_drset_t *drset, const char *name, float trig_delta)
 	} else {
 		dr->trig_delta = MIN(dr->trig_delta, trig_delta);
 	}
+	dr->refs++;
 	return (dr->index);
 }
 
+/*
+ * Drops a reference obtained from obj8_drset_add, for users which turned
+ * out not to need the entry after all. Only possible before the drset is
+ * marked complete. The entry (and its index) stays, but if it isn't
+ * referenced anymore, the resolver skips it.
+ */
+static void
+drset_unref(obj8_drset_t *drset, unsigned idx)
+{
+	drset_dr_t *dr;
+
+	ASSERT(drset != NULL);
+	ASSERT(!drset->complete);
+	if (idx == INVALID_DRSET_IDX)
+		return;
+	ASSERT3U(idx, <, drset->n_drs);
+	dr = list_get_i(&drset->list, idx);
+	ASSERT(dr->refs != 0);
+	dr->refs--;
+}
+
 void
 obj8_drset_mark_complete(obj8_drset_t *drset)
 {
+	unsigned n_unresolved = 0;
+
 	ASSERT(drset != NULL);
 	drset->values = safe_calloc(drset->n_drs, sizeof (*drset->values));
 	drset->trig_deltas = safe_calloc(drset->n_drs,
 	    sizeof (*drset->trig_deltas));
-	for (const drset_dr_t *dr = list_head(&drset->list); dr != NULL;
+	drset->change_serials = safe_calloc(drset->n_drs,
+	    sizeof (*drset->change_serials));
+	for (drset_dr_t *dr = list_head(&drset->list); dr != NULL;
 	    dr = list_next(&drset->list, dr)) {
 		drset->trig_deltas[dr->index] = dr->trig_delta;
+		dr->no_lookup = (dr->refs == 0 || dr->dr_name[0] == '\0' ||
+		    strcmp(dr->dr_name, "none") == 0);
+		if (!dr->no_lookup)
+			n_unresolved++;
 	}
+	/*
+	 * This is usually called from an object's loader thread, while the
+	 * drset is already visible to the main thread.
+	 */
+	mutex_enter(&drset->lock);
+	drset->n_unresolved = n_unresolved;
 	drset->complete = true;
+	mutex_exit(&drset->lock);
 }
 
 static bool
-find_dr_with_offset(char *dr_name, dr_t *dr, int *offset)
+find_dr_with_offset(const char *dr_name, dr_t *dr, int *offset)
 {
+	char base_name[sizeof (((drset_dr_t *)NULL)->dr_name)];
 	char *bracket;
 
 	if (dr_find(dr, "%s", dr_name)) {
 		*offset = -1;
 		return (true);
 	}
-	bracket = strrchr(dr_name, '[');
+	/*
+	 * Work on a copy, the original name is the key in the drset tree.
+	 */
+	strlcpy(base_name, dr_name, sizeof (base_name));
+	bracket = strrchr(base_name, '[');
 	if (bracket != NULL) {
 		int cap;
 
 		*bracket = 0;
-		if (!dr_find(dr, "%s", dr_name))
+		if (!dr_find(dr, "%s", base_name))
 			return (false);
 		cap = dr_getvf32(dr, NULL, 0, 0);
 		if (cap == 0)
@@ -1815,23 +3745,244 @@ find_dr_with_offset(char *dr_name, dr_t *dr, int *offset)
 	return (false);
 }
 
-static inline float
-drset_dr_updatef(drset_dr_t *dr)
+/*
+ * Attaches a freshly resolved indexed drset entry to the array group of
+ * its base dataref, creating the group if necessary and widening its
+ * fetch range to cover the entry's offset.
+ */
+static void
+drset_arr_attach(obj8_drset_t *drset, drset_dr_t *dr)
 {
-	float v;
+	drset_arr_t srch = { 0 };
+	drset_arr_t *arr;
+	avl_index_t where;
+	char *bracket;
+
+	ASSERT(drset != NULL);
+	ASSERT(dr != NULL);
+	ASSERT_MUTEX_HELD(&drset->lock);
+	ASSERT(dr->dr_found);
+	ASSERT3S(dr->dr_offset, >=, 0);
+	ASSERT3P(dr->arr, ==, NULL);
+
+	strlcpy(srch.dr_name, dr->dr_name, sizeof (srch.dr_name));
+	bracket = strrchr(srch.dr_name, '[');
+	ASSERT(bracket != NULL);
+	*bracket = 0;
+
+	arr = avl_find(&drset->arrays, &srch, &where);
+	if (arr == NULL) {
+		arr = safe_calloc(1, sizeof (*arr));
+		strlcpy(arr->dr_name, srch.dr_name, sizeof (arr->dr_name));
+		arr->dr = dr->dr;
+		arr->off_min = dr->dr_offset;
+		arr->off_max = dr->dr_offset;
+		arr->values = safe_calloc(1, sizeof (*arr->values));
+		avl_insert(&drset->arrays, arr, where);
+	} else if (dr->dr_offset < arr->off_min ||
+	    dr->dr_offset > arr->off_max) {
+		arr->off_min = MIN(arr->off_min, dr->dr_offset);
+		arr->off_max = MAX(arr->off_max, dr->dr_offset);
+		free(arr->values);
+		arr->values = safe_calloc(arr->off_max - arr->off_min + 1,
+		    sizeof (*arr->values));
+	}
+	dr->arr = arr;
+}
+
+static bool
+drset_resolve_impl(obj8_drset_t *drset, uint64_t deadline)
+{
+	uint64_t now;
+	bool done;
+
+	mutex_enter(&drset->lock);
+	done = (drset->complete && drset->n_unresolved == 0);
+	if (!drset->complete || done) {
+		mutex_exit(&drset->lock);
+		return (done);
+	}
+	mutex_exit(&drset->lock);
+
+	/*
+	 * `resolve_lock' serializes us against the lazy resolver. The list
+	 * is immutable by now, so we can walk it without `lock'.
+	 */
+	mutex_enter(&drset->resolve_lock);
+	now = microclock();
+	for (drset_dr_t *dr = list_head(&drset->list); dr != NULL;
+	    dr = list_next(&drset->list, dr)) {
+		dr_t dr_tmp;
+		int offset;
 
-	if (COND_UNLIKELY(!dr->dr_found)) {
-		if (COND_LIKELY(dr->dr_lookup_done > MAX_DR_LOOKUPS))
-			return (0);
-		dr->dr_lookup_done++;
-		if (!find_dr_with_offset(dr->dr_name, &dr->dr,
-		    &dr->dr_offset)) {
-			return (0);
+		if (dr->dr_found || dr->no_lookup ||
+		    dr->n_lookups >= MAX_DR_LOOKUPS ||
+		    dr->next_lookup_t > now) {
+			continue;
+		}
+		if (deadline != 0 && now >= deadline)
+			break;
+		dr->n_lookups++;
+		if (!find_dr_with_offset(dr->dr_name, &dr_tmp, &offset)) {
+			dr->lookup_ival = MAX(dr->lookup_ival * 2,
+			    (uint64_t)DR_LOOKUP_IVAL_MIN);
+			dr->lookup_ival = MIN(dr->lookup_ival,
+			    (uint64_t)DR_LOOKUP_IVAL_MAX);
+			now = microclock();
+			dr->next_lookup_t = now + dr->lookup_ival;
+			if (dr->n_lookups >= MAX_DR_LOOKUPS) {
+				/* give up, the entry stays at zero */
+				mutex_enter(&drset->lock);
+				ASSERT(drset->n_unresolved != 0);
+				drset->n_unresolved--;
+				mutex_exit(&drset->lock);
+			}
+			continue;
 		}
+		mutex_enter(&drset->lock);
+		dr->dr = dr_tmp;
+		dr->dr_offset = offset;
 		dr->dr_found = true;
+		if (offset >= 0)
+			drset_arr_attach(drset, dr);
+		ASSERT(drset->n_unresolved != 0);
+		drset->n_unresolved--;
+		mutex_exit(&drset->lock);
+
+		if (drset->resolve_cb != NULL) {
+			drset->resolve_cb(drset, dr->index,
+			    drset->resolve_userinfo);
+		}
+		now = microclock();
+	}
+	mutex_exit(&drset->resolve_lock);
+
+	mutex_enter(&drset->lock);
+	done = (drset->n_unresolved == 0);
+	mutex_exit(&drset->lock);
+
+	return (done);
+}
+
+/*
+ * Flight loop callback doing the lookups for drsets whose user never
+ * calls obj8_drset_resolve. Registered by obj8_drset_update2, so the
+ * lookups happen in a flight loop rather than in the drawing callback.
+ */
+static float
+drset_lazy_floop(float elapsed1, float elapsed2, int counter, void *refcon)
+{
+	obj8_drset_t *drset = refcon;
+	bool user_resolves;
+
+	UNUSED(elapsed1);
+	UNUSED(elapsed2);
+	UNUSED(counter);
+	ASSERT(drset != NULL);
+
+	mutex_enter(&drset->lock);
+	user_resolves = drset->resolve_explicit;
+	mutex_exit(&drset->lock);
+	/*
+	 * Once the user has taken over or we're done, we go dormant. The
+	 * callback stays registered until obj8_drset_destroy.
+	 */
+	if (user_resolves || drset_resolve_impl(drset,
+	    microclock() + DR_LAZY_RESOLVE_BUDGET)) {
+		return (0);
+	}
+	return (-1);
+}
+
+/*
+ * Attempts to resolve the datarefs of all entries in the drset, which
+ * haven't been found yet and whose retry interval has elapsed. This
+ * performs the (comparatively expensive) dataref lookups, so it should be
+ * called from a flight loop callback and never from a drawing callback.
+ *
+ * Calling this is optional. Until it has been called for the first time,
+ * the first obj8_drset_update registers a flight loop callback, which
+ * performs the lookups on its own (subject to the same retry intervals
+ * and a small per-frame time budget). Once this has been called, the
+ * flight loop goes dormant and entries remain at zero until they have
+ * been resolved here.
+ *
+ * A dataref which still hasn't been found after MAX_DR_LOOKUPS attempts
+ * is given up on, its entry remains at zero.
+ *
+ * `deadline' is a microclock() timestamp, after which we stop and leave
+ * the remaining entries for the next call. Pass 0 for no limit. Returns
+ * true if all entries have been resolved (so you can stop calling this),
+ * or false if there is still work left to do.
+ */
+bool
+obj8_drset_resolve(obj8_drset_t *drset, uint64_t deadline)
+{
+	ASSERT(drset != NULL);
+
+	mutex_enter(&drset->lock);
+	drset->resolve_explicit = true;
+	mutex_exit(&drset->lock);
+
+	return (drset_resolve_impl(drset, deadline));
+}
+
+/*
+ * Returns the number of drset entries whose dataref hasn't been found
+ * yet, not counting the ones we have given up on. Returns 0 until the
+ * drset is complete.
+ */
+unsigned
+obj8_drset_get_num_unresolved(const obj8_drset_t *drset)
+{
+	unsigned n;
+
+	ASSERT(drset != NULL);
+	mutex_enter((mutex_t *)&drset->lock);
+	n = drset->n_unresolved;
+	mutex_exit((mutex_t *)&drset->lock);
+
+	return (n);
+}
+
+/*
+ * Sets a callback which gets called whenever a previously missing
+ * dataref has been found, either from obj8_drset_resolve or from the
+ * lazy resolver's flight loop. The callback must not call
+ * obj8_drset_resolve.
+ */
+void
+obj8_drset_set_resolve_cb(obj8_drset_t *drset, obj8_drset_resolve_cb_t cb,
+    void *userinfo)
+{
+	ASSERT(drset != NULL);
+	drset->resolve_cb = cb;
+	drset->resolve_userinfo = userinfo;
+}
+
+static void
+drset_arr_update(drset_arr_t *arr)
+{
+	int n = arr->off_max - arr->off_min + 1;
+	int n_read = dr_getvf32(&arr->dr, arr->values, arr->off_min, n);
+
+	/* The array might have shrunk since we resolved it */
+	if (COND_UNLIKELY(n_read < n)) {
+		n_read = MAX(n_read, 0);
+		memset(&arr->values[n_read], 0,
+		    (n - n_read) * sizeof (*arr->values));
 	}
-	if (dr->dr_offset > 0)
-		dr_getvf32(&dr->dr, &v, dr->dr_offset, 1);
+}
+
+static inline float
+drset_dr_updatef(const drset_dr_t *dr)
+{
+	float v;
+
+	if (COND_UNLIKELY(!dr->dr_found))
+		return (0);
+	if (dr->arr != NULL)
+		v = dr->arr->values[dr->dr_offset - dr->arr->off_min];
 	else
 		v = dr_getf(&dr->dr);
 	if (COND_UNLIKELY(!isfinite(v))) {
@@ -1844,52 +3995,86 @@ drset_dr_updatef(drset_dr_t *dr)
 	return (v);
 }
 
-static bool
-check_drs_have_changed(const obj8_drset_t *drset, const float *new_vals)
+bool
+obj8_drset_update(obj8_drset_t *drset)
 {
-	ASSERT(drset != NULL);
-	ASSERT_MUTEX_HELD(&drset->lock);
-	ASSERT(new_vals != NULL);
-
-	for (unsigned i = 0; i < drset->n_drs; i++) {
-		if (fabs(drset->values[i] - new_vals[i]) >
-		    drset->trig_deltas[i]) {
-			return (true);
-		}
-	}
-	return (false);
+	return (obj8_drset_update2(drset, NULL));
 }
 
+/*
+ * Refreshes the values of all datarefs in the drset. An entry's published
+ * value is only replaced once it has moved by more than its trigger delta
+ * away from the previously published value. If `changed' is not NULL, it
+ * must point to an array of at least OBJ8_DRSET_BITMAP_WORDS(n_drs) words,
+ * which will be filled with a bitmap of the entries whose value has been
+ * replaced (test individual entries using obj8_drset_changed). Returns
+ * true if any entry changed.
+ */
 bool
-obj8_drset_update(obj8_drset_t *drset)
+obj8_drset_update2(obj8_drset_t *drset, uint32_t *changed)
 {
 	unsigned idx;
 	float *vals;
+	bool any_changed = false;
+	bool complete, lazy_resolve;
 
 	ASSERT(drset != NULL);
 
-	if (!drset->complete)
+	if (changed != NULL) {
+		memset(changed, 0, OBJ8_DRSET_BITMAP_WORDS(drset->n_drs) *
+		    sizeof (*changed));
+	}
+	mutex_enter(&drset->lock);
+	complete = drset->complete;
+	lazy_resolve = (!drset->resolve_explicit && drset->n_unresolved != 0);
+	mutex_exit(&drset->lock);
+	if (!complete)
 		return (false);
+	/*
+	 * Users which never call obj8_drset_resolve rely on us to find the
+	 * datarefs, see obj8_drset_resolve. We're on the main thread here
+	 * (we read datarefs), so we can register the flight loop.
+	 */
+	if (lazy_resolve && !drset->lazy_floop) {
+		XPLMRegisterFlightLoopCallback(drset_lazy_floop, -1, drset);
+		drset->lazy_floop = true;
+	}
 
 	vals = safe_malloc(drset->n_drs * sizeof (*vals));
-	idx = 0;
 	ASSERT3U(list_count(&drset->list), ==, drset->n_drs);
+	ASSERT(drset->values != NULL);
+	/*
+	 * The lock keeps obj8_drset_resolve from changing the set of
+	 * resolved entries and array groups while we're reading them.
+	 */
+	mutex_enter(&drset->lock);
+	/*
+	 * Fetch all indexed entries of each array dataref in one go.
+	 */
+	for (drset_arr_t *arr = avl_first(&drset->arrays); arr != NULL;
+	    arr = AVL_NEXT(&drset->arrays, arr)) {
+		drset_arr_update(arr);
+	}
+	idx = 0;
 	for (drset_dr_t *dr = list_head(&drset->list); dr != NULL;
 	    dr = list_next(&drset->list, dr), idx++) {
 		vals[idx] = drset_dr_updatef(dr);
 	}
-	ASSERT(drset->values != NULL);
-	mutex_enter(&drset->lock);
-	if (!check_drs_have_changed(drset, vals)) {
-		mutex_exit(&drset->lock);
-		free(vals);
-		return (false);
-	} else {
-		free(drset->values);
-		drset->values = vals;
-		mutex_exit(&drset->lock);
-		return (true);
+	for (unsigned i = 0; i < drset->n_drs; i++) {
+		if (fabs(drset->values[i] - vals[i]) <= drset->trig_deltas[i])
+			continue;
+		drset->values[i] = vals[i];
+		drset->change_serials[i] = drset->serial + 1;
+		if (changed != NULL)
+			changed[i / 32] |= (1u << (i % 32));
+		any_changed = true;
 	}
+	if (any_changed)
+		drset->serial++;
+	mutex_exit(&drset->lock);
+	free(vals);
+
+	return (any_changed);
 }
 
 size_t
@@ -20,6 +20,7 @@
 #define	_OBJ8_H_
 
 #include <stdio.h>
+#include <stdint.h>
 
 #include <XPLMUtilities.h>
 
@@ -33,6 +34,7 @@
 #include <cglm/cglm.h>
 
 #include "librain_common.h"
+#include "librain_mem.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -140,25 +142,154 @@ typedef enum {
 	OBJ8_RENDER_MODE_MANIP_ONLY_ONE
 } obj8_render_mode_t;
 
-typedef struct {
+typedef struct obj8_drset_s obj8_drset_t;
+
+/*
+ * Called from obj8_drset_resolve (or the lazy resolver, see there) once
+ * the dataref of entry `idx' has been found.
+ */
+typedef void (*obj8_drset_resolve_cb_t)(obj8_drset_t *drset, unsigned idx,
+    void *userinfo);
+
+struct obj8_drset_s {
 	unsigned	n_drs;
 	avl_tree_t	tree;
 	list_t		list;
+	/*
+	 * Indexed entries ("name[N]") sharing the same base array dataref
+	 * are grouped here, so we can fetch them with a single call.
+	 */
+	avl_tree_t	arrays;
 	bool		complete;
 	mutex_t		lock;
 	float		*values;	/* protected by `lock` above */
 	float		*trig_deltas;	// constant after init
-} obj8_drset_t;
+	/*
+	 * `serial' is bumped by every update which changed at least one
+	 * value. `change_serials' holds, for every entry, the serial of the
+	 * last update which changed that entry. Consumers can remember the
+	 * serial they last saw and cheaply find out which entries changed
+	 * since then. Both are protected by `lock'.
+	 */
+	uint64_t	serial;
+	uint64_t	*change_serials;
+	/*
+	 * Number of entries still waiting for their dataref to be found,
+	 * protected by `lock'. Until obj8_drset_resolve is first called by
+	 * the user, a flight loop registered by obj8_drset_update resolves
+	 * them lazily (`lazy_floop' is only touched on the main thread).
+	 * `resolve_lock' serializes the two resolvers.
+	 */
+	unsigned	n_unresolved;
+	bool		resolve_explicit;
+	bool		lazy_floop;
+	mutex_t		resolve_lock;
+	obj8_drset_resolve_cb_t	resolve_cb;
+	void		*resolve_userinfo;
+};
+
+/*
+ * What happens to the CPU-side copy of an object's geometry once it has
+ * been uploaded to the GPU. This determines whether obj8_get_triangle_data
+ * can still return the geometry after the object has been drawn.
+ */
+typedef enum {
+	OBJ8_RETAIN_NONE,	/* discarded (default) */
+	OBJ8_RETAIN_CPU,	/* kept in memory alongside the GPU copy */
+	/*
+	 * Discarded, but read back from the GPU buffers on demand. The
+	 * first query after upload kicks off an asynchronous readback,
+	 * which is serviced by subsequent draws of the object. Once it
+	 * completes, the geometry stays cached as with OBJ8_RETAIN_CPU.
+	 */
+	OBJ8_RETAIN_READBACK
+} obj8_retain_t;
+
+/*
+ * Optional load-time parameters for obj8_parse2.
+ */
+typedef struct {
+	/*
+	 * If greater than zero, the loader also builds a simplified occluder
+	 * version of the mesh, which is then drawn in place of the full mesh
+	 * by programs only reading the vertex position (i.e. depth-only
+	 * passes, such as librain_draw_z_depth). This is the maximum allowed
+	 * deviation from the original surface in meters. The simplification
+	 * never opens up holes in the mesh, nor moves its open borders, but
+	 * it isn't conservative: the surface may shrink inward by up to this
+	 * much. The occluder is rebuilt on every load (it is not cached),
+	 * which adds to the load time of large meshes, see obj8_occl.c.
+	 * Zero, negative and non-finite values disable the occluder.
+	 */
+	float		occluder_tol;
+	obj8_retain_t	retain;
+	/*
+	 * Also upload a separate, tightly packed position-only vertex
+	 * buffer. It is then used automatically when drawing with programs
+	 * which don't use the vtx_norm and vtx_tex0 attributes, such as
+	 * depth-only passes, to reduce the vertex fetch bandwidth.
+	 */
+	bool		pos_buf;
+} obj8_parse_opts_t;
+
+/*
+ * Reader callback for obj8_parse_stream. Must fill up to `cap' bytes into
+ * `buf' and set `*n_read' to the number of bytes stored, or to 0 at the
+ * end of the data. Returns false on a read error, which aborts the load.
+ * Called from the object's loader thread.
+ */
+typedef bool (*obj8_read_cb_t)(void *buf, size_t cap, size_t *n_read,
+    void *userinfo);
+/*
+ * Called from the loader thread once it no longer needs the reader, so
+ * the caller can release its resources. Called exactly once per
+ * successful call to obj8_parse_stream, whether or not the load
+ * succeeded.
+ */
+typedef void (*obj8_close_cb_t)(void *userinfo);
+
+/*
+ * Number of 32-bit words needed for a change bitmap covering `n_drs'
+ * entries, as filled in by obj8_drset_update2.
+ */
+#define	OBJ8_DRSET_BITMAP_WORDS(n_drs)	(((n_drs) + 31) / 32)
 
 LIBRAIN_EXPORT obj8_t *obj8_parse(const char *filename, vect3_t pos_offset);
+LIBRAIN_EXPORT obj8_t *obj8_parse2(const char *filename, vect3_t pos_offset,
+    const obj8_parse_opts_t *opts);
+LIBRAIN_EXPORT obj8_t *obj8_parse_mem(const void *buf, size_t len,
+    const char *name, vect3_t pos_offset, const obj8_parse_opts_t *opts);
+LIBRAIN_EXPORT obj8_t *obj8_parse_stream(obj8_read_cb_t read_cb,
+    obj8_close_cb_t close_cb, void *userinfo, const char *name,
+    vect3_t pos_offset, const obj8_parse_opts_t *opts);
 LIBRAIN_EXPORT void obj8_free(obj8_t *obj);
+LIBRAIN_EXPORT void obj8_release_vaos(obj8_t *obj);
 LIBRAIN_EXPORT bool obj8_needs_upload(const obj8_t *obj);
+LIBRAIN_EXPORT bool obj8_is_uploaded(const obj8_t *obj);
+LIBRAIN_EXPORT librain_mem_stat_t obj8_get_mem_stat(const obj8_t *obj);
+LIBRAIN_EXPORT bool obj8_get_bounds(const obj8_t *obj, const char *groupname,
+    vect3_t *min_p, vect3_t *max_p);
 
 LIBRAIN_EXPORT int obj8_get_triangle_data(obj8_t *obj, obj8_vtx_t *data,
     unsigned cap);
+LIBRAIN_EXPORT int obj8_get_triangle_data2(obj8_t *obj, const char *group_id,
+    bool animated, obj8_vtx_t *data, unsigned cap);
+
+/*
+ * Special LOD selectors for obj8_draw_group_lod.
+ */
+#define	OBJ8_LOD_ALL		-1
+#define	OBJ8_LOD_COARSEST	-2
 
 LIBRAIN_EXPORT void obj8_draw_group(obj8_t *obj, const char *groupname,
     GLuint prog, const mat4 mvp);
+LIBRAIN_EXPORT void obj8_draw_group_dist(obj8_t *obj, const char *groupname,
+    GLuint prog, const mat4 mvp, float dist);
+LIBRAIN_EXPORT void obj8_draw_group_lod(obj8_t *obj, const char *groupname,
+    GLuint prog, const mat4 mvp, int lod);
+LIBRAIN_EXPORT unsigned obj8_get_num_lods(const obj8_t *obj);
+LIBRAIN_EXPORT void obj8_get_lod_range(const obj8_t *obj, unsigned lod,
+    float *min_dist, float *max_dist);
 LIBRAIN_EXPORT void obj8_set_matrix(obj8_t *obj, mat4 matrix);
 
 LIBRAIN_EXPORT obj8_render_mode_t obj8_get_render_mode(const obj8_t *obj);
@@ -166,6 +297,16 @@ LIBRAIN_EXPORT void obj8_set_render_mode(obj8_t *obj, obj8_render_mode_t mode);
 LIBRAIN_EXPORT void obj8_set_render_mode2(obj8_t *obj, obj8_render_mode_t mode,
     int32_t arg);
 
+LIBRAIN_EXPORT bool obj8_geom_arena_init(unsigned vtx_cap, unsigned idx_cap);
+LIBRAIN_EXPORT void obj8_geom_arena_fini(void);
+LIBRAIN_EXPORT void obj8_geom_arena_release_vaos(void);
+LIBRAIN_EXPORT void obj8_geom_arena_batch_begin(void);
+LIBRAIN_EXPORT void obj8_geom_arena_batch_end(void);
+
+LIBRAIN_EXPORT bool obj8_uploader_init(void);
+LIBRAIN_EXPORT void obj8_uploader_fini(void);
+LIBRAIN_EXPORT unsigned obj8_get_num_folded_cmds(const obj8_t *obj);
+
 LIBRAIN_EXPORT unsigned obj8_get_num_manips(const obj8_t *obj);
 LIBRAIN_EXPORT const obj8_manip_t *obj8_get_manip(const obj8_t *obj,
     unsigned idx);
@@ -191,7 +332,22 @@ LIBRAIN_EXPORT void obj8_drset_mark_complete(obj8_drset_t *drset);
 
 LIBRAIN_EXPORT unsigned obj8_drset_add(obj8_drset_t *drset, const char *name,
     float trig_delta);
+LIBRAIN_EXPORT bool obj8_drset_resolve(obj8_drset_t *drset,
+    uint64_t deadline);
+LIBRAIN_EXPORT unsigned obj8_drset_get_num_unresolved(
+    const obj8_drset_t *drset);
+LIBRAIN_EXPORT void obj8_drset_set_resolve_cb(obj8_drset_t *drset,
+    obj8_drset_resolve_cb_t cb, void *userinfo);
 LIBRAIN_EXPORT bool obj8_drset_update(obj8_drset_t *drset);
+LIBRAIN_EXPORT bool obj8_drset_update2(obj8_drset_t *drset,
+    uint32_t *changed);
+
+static inline bool
+obj8_drset_changed(const uint32_t *changed, unsigned idx)
+{
+	ASSERT(changed != NULL);
+	return ((changed[idx / 32] & (1u << (idx % 32))) != 0);
+}
 LIBRAIN_EXPORT const char *obj8_drset_get_dr_name(const obj8_drset_t *drset,
     unsigned idx);
 
@@ -207,6 +363,20 @@ obj8_drset_getf(const obj8_drset_t *drset, unsigned idx)
 	return (value);
 }
 
+/*
+ * Returns the drset's `serial', which changes whenever an update (by
+ * whoever updates the drset) has changed at least one value.
+ */
+static inline uint64_t
+obj8_drset_get_serial(const obj8_drset_t *drset)
+{
+	ASSERT(drset != NULL);
+	mutex_enter((mutex_t *)&drset->lock);
+	uint64_t serial = drset->serial;
+	mutex_exit((mutex_t *)&drset->lock);
+	return (serial);
+}
+
 LIBRAIN_EXPORT size_t obj8_drset_get_all(const obj8_drset_t *drset,
     float *out_values, size_t cap);
 
@@ -0,0 +1,812 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2023 Saso Kiselkov. All rights reserved.
+ */
+
+/*
+ * Shared geometry arena. When enabled, objects don't get their own vertex
+ * and index buffers on upload. Instead, their data is sub-allocated from
+ * a few large buffers shared by all objects, which are drawn using a
+ * single VAO and base-vertex draw calls. Drawing many objects then doesn't
+ * require switching buffers or attribute pointers between objects.
+ *
+ * Each buffer type is managed by a heap, which keeps a list of live
+ * regions and a list of free extents, both sorted by offset. Freed
+ * regions are coalesced with their neighboring free extents. If no single
+ * free extent is large enough for an allocation, the heap is defragmented
+ * by copying all live regions into a new buffer back-to-back (growing it
+ * if need be) on the GPU, and updating the regions' offsets in place.
+ *
+ * Objects can be uploaded into the arena and freed from any thread whose
+ * GL context is shared with the drawing context. All changes to the
+ * heaps (allocation, freeing and compaction) are serialized by the arena
+ * lock. Objects in the arena can be drawn from other threads with shared
+ * contexts (each of which gets its own VAOs). Draws don't take the lock.
+ * A compaction replaces the buffers, but the old ones are only retired,
+ * not deleted: they stay around until a fence placed after the copy has
+ * signaled, so a draw which still picked up the old buffers doesn't end
+ * up using a deleted (or worse, reused) buffer name. A draw racing a
+ * compaction can still mix up old and new offsets for that one frame.
+ * Every compaction bumps the arena's generation number, which the
+ * drawing threads compare against their VAOs to find out when the
+ * attribute pointers need to be set up again.
+ * Consecutive draws from the arena can be batched, so the VAO is only
+ * bound once for all of them (see obj8_geom_arena_batch_begin).
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <acfutils/assert.h>
+#include <acfutils/glutils.h>
+#include <acfutils/helpers.h>
+#include <acfutils/log.h>
+#include <acfutils/safe_alloc.h>
+#include <acfutils/thread.h>
+
+#include "obj8_geom.h"
+
+#define	HEAP_MAX_BUFS	2
+
+TEXSZ_MK_TOKEN(obj8_geom_arena);
+
+/*
+ * Values of obj8_vao_slot_t's `state' field. A slot is busy while the
+ * thread which claimed it is still setting it up. Released slots go back
+ * to being empty and can be claimed again.
+ */
+enum { SLOT_EMPTY = 0, SLOT_BUSY = 1, SLOT_READY = 2 };
+
+typedef struct {
+	unsigned	off;
+	unsigned	len;
+	list_node_t	node;
+} free_ext_t;
+
+/*
+ * Buffers replaced by a compaction, waiting for `fence' to signal.
+ */
+typedef struct {
+	GLuint		bufs[HEAP_MAX_BUFS];
+	size_t		sz[HEAP_MAX_BUFS];
+	GLsync		fence;
+	list_node_t	node;
+} retired_bufs_t;
+
+typedef struct {
+	GLuint		bufs[HEAP_MAX_BUFS];
+	size_t		elem_sz[HEAP_MAX_BUFS];
+	unsigned	cap;		/* elements */
+	unsigned	n_free;		/* elements */
+	list_t		free;		/* free_ext_t, sorted by offset */
+	list_t		live;		/* obj8_geom_region_t, by offset */
+} geom_heap_t;
+
+static struct {
+	bool		inited;
+	mutex_t		lock;		/* protects the heaps and `retired' */
+	/* vtx.bufs[0] holds the vertices, vtx.bufs[1] the positions */
+	geom_heap_t	vtx;
+	geom_heap_t	idx;
+	obj8_vao_cache_t vaos;
+	unsigned	gen;		/* bumped by compaction, atomic */
+	list_t		retired;	/* retired_bufs_t */
+} arena = { .inited = false };
+
+void
+obj8_vao_init(obj8_vao_t *vao)
+{
+	memset(vao, 0, sizeof (*vao));
+	vao->pos_loc = -1;
+	vao->norm_loc = -1;
+	vao->tex0_loc = -1;
+}
+
+static void
+vao_slot_create(obj8_vao_slot_t *slot)
+{
+	if (slot->vaos_created)
+		return;
+	slot->vaos_created = true;
+	if (!GLEW_VERSION_3_0)
+		return;
+	glGenVertexArrays(1, &slot->vao.id);
+	glGenVertexArrays(1, &slot->pos_vao.id);
+	if (slot->vao.id == 0 || slot->pos_vao.id == 0) {
+		/*
+		 * On macOS, even though GLEW can find the glGenVertexArrays
+		 * function, if we're in a compatibility context, this
+		 * function simply errors out. So just swallow the error
+		 * and carry on without VAOs.
+		 */
+		glutils_reset_errors();
+		if (slot->vao.id != 0)
+			glDeleteVertexArrays(1, &slot->vao.id);
+		if (slot->pos_vao.id != 0)
+			glDeleteVertexArrays(1, &slot->pos_vao.id);
+		slot->vao.id = slot->pos_vao.id = 0;
+	}
+}
+
+static obj8_vao_slot_t *
+vao_cache_find(obj8_vao_cache_t *cache)
+{
+	thread_id_t self = curthread_id;
+
+	for (unsigned i = 0; i < OBJ8_VAO_CACHE_SLOTS; i++) {
+		obj8_vao_slot_t *slot = &cache->slots[i];
+
+		/*
+		 * Another thread may be reclaiming the slot while we look at
+		 * it, but it can never be reclaimed by, or for, us.
+		 */
+		if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) ==
+		    SLOT_READY && thread_equal(__atomic_load_n(&slot->thread,
+		    __ATOMIC_RELAXED), self))
+			return (slot);
+	}
+	return (NULL);
+}
+
+/*
+ * Returns the calling thread's slot, claiming a free one on its first
+ * call. Returns NULL if all slots are taken by other threads. The slot's
+ * VAOs are only created once they are first asked for, so slots can
+ * also be used just to hold per-thread state.
+ */
+obj8_vao_slot_t *
+obj8_vao_cache_slot(obj8_vao_cache_t *cache)
+{
+	obj8_vao_slot_t *slot = vao_cache_find(cache);
+
+	if (slot != NULL)
+		return (slot);
+	for (unsigned i = 0; i < OBJ8_VAO_CACHE_SLOTS; i++) {
+		int expected = SLOT_EMPTY;
+
+		slot = &cache->slots[i];
+		if (!__atomic_compare_exchange_n(&slot->state, &expected,
+		    SLOT_BUSY, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			continue;
+		__atomic_store_n(&slot->thread, curthread_id,
+		    __ATOMIC_RELAXED);
+		slot->vaos_created = false;
+		obj8_vao_init(&slot->vao);
+		obj8_vao_init(&slot->pos_vao);
+		memset(&slot->locs, 0, sizeof (slot->locs));
+		slot->draw_state = NULL;
+		slot->batch_depth = 0;
+		slot->batch_bound = NULL;
+		__atomic_store_n(&slot->state, SLOT_READY, __ATOMIC_RELEASE);
+		return (slot);
+	}
+	return (NULL);
+}
+
+/*
+ * Returns the attribute pointer set of `slot' for either the full, or the
+ * position-only vertex buffer, creating the slot's VAOs on first use. If
+ * VAOs can't be used, the returned set has id == 0. If `slot' is NULL
+ * (because we've run out of slots), `scratch' is reset and returned
+ * instead, which makes the caller set up the attribute pointers from
+ * scratch on every draw.
+ */
+obj8_vao_t *
+obj8_vao_slot_get(obj8_vao_slot_t *slot, bool pos_only, obj8_vao_t *scratch)
+{
+	ASSERT(scratch != NULL);
+
+	if (slot == NULL) {
+		obj8_vao_init(scratch);
+		return (scratch);
+	}
+	vao_slot_create(slot);
+	return (pos_only ? &slot->pos_vao : &slot->vao);
+}
+
+/*
+ * Same as obj8_vao_slot_get, but looks up the calling thread's slot.
+ */
+obj8_vao_t *
+obj8_vao_cache_get(obj8_vao_cache_t *cache, bool pos_only,
+    obj8_vao_t *scratch)
+{
+	return (obj8_vao_slot_get(obj8_vao_cache_slot(cache), pos_only,
+	    scratch));
+}
+
+/*
+ * Deletes the calling thread's VAOs from the cache and frees up its slot
+ * for use by other threads. VAOs can only be deleted in the context which
+ * created them, so this must be called by every drawing thread (with its
+ * context current) before the buffers which the cache refers to are
+ * destroyed. Returns the slot's `draw_state', which the caller must
+ * dispose of, or NULL if the thread had no slot.
+ */
+void *
+obj8_vao_cache_release(obj8_vao_cache_t *cache)
+{
+	obj8_vao_slot_t *slot = vao_cache_find(cache);
+	void *draw_state;
+
+	if (slot == NULL)
+		return (NULL);
+	ASSERT0(slot->batch_depth);
+	if (slot->vao.id != 0)
+		glDeleteVertexArrays(1, &slot->vao.id);
+	if (slot->pos_vao.id != 0)
+		glDeleteVertexArrays(1, &slot->pos_vao.id);
+	slot->vao.id = slot->pos_vao.id = 0;
+	draw_state = slot->draw_state;
+	slot->draw_state = NULL;
+	__atomic_store_n(&slot->state, SLOT_EMPTY, __ATOMIC_RELEASE);
+
+	return (draw_state);
+}
+
+static GLuint
+heap_buf_create(size_t sz)
+{
+	GLuint buf;
+
+	glGenBuffers(1, &buf);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buf);
+	if (GLEW_ARB_buffer_storage) {
+		glBufferStorage(GL_COPY_WRITE_BUFFER, sz, NULL,
+		    GL_DYNAMIC_STORAGE_BIT);
+	} else {
+		glBufferData(GL_COPY_WRITE_BUFFER, sz, NULL, GL_STATIC_DRAW);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	IF_TEXSZ(TEXSZ_ALLOC_BYTES_INSTANCE(obj8_geom_arena, &arena,
+	    NULL, 0, sz));
+	librain_mem_alloc(LIBRAIN_MEM_OBJ8_ARENA, NULL, sz);
+
+	return (buf);
+}
+
+static void
+heap_buf_destroy(GLuint *buf, size_t sz)
+{
+	if (*buf != 0) {
+		glDeleteBuffers(1, buf);
+		IF_TEXSZ(TEXSZ_FREE_BYTES_INSTANCE(obj8_geom_arena, &arena,
+		    sz));
+		librain_mem_free(LIBRAIN_MEM_OBJ8_ARENA, NULL, sz);
+		*buf = 0;
+	}
+}
+
+/*
+ * Deletes retired buffers whose fence has signaled, or all of them if
+ * `all' is set.
+ */
+static void
+retired_reap(bool all)
+{
+	retired_bufs_t *rb, *next;
+
+	ASSERT_MUTEX_HELD(&arena.lock);
+	for (rb = list_head(&arena.retired); rb != NULL; rb = next) {
+		next = list_next(&arena.retired, rb);
+		if (!all && glClientWaitSync(rb->fence, 0, 0) ==
+		    GL_TIMEOUT_EXPIRED) {
+			continue;
+		}
+		glDeleteSync(rb->fence);
+		for (int i = 0; i < HEAP_MAX_BUFS; i++)
+			heap_buf_destroy(&rb->bufs[i], rb->sz[i]);
+		list_remove(&arena.retired, rb);
+		free(rb);
+	}
+}
+
+static void
+heap_init(geom_heap_t *h, unsigned cap, size_t elem_sz0, size_t elem_sz1)
+{
+	free_ext_t *ext = safe_calloc(1, sizeof (*ext));
+
+	ASSERT3U(cap, >, 0);
+
+	memset(h, 0, sizeof (*h));
+	list_create(&h->free, sizeof (free_ext_t),
+	    offsetof(free_ext_t, node));
+	list_create(&h->live, sizeof (obj8_geom_region_t),
+	    offsetof(obj8_geom_region_t, node));
+	h->elem_sz[0] = elem_sz0;
+	h->elem_sz[1] = elem_sz1;
+	h->cap = cap;
+	h->n_free = cap;
+	h->bufs[0] = heap_buf_create(cap * elem_sz0);
+	/* secondary buffers are created on demand */
+
+	ext->off = 0;
+	ext->len = cap;
+	list_insert_tail(&h->free, ext);
+}
+
+static void
+heap_fini(geom_heap_t *h)
+{
+	free_ext_t *ext;
+
+	ASSERT0(list_count(&h->live));
+
+	while ((ext = list_remove_head(&h->free)) != NULL)
+		free(ext);
+	list_destroy(&h->free);
+	list_destroy(&h->live);
+	for (int i = 0; i < HEAP_MAX_BUFS; i++)
+		heap_buf_destroy(&h->bufs[i], h->cap * h->elem_sz[i]);
+}
+
+/*
+ * Moves all live regions into a new set of buffers of `new_cap' elements,
+ * packing them back-to-back from the start. This leaves a single free
+ * extent at the end of the heap.
+ */
+static void
+heap_relocate(geom_heap_t *h, unsigned new_cap)
+{
+	GLuint new_bufs[HEAP_MAX_BUFS] = { 0 };
+	retired_bufs_t *rb;
+	free_ext_t *ext;
+	unsigned off = 0;
+
+	ASSERT_MUTEX_HELD(&arena.lock);
+	ASSERT3U(new_cap, >=, h->cap - h->n_free);
+
+	for (int i = 0; i < HEAP_MAX_BUFS; i++) {
+		if (h->bufs[i] != 0)
+			new_bufs[i] = heap_buf_create(new_cap *
+			    h->elem_sz[i]);
+	}
+	for (obj8_geom_region_t *r = list_head(&h->live); r != NULL;
+	    r = list_next(&h->live, r)) {
+		for (int i = 0; i < HEAP_MAX_BUFS; i++) {
+			if (h->bufs[i] == 0)
+				continue;
+			glBindBuffer(GL_COPY_READ_BUFFER, h->bufs[i]);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, new_bufs[i]);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER,
+			    GL_COPY_WRITE_BUFFER, r->off * h->elem_sz[i],
+			    off * h->elem_sz[i], r->len * h->elem_sz[i]);
+		}
+		r->off = off;
+		off += r->len;
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	/*
+	 * Drawing threads may still pick up the old buffers, so only
+	 * delete them once the GPU is past everything issued so far.
+	 */
+	rb = safe_calloc(1, sizeof (*rb));
+	for (int i = 0; i < HEAP_MAX_BUFS; i++) {
+		rb->bufs[i] = h->bufs[i];
+		rb->sz[i] = h->cap * h->elem_sz[i];
+		__atomic_store_n(&h->bufs[i], new_bufs[i], __ATOMIC_RELAXED);
+	}
+	rb->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	/* the fence may be polled from another context */
+	glFlush();
+	list_insert_tail(&arena.retired, rb);
+	/* publishes the new buffers, see obj8_geom_get_gen */
+	__atomic_add_fetch(&arena.gen, 1, __ATOMIC_RELEASE);
+
+	while ((ext = list_remove_head(&h->free)) != NULL)
+		free(ext);
+	h->cap = new_cap;
+	h->n_free = new_cap - off;
+	if (h->n_free != 0) {
+		ext = safe_calloc(1, sizeof (*ext));
+		ext->off = off;
+		ext->len = h->n_free;
+		list_insert_tail(&h->free, ext);
+	}
+}
+
+static void
+heap_alloc(geom_heap_t *h, obj8_geom_region_t *r, unsigned len)
+{
+	free_ext_t *ext;
+	obj8_geom_region_t *prev;
+
+	ASSERT_MUTEX_HELD(&arena.lock);
+	ASSERT3U(len, >, 0);
+
+	retired_reap(false);
+	for (ext = list_head(&h->free); ext != NULL;
+	    ext = list_next(&h->free, ext)) {
+		if (ext->len >= len)
+			break;
+	}
+	if (ext == NULL) {
+		/*
+		 * No single free extent is large enough. Compact the heap,
+		 * growing it if there isn't enough free space in total.
+		 */
+		unsigned new_cap = h->cap;
+
+		if (h->n_free < len)
+			new_cap = MAX(h->cap * 2, h->cap - h->n_free + len);
+		heap_relocate(h, new_cap);
+		ext = list_head(&h->free);
+		ASSERT(ext != NULL);
+		ASSERT3U(ext->len, >=, len);
+	}
+	r->off = ext->off;
+	r->len = len;
+	ext->off += len;
+	ext->len -= len;
+	if (ext->len == 0) {
+		list_remove(&h->free, ext);
+		free(ext);
+	}
+	h->n_free -= len;
+
+	for (prev = list_tail(&h->live); prev != NULL && prev->off > r->off;
+	    prev = list_prev(&h->live, prev))
+		;
+	if (prev != NULL)
+		list_insert_after(&h->live, prev, r);
+	else
+		list_insert_head(&h->live, r);
+}
+
+static void
+heap_free(geom_heap_t *h, obj8_geom_region_t *r)
+{
+	free_ext_t *prev = NULL, *next, *ext;
+
+	ASSERT_MUTEX_HELD(&arena.lock);
+	retired_reap(false);
+	list_remove(&h->live, r);
+
+	for (next = list_head(&h->free); next != NULL && next->off < r->off;
+	    next = list_next(&h->free, next))
+		prev = next;
+	if (prev != NULL && prev->off + prev->len == r->off) {
+		ext = prev;
+		ext->len += r->len;
+	} else {
+		ext = safe_calloc(1, sizeof (*ext));
+		ext->off = r->off;
+		ext->len = r->len;
+		if (prev != NULL)
+			list_insert_after(&h->free, prev, ext);
+		else
+			list_insert_head(&h->free, ext);
+	}
+	if (next != NULL && ext->off + ext->len == next->off) {
+		ext->len += next->len;
+		list_remove(&h->free, next);
+		free(next);
+	}
+	h->n_free += r->len;
+	r->len = 0;
+}
+
+static void
+heap_upload(geom_heap_t *h, int buf_i, const obj8_geom_region_t *r,
+    const void *data)
+{
+	size_t esz = h->elem_sz[buf_i];
+
+	ASSERT(h->bufs[buf_i] != 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, h->bufs[buf_i]);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, r->off * esz, r->len * esz,
+	    data);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+/*
+ * Enables the shared geometry arena. All objects uploaded after this call
+ * store their geometry in the arena, rather than in their own buffers.
+ * Objects uploaded before keep using their own buffers.
+ *
+ * @param vtx_cap Initial vertex capacity of the arena.
+ * @param idx_cap Initial index capacity of the arena.
+ *	The arena grows automatically when it runs out of space, but
+ *	growing requires copying its entire contents, so pick a capacity
+ *	which fits the objects you expect to load.
+ *
+ * @return True if the arena was initialized, false if it isn't supported
+ *	by the GL implementation (requires OpenGL 3.2).
+ */
+bool
+obj8_geom_arena_init(unsigned vtx_cap, unsigned idx_cap)
+{
+	ASSERT(!arena.inited);
+	ASSERT3U(vtx_cap, >, 0);
+	ASSERT3U(idx_cap, >, 0);
+
+	if (!GLEW_VERSION_3_2) {
+		logMsg("Can't enable OBJ8 geometry arena: requires "
+		    "OpenGL 3.2");
+		return (false);
+	}
+	memset(&arena, 0, sizeof (arena));
+	mutex_init(&arena.lock);
+	heap_init(&arena.vtx, vtx_cap, sizeof (obj8_vtx_t),
+	    3 * sizeof (GLfloat));
+	heap_init(&arena.idx, idx_cap, sizeof (GLuint), 0);
+	list_create(&arena.retired, sizeof (retired_bufs_t),
+	    offsetof(retired_bufs_t, node));
+	/* freshly initialized VAOs have generation 0, so they look stale */
+	arena.gen = 1;
+	arena.inited = true;
+
+	return (true);
+}
+
+/*
+ * Destroys the shared geometry arena. All objects which were uploaded
+ * into the arena must have been freed before calling this.
+ */
+void
+obj8_geom_arena_fini(void)
+{
+	if (!arena.inited)
+		return;
+	retired_reap(true);
+	list_destroy(&arena.retired);
+	heap_fini(&arena.vtx);
+	heap_fini(&arena.idx);
+	(void)obj8_vao_cache_release(&arena.vaos);
+	mutex_destroy(&arena.lock);
+	memset(&arena, 0, sizeof (arena));
+}
+
+bool
+obj8_geom_arena_active(void)
+{
+	return (arena.inited);
+}
+
+void
+obj8_geom_alloc_vtx(obj8_geom_region_t *region, const obj8_vtx_t *vtx,
+    const GLfloat *pos, unsigned n_vtx)
+{
+	ASSERT(arena.inited);
+	ASSERT(region != NULL);
+	ASSERT(vtx != NULL || n_vtx == 0);
+
+	if (n_vtx == 0) {
+		memset(region, 0, sizeof (*region));
+		return;
+	}
+	mutex_enter(&arena.lock);
+	if (pos != NULL && arena.vtx.bufs[1] == 0) {
+		__atomic_store_n(&arena.vtx.bufs[1], heap_buf_create(
+		    arena.vtx.cap * arena.vtx.elem_sz[1]), __ATOMIC_RELAXED);
+	}
+	heap_alloc(&arena.vtx, region, n_vtx);
+	heap_upload(&arena.vtx, 0, region, vtx);
+	if (pos != NULL)
+		heap_upload(&arena.vtx, 1, region, pos);
+	mutex_exit(&arena.lock);
+}
+
+void
+obj8_geom_alloc_idx(obj8_geom_region_t *region, const GLuint *idx,
+    unsigned n_idx)
+{
+	ASSERT(arena.inited);
+	ASSERT(region != NULL);
+	ASSERT(idx != NULL || n_idx == 0);
+
+	if (n_idx == 0) {
+		memset(region, 0, sizeof (*region));
+		return;
+	}
+	mutex_enter(&arena.lock);
+	heap_alloc(&arena.idx, region, n_idx);
+	heap_upload(&arena.idx, 0, region, idx);
+	mutex_exit(&arena.lock);
+}
+
+void
+obj8_geom_free_vtx(obj8_geom_region_t *region)
+{
+	ASSERT(arena.inited);
+	if (region->len == 0)
+		return;
+	mutex_enter(&arena.lock);
+	heap_free(&arena.vtx, region);
+	mutex_exit(&arena.lock);
+}
+
+void
+obj8_geom_free_idx(obj8_geom_region_t *region)
+{
+	ASSERT(arena.inited);
+	if (region->len == 0)
+		return;
+	mutex_enter(&arena.lock);
+	heap_free(&arena.idx, region);
+	mutex_exit(&arena.lock);
+}
+
+/*
+ * Holds off any changes to the arena, so that regions' offsets and the
+ * arena's buffers can be read consistently (e.g. to copy data out).
+ */
+void
+obj8_geom_arena_enter(void)
+{
+	ASSERT(arena.inited);
+	mutex_enter(&arena.lock);
+}
+
+void
+obj8_geom_arena_exit(void)
+{
+	ASSERT(arena.inited);
+	mutex_exit(&arena.lock);
+}
+
+/*
+ * Returns the arena's current generation. It changes whenever compaction
+ * has replaced the arena's buffers, so VAOs set up for an older one must
+ * be set up again. Buffers returned by obj8_geom_get_buf after this call
+ * are at least as recent as the returned generation.
+ */
+unsigned
+obj8_geom_get_gen(void)
+{
+	ASSERT(arena.inited);
+	return (__atomic_load_n(&arena.gen, __ATOMIC_ACQUIRE));
+}
+
+GLuint
+obj8_geom_get_buf(obj8_geom_buf_t which)
+{
+	ASSERT(arena.inited);
+	switch (which) {
+	case OBJ8_GEOM_BUF_VTX:
+		return (__atomic_load_n(&arena.vtx.bufs[0],
+		    __ATOMIC_RELAXED));
+	case OBJ8_GEOM_BUF_POS:
+		return (__atomic_load_n(&arena.vtx.bufs[1],
+		    __ATOMIC_RELAXED));
+	default:
+		ASSERT3U(which, ==, OBJ8_GEOM_BUF_IDX);
+		return (__atomic_load_n(&arena.idx.bufs[0],
+		    __ATOMIC_RELAXED));
+	}
+}
+
+/*
+ * Returns the arena's attribute pointer set for either the full, or the
+ * position-only vertex buffer, for use by the calling thread. See
+ * obj8_vao_cache_get for the meaning of `scratch'.
+ */
+obj8_vao_t *
+obj8_geom_get_vao(bool pos_only, obj8_vao_t *scratch)
+{
+	ASSERT(arena.inited);
+	return (obj8_vao_cache_get(&arena.vaos, pos_only, scratch));
+}
+
+/*
+ * Binds `vao', as returned by obj8_geom_get_vao, for a draw from the
+ * arena. Inside of a batch, the VAO stays bound from one draw to the
+ * next, so this does nothing if it already is. Returns true if a batch
+ * is active, in which case the caller must leave the VAO and array
+ * buffer bindings in place after drawing.
+ */
+bool
+obj8_geom_bind_vao(const obj8_vao_t *vao)
+{
+	obj8_vao_slot_t *slot;
+
+	ASSERT(arena.inited);
+	ASSERT(vao != NULL);
+
+	if (vao->id == 0)
+		return (false);
+	slot = vao_cache_find(&arena.vaos);
+	ASSERT(slot != NULL);
+	if (slot->batch_depth == 0) {
+		glBindVertexArray(vao->id);
+		return (false);
+	}
+	if (slot->batch_bound != vao) {
+		glBindVertexArray(vao->id);
+		slot->batch_bound = vao;
+	}
+	return (true);
+}
+
+/*
+ * Must be called when the calling thread binds a VAO other than the arena
+ * VAOs inside of a batch (i.e. when drawing an object which isn't in the
+ * arena), so that the next arena draw binds the arena VAO again.
+ */
+void
+obj8_geom_batch_unbind(void)
+{
+	obj8_vao_slot_t *slot;
+
+	if (!arena.inited)
+		return;
+	slot = vao_cache_find(&arena.vaos);
+	if (slot != NULL)
+		slot->batch_bound = NULL;
+}
+
+/*
+ * Starts a batch of draws of objects stored in the arena on the calling
+ * thread. Within a batch, the arena VAO (and with it the arena's vertex
+ * and index buffers) is bound once by the first draw and then left bound
+ * for all following draws, which thus consist of nothing more than the
+ * per-object uniform updates and base-vertex draw calls. The binding is
+ * only undone by obj8_geom_arena_batch_end. Batches can be nested, only
+ * the outermost end call unbinds. Between the begin and end calls, the
+ * caller must not change the vertex array binding itself.
+ *
+ * If the arena isn't enabled or VAOs aren't available, this is a no-op
+ * and every draw sets up and tears down its bindings as usual.
+ */
+void
+obj8_geom_arena_batch_begin(void)
+{
+	obj8_vao_slot_t *slot;
+
+	if (!arena.inited)
+		return;
+	slot = obj8_vao_cache_slot(&arena.vaos);
+	if (slot == NULL)
+		return;
+	vao_slot_create(slot);
+	if (slot->vao.id != 0)
+		slot->batch_depth++;
+}
+
+/*
+ * Ends a batch started with obj8_geom_arena_batch_begin.
+ */
+void
+obj8_geom_arena_batch_end(void)
+{
+	obj8_vao_slot_t *slot;
+
+	if (!arena.inited)
+		return;
+	slot = vao_cache_find(&arena.vaos);
+	if (slot == NULL || slot->batch_depth == 0)
+		return;
+	slot->batch_depth--;
+	if (slot->batch_depth == 0 && slot->batch_bound != NULL) {
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		slot->batch_bound = NULL;
+	}
+}
+
+/*
+ * Releases the arena VAOs of the calling thread. Every thread other than
+ * the one calling obj8_geom_arena_fini which has drawn objects from the
+ * arena must call this with its context current before it goes away.
+ */
+void
+obj8_geom_arena_release_vaos(void)
+{
+	if (arena.inited)
+		(void)obj8_vao_cache_release(&arena.vaos);
+}
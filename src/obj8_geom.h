@@ -0,0 +1,136 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2023 Saso Kiselkov. All rights reserved.
+ */
+
+#ifndef	_OBJ8_GEOM_H_
+#define	_OBJ8_GEOM_H_
+
+#include <acfutils/glew.h>
+#include <acfutils/list.h>
+#include <acfutils/thread.h>
+
+#include "obj8.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A set of vertex attribute pointers. When VAOs are in use, the pointers
+ * are retained in the VAO, so we remember which program's attribute
+ * locations and, for the arena, which generation of the arena's buffers
+ * they have been set up for and only redo them when either changes.
+ */
+typedef struct {
+	GLuint		id;
+	GLuint		prog;
+	unsigned	gen;		/* see obj8_geom_get_gen */
+	GLint		pos_loc;
+	GLint		norm_loc;
+	GLint		tex0_loc;
+} obj8_vao_t;
+
+/*
+ * Uniform and attribute locations of the program which a thread last
+ * drew an object with. Looked up again whenever the program changes.
+ */
+typedef struct {
+	GLuint		prog;
+	GLint		pvm_loc;
+	GLint		light_level_loc;
+	GLint		manip_idx_loc;
+	GLint		pos_loc;
+	GLint		norm_loc;
+	GLint		tex0_loc;
+} obj8_prog_locs_t;
+
+/*
+ * VAOs are not shared between GL contexts, so every thread which draws
+ * from a set of (shared) buffers needs its own VAOs, along with any other
+ * state which drawing updates. Each drawing thread claims a slot on its
+ * first draw and keeps it until it releases it, after which the slot can
+ * be claimed by another thread. A slot's `state' and `thread' fields are
+ * accessed atomically, so a lookup needs no locking. All other fields
+ * are only ever touched by the thread owning the slot.
+ */
+#define	OBJ8_VAO_CACHE_SLOTS	8
+
+typedef struct {
+	int		state;
+	thread_id_t	thread;
+	bool		vaos_created;
+	obj8_vao_t	vao;		/* full vertex buffer */
+	obj8_vao_t	pos_vao;	/* position-only vertex buffer */
+	obj8_prog_locs_t locs;
+	void		*draw_state;	/* owned by the cache's user */
+	/*
+	 * Arena draw batch state of the owning thread (see
+	 * obj8_geom_arena_batch_begin).
+	 */
+	unsigned	batch_depth;
+	const obj8_vao_t *batch_bound;	/* VAO left bound in the batch */
+} obj8_vao_slot_t;
+
+typedef struct {
+	obj8_vao_slot_t	slots[OBJ8_VAO_CACHE_SLOTS];
+} obj8_vao_cache_t;
+
+/*
+ * A sub-allocation in the shared geometry arena. `off' is expressed in
+ * elements (vertices or indices) and can change whenever the arena is
+ * compacted, so it must be re-read before every draw.
+ */
+typedef struct {
+	unsigned	off;
+	unsigned	len;
+	list_node_t	node;
+} obj8_geom_region_t;
+
+typedef enum {
+	OBJ8_GEOM_BUF_VTX,	/* full obj8_vtx_t vertices */
+	OBJ8_GEOM_BUF_POS,	/* positions only, parallel to the above */
+	OBJ8_GEOM_BUF_IDX	/* GLuint indices */
+} obj8_geom_buf_t;
+
+void obj8_vao_init(obj8_vao_t *vao);
+obj8_vao_slot_t *obj8_vao_cache_slot(obj8_vao_cache_t *cache);
+obj8_vao_t *obj8_vao_slot_get(obj8_vao_slot_t *slot, bool pos_only,
+    obj8_vao_t *scratch);
+obj8_vao_t *obj8_vao_cache_get(obj8_vao_cache_t *cache, bool pos_only,
+    obj8_vao_t *scratch);
+void *obj8_vao_cache_release(obj8_vao_cache_t *cache);
+
+bool obj8_geom_arena_active(void);
+void obj8_geom_alloc_vtx(obj8_geom_region_t *region, const obj8_vtx_t *vtx,
+    const GLfloat *pos, unsigned n_vtx);
+void obj8_geom_alloc_idx(obj8_geom_region_t *region, const GLuint *idx,
+    unsigned n_idx);
+void obj8_geom_free_vtx(obj8_geom_region_t *region);
+void obj8_geom_free_idx(obj8_geom_region_t *region);
+void obj8_geom_arena_enter(void);
+void obj8_geom_arena_exit(void);
+unsigned obj8_geom_get_gen(void);
+GLuint obj8_geom_get_buf(obj8_geom_buf_t which);
+obj8_vao_t *obj8_geom_get_vao(bool pos_only, obj8_vao_t *scratch);
+bool obj8_geom_bind_vao(const obj8_vao_t *vao);
+void obj8_geom_batch_unbind(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* _OBJ8_GEOM_H_ */
@@ -0,0 +1,583 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2023 Saso Kiselkov. All rights reserved.
+ */
+
+/*
+ * Occluder mesh simplification. Objects drawn into the z-depth buffer only
+ * serve to mask rain behind cockpit frames and panels, so they don't need
+ * anywhere near the detail of the visual model. We reduce them using
+ * half-edge collapses: a vertex is merged into one of its neighbors, so
+ * the simplified mesh only ever references vertices which already exist
+ * in the object's vertex table. The result is thus just a new index list.
+ *
+ * The occluder is NOT conservative: a collapse can move the surface
+ * inward as well as outward, so the occluder may end up slightly smaller
+ * than the visual model, letting rain show through along its edges and
+ * concave areas. What we do guarantee is that the deviation is bounded
+ * by the caller's tolerance, and that no holes are opened up in the mesh
+ * (through which rain would be visible where it shouldn't be). To that
+ * end, we:
+ *
+ * 1) Weld vertices by position first, so that UV and normal seams don't
+ *	look like mesh borders.
+ * 2) Never move vertices lying on an open border or a non-manifold edge.
+ * 3) Only collapse edges where the link condition holds (the two end
+ *	points share exactly two neighbors), which preserves the topology.
+ * 4) Reject collapses which would flip or degenerate any triangle.
+ * 5) Bound the deviation from the original surface by the caller's
+ *	tolerance using the accumulated plane quadrics of the merged
+ *	triangles. Since the quadric is a sum of squared plane distances,
+ *	keeping it under tol^2 guarantees every one of the original planes
+ *	is within `tol' of the surviving vertex, on either side of it.
+ *	So pick `tol' smaller than the gap you can tolerate.
+ *
+ * The cost is a few sorts of the vertex and edge lists, followed by up
+ * to OCCL_MAX_PASSES passes over all vertices, each of which inspects
+ * the neighborhoods of the vertex and its neighbors. Nothing is cached,
+ * so this is paid again every time an object is loaded.
+ */
+
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <acfutils/assert.h>
+#include <acfutils/helpers.h>
+#include <acfutils/math.h>
+#include <acfutils/safe_alloc.h>
+
+#include "obj8_occl.h"
+
+#define	OCCL_MAX_PASSES	8
+#define	OCCL_ALLOC_STEP	8
+
+typedef struct {
+	float		pos[3];
+	GLuint		idx;	/* index into the object's vertex table */
+	unsigned	cls;	/* welded vertex number */
+} occl_weld_t;
+
+typedef struct {
+	double		q[10];	/* symmetric 4x4 plane quadric */
+} occl_quadric_t;
+
+typedef struct {
+	double		pos[3];
+	GLuint		idx;	/* representative vertex in the vertex table */
+	occl_quadric_t	q;
+	unsigned	*tris;	/* incident triangles, may contain dead ones */
+	unsigned	n_tris;
+	unsigned	cap_tris;
+	bool		locked;
+	bool		dead;
+} occl_vtx_t;
+
+typedef struct {
+	unsigned	v[3];
+	bool		dead;
+} occl_tri_t;
+
+typedef struct {
+	unsigned	a;
+	unsigned	b;
+} occl_edge_t;
+
+typedef struct {
+	occl_vtx_t	*vtx;
+	unsigned	n_vtx;
+	occl_tri_t	*tris;
+	unsigned	n_tris;
+	/* scratch space for neighbor lookups */
+	unsigned	*nbrs[3];
+	unsigned	cap_nbrs[3];
+} occl_mesh_t;
+
+static int
+weld_idx_compar(const void *a, const void *b)
+{
+	const occl_weld_t *wa = a, *wb = b;
+
+	if (wa->idx < wb->idx)
+		return (-1);
+	if (wa->idx > wb->idx)
+		return (1);
+	return (0);
+}
+
+static int
+weld_pos_compar(const void *a, const void *b)
+{
+	const occl_weld_t *wa = a, *wb = b;
+
+	for (int i = 0; i < 3; i++) {
+		if (wa->pos[i] < wb->pos[i])
+			return (-1);
+		if (wa->pos[i] > wb->pos[i])
+			return (1);
+	}
+	return (weld_idx_compar(a, b));
+}
+
+static int
+edge_compar(const void *a, const void *b)
+{
+	const occl_edge_t *ea = a, *eb = b;
+
+	if (ea->a != eb->a)
+		return (ea->a < eb->a ? -1 : 1);
+	if (ea->b != eb->b)
+		return (ea->b < eb->b ? -1 : 1);
+	return (0);
+}
+
+static inline void
+vec_sub(const double a[3], const double b[3], double out[3])
+{
+	out[0] = a[0] - b[0];
+	out[1] = a[1] - b[1];
+	out[2] = a[2] - b[2];
+}
+
+static inline void
+vec_cross(const double a[3], const double b[3], double out[3])
+{
+	out[0] = a[1] * b[2] - a[2] * b[1];
+	out[1] = a[2] * b[0] - a[0] * b[2];
+	out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static inline double
+vec_dot(const double a[3], const double b[3])
+{
+	return (a[0] * b[0] + a[1] * b[1] + a[2] * b[2]);
+}
+
+static void
+tri_normal(const double p0[3], const double p1[3], const double p2[3],
+    double n[3])
+{
+	double e1[3], e2[3];
+
+	vec_sub(p1, p0, e1);
+	vec_sub(p2, p0, e2);
+	vec_cross(e1, e2, n);
+}
+
+static void
+quadric_add_plane(occl_quadric_t *q, const double n_in[3], const double p[3])
+{
+	double len = sqrt(vec_dot(n_in, n_in));
+	double a, b, c, d;
+
+	if (len == 0)
+		return;
+	a = n_in[0] / len;
+	b = n_in[1] / len;
+	c = n_in[2] / len;
+	d = -(a * p[0] + b * p[1] + c * p[2]);
+
+	q->q[0] += a * a;
+	q->q[1] += a * b;
+	q->q[2] += a * c;
+	q->q[3] += a * d;
+	q->q[4] += b * b;
+	q->q[5] += b * c;
+	q->q[6] += b * d;
+	q->q[7] += c * c;
+	q->q[8] += c * d;
+	q->q[9] += d * d;
+}
+
+/*
+ * Evaluates the sum of the quadrics `q1' and `q2' at point `p', i.e. the
+ * sum of squared distances of `p' from all the planes accumulated in them.
+ */
+static double
+quadric_eval2(const occl_quadric_t *q1, const occl_quadric_t *q2,
+    const double p[3])
+{
+	double q[10];
+	double x = p[0], y = p[1], z = p[2];
+
+	for (int i = 0; i < 10; i++)
+		q[i] = q1->q[i] + q2->q[i];
+
+	return (q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z +
+	    2 * q[3] * x + q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y +
+	    q[7] * z * z + 2 * q[8] * z + q[9]);
+}
+
+static void
+vtx_add_tri(occl_vtx_t *v, unsigned tri)
+{
+	if (v->n_tris == v->cap_tris) {
+		v->cap_tris += OCCL_ALLOC_STEP;
+		v->tris = safe_realloc(v->tris, v->cap_tris *
+		    sizeof (*v->tris));
+	}
+	v->tris[v->n_tris++] = tri;
+}
+
+/*
+ * Collects the unique neighbors of vertex `v' into scratch buffer `buf'.
+ * Returns the number of neighbors found.
+ */
+static unsigned
+gather_nbrs(occl_mesh_t *m, unsigned v, int buf)
+{
+	const occl_vtx_t *vtx = &m->vtx[v];
+	unsigned n = 0;
+
+	for (unsigned i = 0; i < vtx->n_tris; i++) {
+		const occl_tri_t *tri = &m->tris[vtx->tris[i]];
+
+		if (tri->dead)
+			continue;
+		for (int j = 0; j < 3; j++) {
+			unsigned w = tri->v[j];
+			bool found = false;
+
+			if (w == v)
+				continue;
+			for (unsigned k = 0; k < n; k++) {
+				if (m->nbrs[buf][k] == w) {
+					found = true;
+					break;
+				}
+			}
+			if (found)
+				continue;
+			if (n == m->cap_nbrs[buf]) {
+				m->cap_nbrs[buf] += OCCL_ALLOC_STEP;
+				m->nbrs[buf] = safe_realloc(m->nbrs[buf],
+				    m->cap_nbrs[buf] * sizeof (unsigned));
+			}
+			m->nbrs[buf][n++] = w;
+		}
+	}
+
+	return (n);
+}
+
+static inline bool
+tri_has_vtx(const occl_tri_t *tri, unsigned v)
+{
+	return (tri->v[0] == v || tri->v[1] == v || tri->v[2] == v);
+}
+
+/*
+ * Checks whether vertex `u' can be merged into its neighbor `v' without
+ * changing the mesh topology, or flipping or degenerating any triangle.
+ */
+static bool
+collapse_ok(occl_mesh_t *m, unsigned u, unsigned v)
+{
+	const occl_vtx_t *vu = &m->vtx[u];
+	unsigned n_u, n_v, n_common = 0, n_shared = 0;
+
+	n_u = gather_nbrs(m, u, 0);
+	n_v = gather_nbrs(m, v, 1);
+	for (unsigned i = 0; i < n_u; i++) {
+		for (unsigned j = 0; j < n_v; j++) {
+			if (m->nbrs[0][i] == m->nbrs[1][j]) {
+				n_common++;
+				break;
+			}
+		}
+	}
+	if (n_common != 2)
+		return (false);
+
+	for (unsigned i = 0; i < vu->n_tris; i++) {
+		const occl_tri_t *tri = &m->tris[vu->tris[i]];
+		const double *p[3], *p_new[3];
+		double n_old[3], n_new[3];
+
+		if (tri->dead)
+			continue;
+		if (tri_has_vtx(tri, v)) {
+			n_shared++;
+			continue;
+		}
+		for (int j = 0; j < 3; j++) {
+			p[j] = m->vtx[tri->v[j]].pos;
+			p_new[j] = (tri->v[j] == u ? m->vtx[v].pos : p[j]);
+		}
+		tri_normal(p[0], p[1], p[2], n_old);
+		tri_normal(p_new[0], p_new[1], p_new[2], n_new);
+		if (vec_dot(n_new, n_new) == 0 || vec_dot(n_old, n_new) <= 0)
+			return (false);
+	}
+
+	return (n_shared == 2);
+}
+
+static void
+collapse(occl_mesh_t *m, unsigned u, unsigned v)
+{
+	occl_vtx_t *vu = &m->vtx[u];
+	occl_vtx_t *vv = &m->vtx[v];
+
+	for (unsigned i = 0; i < vu->n_tris; i++) {
+		occl_tri_t *tri = &m->tris[vu->tris[i]];
+
+		if (tri->dead)
+			continue;
+		if (tri_has_vtx(tri, v)) {
+			tri->dead = true;
+			continue;
+		}
+		for (int j = 0; j < 3; j++) {
+			if (tri->v[j] == u)
+				tri->v[j] = v;
+		}
+		vtx_add_tri(vv, vu->tris[i]);
+	}
+	for (int i = 0; i < 10; i++)
+		vv->q.q[i] += vu->q.q[i];
+
+	free(vu->tris);
+	vu->tris = NULL;
+	vu->n_tris = 0;
+	vu->cap_tris = 0;
+	vu->dead = true;
+}
+
+/*
+ * Runs a single pass over all vertices, collapsing each movable vertex
+ * into its cheapest neighbor within tolerance. Returns the number of
+ * collapses performed.
+ */
+static unsigned
+simplify_pass(occl_mesh_t *m, double tol2)
+{
+	unsigned n_collapsed = 0;
+
+	for (unsigned u = 0; u < m->n_vtx; u++) {
+		occl_vtx_t *vu = &m->vtx[u];
+		unsigned n_nbrs, best = UINT_MAX;
+		double best_cost = tol2;
+
+		if (vu->dead || vu->locked)
+			continue;
+		/* collapse_ok uses scratch buffers 0 and 1 */
+		n_nbrs = gather_nbrs(m, u, 2);
+		for (unsigned i = 0; i < n_nbrs; i++) {
+			unsigned v = m->nbrs[2][i];
+			double cost = quadric_eval2(&vu->q, &m->vtx[v].q,
+			    m->vtx[v].pos);
+
+			if (cost <= best_cost && collapse_ok(m, u, v)) {
+				best = v;
+				best_cost = cost;
+			}
+		}
+		if (best != UINT_MAX) {
+			collapse(m, u, best);
+			n_collapsed++;
+		}
+	}
+
+	return (n_collapsed);
+}
+
+/*
+ * Welds the vertices referenced by `idx_table' by position and sets up
+ * the vertex & triangle tables of `m'. Triangles which are degenerate after
+ * welding are dropped, as they can't occlude anything.
+ */
+static void
+mesh_init(occl_mesh_t *m, const obj8_vtx_t *vtx_table,
+    const GLuint *idx_table, unsigned n_idx)
+{
+	occl_weld_t *weld = safe_calloc(n_idx, sizeof (*weld));
+	unsigned n_weld = 0;
+
+	for (unsigned i = 0; i < n_idx; i++) {
+		weld[i].idx = idx_table[i];
+		memcpy(weld[i].pos, vtx_table[idx_table[i]].pos,
+		    sizeof (weld[i].pos));
+	}
+	qsort(weld, n_idx, sizeof (*weld), weld_idx_compar);
+	for (unsigned i = 0; i < n_idx; i++) {
+		if (n_weld == 0 || weld[n_weld - 1].idx != weld[i].idx)
+			weld[n_weld++] = weld[i];
+	}
+
+	qsort(weld, n_weld, sizeof (*weld), weld_pos_compar);
+	m->vtx = safe_calloc(n_weld, sizeof (*m->vtx));
+	for (unsigned i = 0; i < n_weld; i++) {
+		if (m->n_vtx == 0 || memcmp(weld[i].pos, weld[i - 1].pos,
+		    sizeof (weld[i].pos)) != 0) {
+			occl_vtx_t *v = &m->vtx[m->n_vtx++];
+
+			v->idx = weld[i].idx;
+			for (int j = 0; j < 3; j++)
+				v->pos[j] = weld[i].pos[j];
+		}
+		weld[i].cls = m->n_vtx - 1;
+	}
+	/* sort back by index so we can look up the welded vertices */
+	qsort(weld, n_weld, sizeof (*weld), weld_idx_compar);
+
+	m->tris = safe_calloc(n_idx / 3, sizeof (*m->tris));
+	for (unsigned i = 0; i + 2 < n_idx; i += 3) {
+		occl_tri_t *tri = &m->tris[m->n_tris];
+		double n[3];
+
+		for (int j = 0; j < 3; j++) {
+			occl_weld_t key = { .idx = idx_table[i + j] };
+			const occl_weld_t *w = bsearch(&key, weld, n_weld,
+			    sizeof (*weld), weld_idx_compar);
+
+			ASSERT(w != NULL);
+			tri->v[j] = w->cls;
+		}
+		if (tri->v[0] == tri->v[1] || tri->v[1] == tri->v[2] ||
+		    tri->v[0] == tri->v[2])
+			continue;
+		tri_normal(m->vtx[tri->v[0]].pos, m->vtx[tri->v[1]].pos,
+		    m->vtx[tri->v[2]].pos, n);
+		if (vec_dot(n, n) == 0)
+			continue;
+		for (int j = 0; j < 3; j++) {
+			occl_vtx_t *v = &m->vtx[tri->v[j]];
+
+			vtx_add_tri(v, m->n_tris);
+			quadric_add_plane(&v->q, n, m->vtx[tri->v[0]].pos);
+		}
+		m->n_tris++;
+	}
+
+	free(weld);
+}
+
+/*
+ * Locks all vertices lying on edges which aren't shared by exactly two
+ * triangles. These are either open borders of the mesh (moving those
+ * would shrink the mesh's outline), or non-manifold edges, which also
+ * occur where double-sided geometry is modeled as back-to-back triangles.
+ */
+static void
+mesh_lock_borders(occl_mesh_t *m)
+{
+	occl_edge_t *edges = safe_malloc(m->n_tris * 3 * sizeof (*edges));
+	unsigned n_edges = 0;
+
+	for (unsigned i = 0; i < m->n_tris; i++) {
+		const occl_tri_t *tri = &m->tris[i];
+
+		for (int j = 0; j < 3; j++) {
+			unsigned a = tri->v[j], b = tri->v[(j + 1) % 3];
+
+			edges[n_edges].a = MIN(a, b);
+			edges[n_edges].b = MAX(a, b);
+			n_edges++;
+		}
+	}
+	qsort(edges, n_edges, sizeof (*edges), edge_compar);
+	for (unsigned i = 0; i < n_edges;) {
+		unsigned j = i + 1;
+
+		while (j < n_edges && edge_compar(&edges[i], &edges[j]) == 0)
+			j++;
+		if (j - i != 2) {
+			m->vtx[edges[i].a].locked = true;
+			m->vtx[edges[i].b].locked = true;
+		}
+		i = j;
+	}
+
+	free(edges);
+}
+
+static void
+mesh_fini(occl_mesh_t *m)
+{
+	for (unsigned i = 0; i < m->n_vtx; i++)
+		free(m->vtx[i].tris);
+	free(m->vtx);
+	free(m->tris);
+	for (int i = 0; i < 3; i++)
+		free(m->nbrs[i]);
+	memset(m, 0, sizeof (*m));
+}
+
+/*
+ * Builds a simplified occluder version of a triangle list. It deviates
+ * from the original by up to `tol' in either direction (see above).
+ *
+ * @param vtx_table The vertex table referenced by `idx_table'.
+ * @param n_vtx Number of vertices in `vtx_table'.
+ * @param idx_table Triangle list (3 indices per triangle) to simplify.
+ * @param n_idx Number of indices in `idx_table'.
+ * @param tol Maximum allowable deviation from the original surface.
+ * @param out_idx Return parameter, which will be filled with a newly
+ *	allocated triangle list referencing vertices in `vtx_table'. The
+ *	caller is responsible for freeing it using free().
+ *
+ * @return The number of indices in the new triangle list.
+ */
+unsigned
+obj8_occl_simplify(const obj8_vtx_t *vtx_table, unsigned n_vtx,
+    const GLuint *idx_table, unsigned n_idx, double tol, GLuint **out_idx)
+{
+	occl_mesh_t m = { 0 };
+	unsigned n_out = 0;
+	GLuint *out;
+
+	ASSERT(vtx_table != NULL);
+	ASSERT(idx_table != NULL || n_idx == 0);
+	ASSERT3F(tol, >=, 0);
+	ASSERT(out_idx != NULL);
+
+	/*
+	 * Broken index tables can't be simplified, just pass them through,
+	 * so the occluder draws exactly what the full mesh would.
+	 */
+	for (unsigned i = 0; i < n_idx; i++) {
+		if (idx_table[i] >= n_vtx) {
+			out = safe_malloc(n_idx * sizeof (*out));
+			memcpy(out, idx_table, n_idx * sizeof (*out));
+			*out_idx = out;
+			return (n_idx);
+		}
+	}
+	n_idx -= n_idx % 3;
+
+	mesh_init(&m, vtx_table, idx_table, n_idx);
+	mesh_lock_borders(&m);
+	for (int pass = 0; pass < OCCL_MAX_PASSES; pass++) {
+		if (simplify_pass(&m, POW2(tol)) == 0)
+			break;
+	}
+
+	out = safe_malloc(m.n_tris * 3 * sizeof (*out));
+	for (unsigned i = 0; i < m.n_tris; i++) {
+		const occl_tri_t *tri = &m.tris[i];
+
+		if (tri->dead)
+			continue;
+		for (int j = 0; j < 3; j++)
+			out[n_out++] = m.vtx[tri->v[j]].idx;
+	}
+	mesh_fini(&m);
+	*out_idx = out;
+
+	return (n_out);
+}
@@ -0,0 +1,37 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2023 Saso Kiselkov. All rights reserved.
+ */
+
+#ifndef	_OBJ8_OCCL_H_
+#define	_OBJ8_OCCL_H_
+
+#include <acfutils/glew.h>
+
+#include "obj8.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+unsigned obj8_occl_simplify(const obj8_vtx_t *vtx_table, unsigned n_vtx,
+    const GLuint *idx_table, unsigned n_idx, double tol, GLuint **out_idx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* _OBJ8_OCCL_H_ */
@@ -16,23 +16,73 @@
  * Copyright 2023 Saso Kiselkov. All rights reserved.
  */
 
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#if	IBM
+#include <windows.h>
+#else	/* !IBM */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif	/* !IBM */
+
 #if	defined(LIBRAIN_SOIL_VERSION) && LIBRAIN_SOIL_VERSION == 2
 #include <SOIL2/SOIL2.h>
 #else
 #include <SOIL/SOIL.h>
 #endif
 #include <acfutils/avl.h>
+#include <acfutils/crc64.h>
 #include <acfutils/glutils.h>
 #include <acfutils/glew.h>
+#include <acfutils/list.h>
 #include <acfutils/png.h>
 #include <acfutils/safe_alloc.h>
 #include <acfutils/thread.h>
+#include <acfutils/time.h>
 
 #include "objmgr.h"
+#include "objmgr_bc.h"
+
+/*
+ * Texture uploads are streamed through a small ring of pixel unpack
+ * buffers. A slot is only refilled once the GPU is done reading from it.
+ */
+#define	PBO_RING_SZ	4
+
+#define	DDS_HDR_SZ		128	/* incl. the "DDS " magic */
+#define	DDSD_MIPMAPCOUNT	0x20000
+#define	DDPF_FOURCC		0x4
+#define	DDSD_DEFAULT_FLAGS	0xa1007	/* caps, size, pf, mips, linsize */
+#define	DDSCAPS_DEFAULT		0x401008	/* texture, mipmap, complex */
+
+/* Bump when the encoder output changes, to invalidate old cache files */
+#define	TEX_CACHE_VERSION	1
+
+TEXSZ_MK_TOKEN(objmgr_rtt_tex);
+
+typedef struct {
+	size_t		off;	/* from the start of the level data */
+	size_t		size;
+	int		w, h;
+} tex_level_t;
+
+typedef enum {
+	TEX_ALBEDO,
+	TEX_NORM,
+	TEX_LIT
+} tex_kind_t;
 
 typedef struct {
 	objmgr_t	*mgr;
 	GLuint		tex;
+	tex_kind_t	kind;
+	char		*cache_dir;	/* compressed texture cache, or NULL */
+	bool		norm_bc5;
 	char		*filename;
 	unsigned	refcnt;		// protected by objmgr->lock
 	int		width;
@@ -48,18 +98,80 @@ typedef struct {
 	bool		load_error;
 	uint8_t		*pixels;
 	size_t		buflen;		/* used for DDS loads */
+	bool		pixels_mapped;	/* `pixels' is from map_file */
 	thread_t	loader;
+	bool		loader_joined;
+	/*
+	 * Filled in by the loader: the mip levels to upload. For PNGs,
+	 * these are generated on the CPU into `mip_data'. For DDS files,
+	 * they point into `pixels'. If a DDS file couldn't be parsed,
+	 * `levels' is NULL and we fall back to loading it via SOIL.
+	 */
+	tex_level_t	*levels;
+	unsigned	n_levels;
+	uint8_t		*mip_data;
+	bool		compressed;
+	GLint		int_fmt;
+	GLint		fmt;
+	GLint		type;
+	/* upload progress, only touched by the drawing thread */
+	GLuint		upload_tex;
+	unsigned	next_level;
+	/*
+	 * Residency tracking, only touched by the drawing thread. While
+	 * `tex' is valid, the texture is on objmgr_t's `resident' list,
+	 * ordered from least to most recently bound.
+	 */
+	size_t		vram_sz;
+	uint64_t	last_frame;
+	bool		evicted;
+	/*
+	 * Set by the loader if the texture came from (or went into) a DDS
+	 * file or the texture cache. Only such textures are evicted, as
+	 * reloading anything else means decoding the PNG all over again.
+	 */
+	bool		reloadable;
+	list_node_t	lru_node;
+	librain_mem_acct_t mem;
+	/*
+	 * ARB_bindless_texture handle, created on first request while
+	 * `tex' is valid and kept resident until `tex' is deleted.
+	 */
+	GLuint64	handle;
 
 	avl_node_t	node;
 } objmgr_tex_t;
 
+typedef enum {
+	OBJ_LOADING,
+	OBJ_READY,
+	OBJ_FAILED
+} obj_state_t;
+
 struct objmgr_obj_s {
-	const char	*filename;	/* held by the obj8_t below */
-	obj8_t		*obj;
+	objmgr_t	*mgr;
+	char		*filename;
 	unsigned	refcnt;		// protected by objmgr->lock
+	bool		in_tree;	// protected by objmgr->lock
+	/* holds a reference on behalf of objmgr_preload_manifest */
+	bool		preloaded;	// protected by objmgr->lock
+	bool		recorded;	// protected by objmgr->lock
+	bool		lazy_load_textures;
 	bool		load_norm;
 	bool		allow_dds_albedo;
 	bool		allow_dds_lit;
+
+	/*
+	 * The obj8 parse and texture loads are started by `loader'. Until
+	 * `state' is OBJ_READY, only the loader touches `obj' and the
+	 * textures below.
+	 */
+	thread_t	loader;
+	mutex_t		lock;
+	condvar_t	cv;
+	obj_state_t	state;		// protected by lock
+	obj8_t		*obj;
+
 	bool		drset_needs_update;
 	bool		drset_has_changed;
 	objmgr_tex_t	*tex;
@@ -68,10 +180,63 @@ struct objmgr_obj_s {
 	avl_node_t	node;
 };
 
+struct objmgr_rtt_s {
+	objmgr_t		*mgr;
+	objmgr_obj_t		*obj;
+	char			*group;
+	unsigned		w, h;
+	float			view_tol;
+	objmgr_rtt_draw_cb_t	draw_cb;
+	void			*userinfo;
+
+	GLuint			tex;
+	GLuint			depth_rb;
+	GLuint			fbo;
+	bool			valid;
+	uint64_t		drset_serial;
+	float			pvm[4][4];	/* see objmgr_rtt_update */
+	unsigned		n_renders;
+	librain_mem_acct_t	mem;
+};
+
 struct objmgr_s {
 	avl_tree_t	texs;		// protected by lock
 	avl_tree_t	objs;		// protected by lock
 	mutex_t		lock;
+	char		*cache_dir;	// protected by lock
+	bool		norm_bc5;	// protected by lock
+
+	/* texture upload state, only touched by the drawing thread */
+	GLuint		pbo[PBO_RING_SZ];
+	size_t		pbo_sz[PBO_RING_SZ];
+	GLsync		pbo_fence[PBO_RING_SZ];
+	unsigned	pbo_next;
+	uint64_t	budget_us;	/* 0 = unlimited */
+	size_t		budget_bytes;	/* 0 = unlimited */
+	uint64_t	frame_us;
+	size_t		frame_bytes;
+	/* texture residency, only touched by the drawing thread */
+	uint64_t	frame;
+	list_t		resident;
+	size_t		vram_used;
+	size_t		vram_budget;	/* 0 = unlimited */
+	/* live objmgr_rtt_t's, only touched by the drawing thread */
+	unsigned	n_rtts;
+	/*
+	 * objmgr_drset_update_all state. Each array holds a reference to
+	 * every object in it. `changed' is the set published by the last
+	 * update, `upd_objs' is scratch space for the next one.
+	 */
+	objmgr_obj_t	**upd_objs;
+	size_t		upd_cap;
+	mutex_t		changed_lock;
+	objmgr_obj_t	**changed;	// protected by changed_lock
+	size_t		n_changed;	// protected by changed_lock
+	size_t		changed_cap;
+	/* load order of this session, see objmgr_preload_manifest */
+	char		*manifest_path;	// protected by lock
+	char		*manifest;	// protected by lock
+	size_t		manifest_len;	// protected by lock
 };
 
 static int
@@ -100,25 +265,492 @@ obj_compar(const void *a, const void *b)
 	return (0);
 }
 
+/*
+ * Maps a file read-only into memory. DDS files are uploaded straight from
+ * the mapping, so a texture never has to be copied into the heap in full.
+ * Returns NULL if the file can't be mapped, e.g. because it is empty.
+ */
+static void *
+map_file(const char *path, size_t *len)
+{
+#if	IBM
+	int wlen = MultiByteToWideChar(CP_UTF8, 0, path, -1, NULL, 0);
+	WCHAR *wpath = safe_calloc(wlen, sizeof (*wpath));
+	HANDLE fh, mh;
+	LARGE_INTEGER sz;
+	void *buf = NULL;
+
+	MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, wlen);
+	fh = CreateFileW(wpath, GENERIC_READ, FILE_SHARE_READ, NULL,
+	    OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	free(wpath);
+	if (fh == INVALID_HANDLE_VALUE)
+		return (NULL);
+	if (!GetFileSizeEx(fh, &sz) || sz.QuadPart == 0 ||
+	    (uint64_t)sz.QuadPart > SIZE_MAX) {
+		CloseHandle(fh);
+		return (NULL);
+	}
+	mh = CreateFileMappingW(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mh != NULL) {
+		buf = MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+		/* the view keeps the mapping alive */
+		CloseHandle(mh);
+	}
+	CloseHandle(fh);
+	if (buf != NULL)
+		*len = sz.QuadPart;
+
+	return (buf);
+#else	/* !IBM */
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	void *buf;
+
+	if (fd == -1)
+		return (NULL);
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return (NULL);
+	}
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	/* the mapping stays valid after the descriptor is closed */
+	close(fd);
+	if (buf == MAP_FAILED)
+		return (NULL);
+	(void) madvise(buf, st.st_size, MADV_SEQUENTIAL);
+	*len = st.st_size;
+
+	return (buf);
+#endif	/* !IBM */
+}
+
+static void
+unmap_file(void *buf, size_t len)
+{
+#if	IBM
+	UNUSED(len);
+	VERIFY(UnmapViewOfFile(buf));
+#else
+	VERIFY0(munmap(buf, len));
+#endif
+}
+
+/*
+ * Loads a DDS file into `pixels', mapping it if possible.
+ */
+static bool
+load_dds_file(objmgr_tex_t *tex, const char *path)
+{
+	ASSERT3P(tex->pixels, ==, NULL);
+
+	tex->pixels = map_file(path, &tex->buflen);
+	if (tex->pixels != NULL) {
+		tex->pixels_mapped = true;
+		return (true);
+	}
+	tex->pixels = file2buf(path, &tex->buflen);
+	return (tex->pixels != NULL);
+}
+
+static void
+free_pixels(objmgr_tex_t *tex)
+{
+	if (tex->pixels_mapped)
+		unmap_file(tex->pixels, tex->buflen);
+	else
+		lacf_free(tex->pixels);
+	tex->pixels = NULL;
+	tex->pixels_mapped = false;
+}
+
 static void
 free_tex(objmgr_tex_t *tex)
 {
 	ASSERT(tex != NULL);
 	ASSERT0(tex->refcnt);
 
-	if (tex->load_started)
+	if (!tex->loader_joined)
 		thread_join(&tex->loader);
-	lacf_free(tex->pixels);
+	if (tex->handle != 0)
+		glMakeTextureHandleNonResidentARB(tex->handle);
+	if (tex->tex != 0) {
+		list_remove(&tex->mgr->resident, tex);
+		tex->mgr->vram_used -= tex->vram_sz;
+		librain_mem_free(LIBRAIN_MEM_OBJMGR_TEX, &tex->mem,
+		    tex->vram_sz);
+	}
+	free_pixels(tex);
+	free(tex->mip_data);
+	free(tex->levels);
 	if (tex->tex != 0)
 		glDeleteTextures(1, &tex->tex);
+	if (tex->upload_tex != 0)
+		glDeleteTextures(1, &tex->upload_tex);
 	free(tex->filename);
+	free(tex->cache_dir);
 	mutex_destroy(&tex->lock);
 	ZERO_FREE(tex);
 }
 
+static inline uint32_t
+dds_read32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+	    ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+/*
+ * Parses the header of a DDS file loaded into `hdr' and sets up its mip
+ * levels for direct upload. Only the block-compressed formats which
+ * X-Plane itself uses are handled here. Anything else (including files
+ * with a DX10 header) is left for SOIL to deal with.
+ */
+static bool
+parse_dds(objmgr_tex_t *tex, const uint8_t *hdr, size_t len)
+{
+	unsigned w, h, n_levels, block_sz;
+	size_t off = DDS_HDR_SZ;
+	uint32_t fourcc;
+
+	if (len < DDS_HDR_SZ || memcmp(hdr, "DDS ", 4) != 0 ||
+	    dds_read32(&hdr[4]) != 124 ||
+	    !(dds_read32(&hdr[80]) & DDPF_FOURCC))
+		return (false);
+	h = dds_read32(&hdr[12]);
+	w = dds_read32(&hdr[16]);
+	n_levels = ((dds_read32(&hdr[8]) & DDSD_MIPMAPCOUNT) ?
+	    MAX(dds_read32(&hdr[28]), 1) : 1);
+	fourcc = dds_read32(&hdr[84]);
+	if (w == 0 || h == 0 || n_levels > 32)
+		return (false);
+
+	if (fourcc == dds_read32((const uint8_t *)"DXT1")) {
+		tex->int_fmt = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+		block_sz = 8;
+	} else if (fourcc == dds_read32((const uint8_t *)"DXT3")) {
+		tex->int_fmt = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
+		block_sz = 16;
+	} else if (fourcc == dds_read32((const uint8_t *)"DXT5")) {
+		tex->int_fmt = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		block_sz = 16;
+	} else if (GLEW_ARB_texture_compression_rgtc &&
+	    (fourcc == dds_read32((const uint8_t *)"ATI2") ||
+	    fourcc == dds_read32((const uint8_t *)"BC5U"))) {
+		tex->int_fmt = GL_COMPRESSED_RG_RGTC2;
+		block_sz = 16;
+	} else {
+		return (false);
+	}
+	if (tex->int_fmt != GL_COMPRESSED_RG_RGTC2 &&
+	    !GLEW_EXT_texture_compression_s3tc)
+		return (false);
+
+	tex->levels = safe_calloc(n_levels, sizeof (*tex->levels));
+	for (unsigned i = 0; i < n_levels; i++) {
+		tex_level_t *lvl = &tex->levels[i];
+
+		lvl->w = MAX(w >> i, 1);
+		lvl->h = MAX(h >> i, 1);
+		lvl->off = off;
+		lvl->size = (size_t)MAX((lvl->w + 3) / 4, 1) *
+		    MAX((lvl->h + 3) / 4, 1) * block_sz;
+		off += lvl->size;
+		if (off > len) {
+			logMsg("%s: DDS texture load error, file is truncated",
+			    tex->filename);
+			free(tex->levels);
+			tex->levels = NULL;
+			return (false);
+		}
+	}
+	tex->n_levels = n_levels;
+	tex->compressed = true;
+
+	return (true);
+}
+
+static inline unsigned
+px_get(const uint8_t *p, unsigned bpc)
+{
+	uint16_t v;
+
+	if (bpc == 1)
+		return (*p);
+	memcpy(&v, p, sizeof (v));
+	return (v);
+}
+
+static inline void
+px_set(uint8_t *p, unsigned bpc, unsigned v)
+{
+	uint16_t v16 = v;
+
+	if (bpc == 1)
+		*p = v;
+	else
+		memcpy(p, &v16, sizeof (v16));
+}
+
+/*
+ * 2x2 box filter, odd source dimensions replicate the last row/column.
+ */
+static void
+downsample(const uint8_t *src, int sw, int sh, uint8_t *dst, int dw, int dh,
+    unsigned n_chan, unsigned bpc)
+{
+	size_t px_sz = n_chan * bpc;
+
+	for (int y = 0; y < dh; y++) {
+		const uint8_t *row0 = &src[MIN(2 * y, sh - 1) * sw * px_sz];
+		const uint8_t *row1 =
+		    &src[MIN(2 * y + 1, sh - 1) * sw * px_sz];
+
+		for (int x = 0; x < dw; x++) {
+			size_t x0 = MIN(2 * x, sw - 1) * px_sz;
+			size_t x1 = MIN(2 * x + 1, sw - 1) * px_sz;
+			uint8_t *out = &dst[(y * dw + x) * px_sz];
+
+			for (unsigned c = 0; c < n_chan; c++) {
+				size_t co = c * bpc;
+				unsigned sum = px_get(&row0[x0 + co], bpc) +
+				    px_get(&row0[x1 + co], bpc) +
+				    px_get(&row1[x0 + co], bpc) +
+				    px_get(&row1[x1 + co], bpc);
+
+				px_set(&out[co], bpc, (sum + 2) / 4);
+			}
+		}
+	}
+}
+
+/*
+ * Generates the full mip chain of a freshly loaded PNG on the loader
+ * thread, so the drawing thread doesn't have to call glGenerateMipmap.
+ */
+static bool
+gen_png_mips(objmgr_tex_t *tex)
+{
+	unsigned n_chan, bpc, n_levels = 1;
+	size_t total = 0;
+
+	if (!glutils_png2gltexfmt(tex->color_type, tex->bit_depth,
+	    &tex->int_fmt, &tex->fmt, &tex->type)) {
+		logMsg("%s: unsupported color type/bit depth combo: %d/%d",
+		    tex->filename, tex->color_type, tex->bit_depth);
+		return (false);
+	}
+	switch (tex->fmt) {
+	case GL_RGBA:
+	case GL_BGRA:
+		n_chan = 4;
+		break;
+	case GL_RGB:
+	case GL_BGR:
+		n_chan = 3;
+		break;
+	case GL_RG:
+	case GL_LUMINANCE_ALPHA:
+		n_chan = 2;
+		break;
+	default:
+		n_chan = 1;
+		break;
+	}
+	bpc = (tex->type == GL_UNSIGNED_SHORT ? 2 : 1);
+
+	while ((tex->width >> n_levels) != 0 || (tex->height >> n_levels) != 0)
+		n_levels++;
+	tex->levels = safe_calloc(n_levels, sizeof (*tex->levels));
+	for (unsigned i = 0; i < n_levels; i++) {
+		tex_level_t *lvl = &tex->levels[i];
+
+		lvl->w = MAX(tex->width >> i, 1);
+		lvl->h = MAX(tex->height >> i, 1);
+		lvl->off = total;
+		lvl->size = (size_t)lvl->w * lvl->h * n_chan * bpc;
+		total += lvl->size;
+	}
+	tex->n_levels = n_levels;
+	tex->mip_data = safe_malloc(total);
+	memcpy(tex->mip_data, tex->pixels, tex->levels[0].size);
+	for (unsigned i = 1; i < n_levels; i++) {
+		const tex_level_t *prev = &tex->levels[i - 1];
+		const tex_level_t *lvl = &tex->levels[i];
+
+		downsample(&tex->mip_data[prev->off], prev->w, prev->h,
+		    &tex->mip_data[lvl->off], lvl->w, lvl->h, n_chan, bpc);
+	}
+	lacf_free(tex->pixels);
+	tex->pixels = NULL;
+
+	return (true);
+}
+
+static void
+put32(uint8_t *p, uint32_t v)
+{
+	for (int i = 0; i < 4; i++)
+		p[i] = (v >> (8 * i)) & 0xff;
+}
+
+static char *
+cache_path(const objmgr_tex_t *tex, uint64_t hash)
+{
+	char name[32];
+
+	snprintf(name, sizeof (name), "%016llx.dds", (unsigned long long)hash);
+	return (mkpathname(tex->cache_dir, name, NULL));
+}
+
+static bool
+write_cache_file(const char *path, const uint8_t *buf, size_t len)
+{
+	char *tmp = sprintf_alloc("%s.%p.tmp", path, (void *)buf);
+	FILE *fp = fopen(tmp, "wb");
+	bool ok;
+
+	if (fp == NULL) {
+		logMsg("Can't write file %s: %s", tmp,
+		    strerror(errno));
+		free(tmp);
+		return (false);
+	}
+	ok = (fwrite(buf, 1, len, fp) == len);
+	ok = (fclose(fp) == 0 && ok);
+	/* another loader might have beaten us to it, which is fine */
+	if (!ok || rename(tmp, path) != 0)
+		remove(tmp);
+	free(tmp);
+
+	return (ok);
+}
+
+/*
+ * Compresses the CPU mip chain produced by gen_png_mips into a DDS file
+ * image, which replaces the uncompressed levels and is also stored in
+ * the texture cache under `hash'. Only 8-bit RGB(A) textures qualify.
+ * Returns true if the cache file was written.
+ */
+static bool
+transcode_png(objmgr_tex_t *tex, uint64_t hash)
+{
+	unsigned n_chan;
+	bc_fmt_t fmt;
+	const char *fourcc;
+	bool has_alpha = false;
+	size_t len = DDS_HDR_SZ;
+	uint8_t *dds;
+	char *path;
+	bool written;
+
+	if (tex->type != GL_UNSIGNED_BYTE ||
+	    (tex->fmt != GL_RGB && tex->fmt != GL_RGBA))
+		return (false);
+	n_chan = (tex->fmt == GL_RGBA ? 4 : 3);
+	if (n_chan == 4) {
+		const tex_level_t *lvl = &tex->levels[0];
+
+		for (size_t i = 0; i < (size_t)lvl->w * lvl->h; i++) {
+			if (tex->mip_data[lvl->off + i * 4 + 3] != 255) {
+				has_alpha = true;
+				break;
+			}
+		}
+	}
+	if (tex->kind == TEX_NORM && tex->norm_bc5) {
+		if (!GLEW_ARB_texture_compression_rgtc)
+			return (false);
+		fmt = BC_FMT_BC5;
+		fourcc = "ATI2";
+	} else {
+		if (!GLEW_EXT_texture_compression_s3tc)
+			return (false);
+		/* normal maps carry more detail, so don't use BC1 for them */
+		if (has_alpha || tex->kind == TEX_NORM) {
+			fmt = BC_FMT_BC3;
+			fourcc = "DXT5";
+		} else {
+			fmt = BC_FMT_BC1;
+			fourcc = "DXT1";
+		}
+	}
+
+	for (unsigned i = 0; i < tex->n_levels; i++) {
+		len += bc_encoded_size(fmt, tex->levels[i].w,
+		    tex->levels[i].h);
+	}
+	dds = safe_calloc(1, len);
+	memcpy(dds, "DDS ", 4);
+	put32(&dds[4], 124);
+	put32(&dds[8], DDSD_DEFAULT_FLAGS);
+	put32(&dds[12], tex->height);
+	put32(&dds[16], tex->width);
+	put32(&dds[20], bc_encoded_size(fmt, tex->width, tex->height));
+	put32(&dds[28], tex->n_levels);
+	put32(&dds[76], 32);
+	put32(&dds[80], DDPF_FOURCC);
+	memcpy(&dds[84], fourcc, 4);
+	put32(&dds[108], DDSCAPS_DEFAULT);
+	for (unsigned i = 0, off = DDS_HDR_SZ; i < tex->n_levels; i++) {
+		const tex_level_t *lvl = &tex->levels[i];
+
+		bc_encode(fmt, &tex->mip_data[lvl->off], lvl->w, lvl->h,
+		    n_chan, &dds[off]);
+		off += bc_encoded_size(fmt, lvl->w, lvl->h);
+	}
+
+	free(tex->mip_data);
+	tex->mip_data = NULL;
+	free(tex->levels);
+	tex->levels = NULL;
+	VERIFY(parse_dds(tex, dds, len));
+	tex->mip_data = dds;
+
+	path = cache_path(tex, hash);
+	written = write_cache_file(path, dds, len);
+	free(path);
+
+	return (written);
+}
+
+/*
+ * Looks up the texture in the compressed texture cache. The cache is
+ * keyed by a hash of the source file's contents, so edited textures
+ * simply miss and get transcoded anew. On a hit, the cached DDS file is
+ * loaded into `pixels' and set up for direct upload.
+ */
+static bool
+load_cached(objmgr_tex_t *tex, uint64_t *hash)
+{
+	size_t len;
+	void *src = map_file(tex->filename, &len);
+	char *path;
+
+	if (src == NULL)
+		return (false);
+	*hash = crc64(src, len);
+	unmap_file(src, len);
+	*hash = crc64_append(*hash, (uint8_t []){ TEX_CACHE_VERSION,
+	    tex->kind, tex->norm_bc5 }, 3);
+
+	path = cache_path(tex, *hash);
+	if (file_exists(path, NULL) && load_dds_file(tex, path) &&
+	    !parse_dds(tex, tex->pixels, tex->buflen)) {
+		logMsg("%s: texture cache file %s is corrupt, ignoring it",
+		    tex->filename, path);
+		free_pixels(tex);
+	}
+	free(path);
+
+	return (tex->pixels != NULL);
+}
+
 static void
 load_texture(void *arg)
 {
+	uint64_t hash = 0;
+	bool use_cache, cached = false;
 	objmgr_tex_t *tex;
 
 	ASSERT(arg != NULL);
@@ -130,14 +762,14 @@ load_texture(void *arg)
 		char *dds_filename = path_ext_subst(tex->filename, "dds");
 		char *dds_filename_up = path_ext_subst(tex->filename, "DDS");
 		if ((file_exists(dds_filename, NULL) &&
-		    (tex->pixels = file2buf(dds_filename, &tex->buflen)) !=
-		    NULL) ||
+		    load_dds_file(tex, dds_filename)) ||
 		    (file_exists(dds_filename_up, NULL) &&
-		    (tex->pixels = file2buf(dds_filename_up, &tex->buflen)) !=
-		    NULL)) {
+		    load_dds_file(tex, dds_filename_up))) {
+			(void) parse_dds(tex, tex->pixels, tex->buflen);
 			mutex_enter(&tex->lock);
 			tex->load_complete = true;
 			tex->load_dds = true;
+			tex->reloadable = true;
 			tex->load_started = false;
 			mutex_exit(&tex->lock);
 			LACF_DESTROY(dds_filename);
@@ -147,19 +779,36 @@ load_texture(void *arg)
 		LACF_DESTROY(dds_filename);
 		LACF_DESTROY(dds_filename_up);
 	}
+	use_cache = (tex->cache_dir != NULL);
+	if (use_cache && load_cached(tex, &hash)) {
+		mutex_enter(&tex->lock);
+		tex->load_complete = true;
+		tex->reloadable = true;
+		tex->load_started = false;
+		mutex_exit(&tex->lock);
+		return;
+	}
 	tex->pixels = png_load_from_file_rgb_auto(tex->filename, &tex->width,
 	    &tex->height, &tex->color_type, &tex->bit_depth);
+	if (tex->pixels != NULL && !gen_png_mips(tex)) {
+		lacf_free(tex->pixels);
+		tex->pixels = NULL;
+	}
+	/* a zero hash means we couldn't read the source file */
+	if (tex->mip_data != NULL && use_cache && hash != 0)
+		cached = transcode_png(tex, hash);
 	mutex_enter(&tex->lock);
-	if (tex->pixels != NULL)
+	if (tex->mip_data != NULL)
 		tex->load_complete = true;
 	else
 		tex->load_error = true;
+	tex->reloadable = cached;
 	tex->load_started = false;
 	mutex_exit(&tex->lock);
 }
 
 static objmgr_tex_t *
-add_tex(objmgr_t *mgr, const char *filename, bool allow_dds)
+add_tex(objmgr_t *mgr, const char *filename, tex_kind_t kind, bool allow_dds)
 {
 	const objmgr_tex_t srch = { .filename = (char *)filename };
 	avl_index_t where;
@@ -176,6 +825,10 @@ add_tex(objmgr_t *mgr, const char *filename, bool allow_dds)
 		tex->refcnt = 1;
 		tex->filename = safe_strdup(filename);
 		tex->allow_dds = allow_dds;
+		tex->kind = kind;
+		if (mgr->cache_dir != NULL)
+			tex->cache_dir = safe_strdup(mgr->cache_dir);
+		tex->norm_bc5 = mgr->norm_bc5;
 		mutex_init(&tex->lock);
 
 		tex->load_started = true;
@@ -190,29 +843,251 @@ add_tex(objmgr_t *mgr, const char *filename, bool allow_dds)
 	return (tex);
 }
 
+/*
+ * Picks the next pixel unpack buffer from the ring, making sure it can
+ * hold `size' bytes, fills it with `data' and leaves it bound. Returns
+ * the slot index, or -1 if the GPU is still reading from the slot.
+ */
+static int
+pbo_ring_fill(objmgr_t *mgr, const void *data, size_t size)
+{
+	unsigned i = mgr->pbo_next;
+	void *p = NULL;
+
+	if (mgr->pbo_fence[i] != NULL) {
+		if (glClientWaitSync(mgr->pbo_fence[i], 0, 0) ==
+		    GL_TIMEOUT_EXPIRED)
+			return (-1);
+		glDeleteSync(mgr->pbo_fence[i]);
+		mgr->pbo_fence[i] = NULL;
+	}
+	if (mgr->pbo[i] == 0)
+		glGenBuffers(1, &mgr->pbo[i]);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, mgr->pbo[i]);
+	/*
+	 * Without sync objects, we can't tell when the GPU is done with
+	 * the buffer, so orphan it on every use instead.
+	 */
+	if (size > mgr->pbo_sz[i] || !GLEW_VERSION_3_2) {
+		if (size > mgr->pbo_sz[i]) {
+			librain_mem_alloc(LIBRAIN_MEM_OBJMGR_PBO, NULL,
+			    size - mgr->pbo_sz[i]);
+			mgr->pbo_sz[i] = size;
+		}
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, mgr->pbo_sz[i], NULL,
+		    GL_STREAM_DRAW);
+	}
+	if (GLEW_VERSION_3_0) {
+		p = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+		    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+		    GL_MAP_UNSYNCHRONIZED_BIT);
+	}
+	if (p != NULL) {
+		memcpy(p, data, size);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	} else {
+		glBufferSubData(GL_PIXEL_UNPACK_BUFFER, 0, size, data);
+	}
+	mgr->pbo_next = (i + 1) % PBO_RING_SZ;
+
+	return (i);
+}
+
+static void
+pbo_ring_fini(objmgr_t *mgr)
+{
+	for (unsigned i = 0; i < PBO_RING_SZ; i++) {
+		if (mgr->pbo_fence[i] != NULL)
+			glDeleteSync(mgr->pbo_fence[i]);
+		if (mgr->pbo[i] != 0)
+			glDeleteBuffers(1, &mgr->pbo[i]);
+		librain_mem_free(LIBRAIN_MEM_OBJMGR_PBO, NULL, mgr->pbo_sz[i]);
+	}
+}
+
+/*
+ * At least one mip level is let through per frame even if it exceeds
+ * the budget on its own, so that large textures can't stall forever.
+ */
+static bool
+upload_budget_avail(const objmgr_t *mgr)
+{
+	if (mgr->frame_bytes == 0)
+		return (true);
+	if (mgr->budget_bytes != 0 && mgr->frame_bytes >= mgr->budget_bytes)
+		return (false);
+	if (mgr->budget_us != 0 && mgr->frame_us >= mgr->budget_us)
+		return (false);
+	return (true);
+}
+
+/*
+ * Uploads as many of the texture's remaining mip levels as the frame's
+ * budget allows. Returns true once all levels are uploaded.
+ */
+static bool
+upload_levels(objmgr_tex_t *tex)
+{
+	objmgr_t *mgr = tex->mgr;
+	const uint8_t *base = (tex->mip_data != NULL ? tex->mip_data :
+	    tex->pixels);
+	GLint old_align;
+
+	ASSERT(tex->levels != NULL);
+
+	glActiveTexture(GL_TEXTURE0);
+	if (tex->upload_tex == 0) {
+		glGenTextures(1, &tex->upload_tex);
+		VERIFY(tex->upload_tex != 0);
+		glBindTexture(GL_TEXTURE_2D, tex->upload_tex);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+		    tex->n_levels - 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
+		    GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+		    tex->n_levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+		if (tex->load_dds) {
+			/* same as what SOIL sets up for DDS files */
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
+			    GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,
+			    GL_CLAMP_TO_EDGE);
+		}
+	} else {
+		glBindTexture(GL_TEXTURE_2D, tex->upload_tex);
+	}
+	glGetIntegerv(GL_UNPACK_ALIGNMENT, &old_align);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	while (tex->next_level < tex->n_levels && upload_budget_avail(mgr)) {
+		const tex_level_t *lvl = &tex->levels[tex->next_level];
+		uint64_t start = microclock();
+		int slot = pbo_ring_fill(mgr, &base[lvl->off], lvl->size);
+
+		if (slot < 0)
+			break;
+		if (tex->compressed) {
+			glCompressedTexImage2D(GL_TEXTURE_2D, tex->next_level,
+			    tex->int_fmt, lvl->w, lvl->h, 0, lvl->size, NULL);
+		} else {
+			glTexImage2D(GL_TEXTURE_2D, tex->next_level,
+			    tex->int_fmt, lvl->w, lvl->h, 0, tex->fmt,
+			    tex->type, NULL);
+		}
+		if (GLEW_VERSION_3_2) {
+			mgr->pbo_fence[slot] = glFenceSync(
+			    GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		}
+		tex->next_level++;
+		mgr->frame_bytes += lvl->size;
+		mgr->frame_us += microclock() - start;
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, old_align);
+
+	return (tex->next_level == tex->n_levels);
+}
+
+/*
+ * Drops the texture from VRAM. It is reloaded by its loader thread the
+ * next time it is bound, from the compressed texture cache or the
+ * original DDS file (see `reloadable').
+ */
+static void
+evict_tex(objmgr_tex_t *tex)
+{
+	objmgr_t *mgr = tex->mgr;
+
+	ASSERT(tex->tex != 0);
+	ASSERT(tex->loader_joined);
+	ASSERT(tex->reloadable);
+
+	list_remove(&mgr->resident, tex);
+	mgr->vram_used -= tex->vram_sz;
+	librain_mem_free(LIBRAIN_MEM_OBJMGR_TEX, &tex->mem, tex->vram_sz);
+	if (tex->handle != 0) {
+		glMakeTextureHandleNonResidentARB(tex->handle);
+		tex->handle = 0;
+	}
+	glDeleteTextures(1, &tex->tex);
+
+	mutex_enter(&tex->lock);
+	tex->tex = 0;
+	tex->load_complete = false;
+	tex->evicted = true;
+	tex->next_level = 0;
+	mutex_exit(&tex->lock);
+}
+
+/*
+ * Evicts least recently bound textures until we're within the VRAM
+ * budget. Textures bound in the current frame, and textures which can't
+ * be reloaded cheaply, are never evicted, so if those alone exceed the
+ * budget, we stay over it.
+ */
+static void
+enforce_vram_budget(objmgr_t *mgr)
+{
+	objmgr_tex_t *tex, *next;
+
+	if (mgr->vram_budget == 0)
+		return;
+	for (tex = list_head(&mgr->resident); tex != NULL &&
+	    mgr->vram_used > mgr->vram_budget; tex = next) {
+		next = list_next(&mgr->resident, tex);
+		/* the list is ordered by use, so everything after is too */
+		if (tex->last_frame == mgr->frame)
+			break;
+		if (tex->reloadable)
+			evict_tex(tex);
+	}
+}
+
+static void
+make_resident(objmgr_tex_t *tex, size_t vram_sz)
+{
+	objmgr_t *mgr = tex->mgr;
+
+	tex->vram_sz = vram_sz;
+	tex->last_frame = mgr->frame;
+	list_insert_tail(&mgr->resident, tex);
+	mgr->vram_used += vram_sz;
+	librain_mem_alloc(LIBRAIN_MEM_OBJMGR_TEX, &tex->mem, vram_sz);
+}
+
 static bool
 complete_texture_load(objmgr_tex_t *tex)
 {
 	ASSERT(tex != NULL);
 
 	mutex_enter(&tex->lock);
+	if (tex->evicted) {
+		/* bound again after eviction, start reloading it */
+		ASSERT(tex->loader_joined);
+		tex->evicted = false;
+		tex->load_started = true;
+		tex->loader_joined = false;
+		VERIFY(thread_create(&tex->loader, load_texture, tex));
+	}
 	if (tex->load_complete && tex->tex == 0) {
-		GLint int_fmt, fmt, type;
-
 		mutex_exit(&tex->lock);
 
-		thread_join(&tex->loader);
+		if (!tex->loader_joined) {
+			thread_join(&tex->loader);
+			tex->loader_joined = true;
+		}
 
 		mutex_enter(&tex->lock);
 		if (tex->tex != 0) {
-			ASSERT3P(tex->pixels, ==, NULL);
 			mutex_exit(&tex->lock);
-			return (tex->tex != 0);
+			return (true);
 		}
 		ASSERT0(tex->load_started);
-		ASSERT(tex->pixels != NULL);
 
-		if (tex->load_dds) {
+		if (tex->levels == NULL) {
+			ASSERT(tex->load_dds);
+			ASSERT(tex->pixels != NULL);
 			tex->tex = SOIL_load_OGL_texture_from_memory(
 			    tex->pixels, tex->buflen, 0, 0,
 			    SOIL_FLAG_DDS_LOAD_DIRECT);
@@ -221,29 +1096,27 @@ complete_texture_load(objmgr_tex_t *tex)
 				    "data is corrupt", tex->filename);
 				tex->load_complete = false;
 				tex->load_error = true;
+			} else {
+				/* the file's payload is a good estimate */
+				make_resident(tex, tex->buflen - MIN(
+				    tex->buflen, DDS_HDR_SZ));
 			}
-		} else if (glutils_png2gltexfmt(tex->color_type,
-		    tex->bit_depth, &int_fmt, &fmt, &type)) {
-			glGenTextures(1, &tex->tex);
-			VERIFY(tex->tex != 0);
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, tex->tex);
-			glTexImage2D(GL_TEXTURE_2D, 0, int_fmt, tex->width,
-			    tex->height, 0, fmt, type, tex->pixels);
-			glGenerateMipmap(GL_TEXTURE_2D);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
-			    GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-			    GL_LINEAR_MIPMAP_LINEAR);
-		} else {
-			logMsg("%s: unsupported color type/bit depth combo: "
-			    "%d/%d", tex->filename, tex->color_type,
-			    tex->bit_depth);
-			tex->load_complete = false;
-			tex->load_error = true;
+		} else if (upload_levels(tex)) {
+			size_t vram_sz = 0;
+
+			for (unsigned i = 0; i < tex->n_levels; i++)
+				vram_sz += tex->levels[i].size;
+			tex->tex = tex->upload_tex;
+			tex->upload_tex = 0;
+			make_resident(tex, vram_sz);
+		}
+		if (tex->tex != 0 || tex->load_error) {
+			free_pixels(tex);
+			free(tex->mip_data);
+			tex->mip_data = NULL;
+			free(tex->levels);
+			tex->levels = NULL;
 		}
-		lacf_free(tex->pixels);
-		tex->pixels = NULL;
 		GLUTILS_ASSERT_NO_ERROR();
 	}
 	mutex_exit(&tex->lock);
@@ -251,48 +1124,133 @@ complete_texture_load(objmgr_tex_t *tex)
 	return (tex->tex != 0);
 }
 
-static void
-remove_tex(objmgr_t *mgr, objmgr_tex_t *tex)
+/*
+ * Limits how much texture data is uploaded per frame, either by time
+ * (`max_ms') or by size (`max_bytes'). Zero means unlimited. Textures
+ * which don't fit into a frame's budget complete over several frames,
+ * until then they aren't bound. When setting a budget, the caller must
+ * call objmgr_new_frame once per frame to replenish it.
+ */
+void
+objmgr_set_tex_upload_budget(objmgr_t *mgr, double max_ms, size_t max_bytes)
 {
 	ASSERT(mgr != NULL);
-	ASSERT(tex != NULL);
-	ASSERT3U(tex->refcnt, >, 0);
+	ASSERT3F(max_ms, >=, 0);
+	mgr->budget_us = max_ms * 1000;
+	mgr->budget_bytes = max_bytes;
+}
 
-	mutex_enter(&mgr->lock);
-	tex->refcnt--;
-	if (tex->refcnt == 0) {
-		avl_remove(&mgr->texs, tex);
-		free_tex(tex);
+/*
+ * Enables the compressed texture cache in `cache_dir' (NULL disables it).
+ * PNG textures are then transcoded to BC1 (opaque) or BC3 (with alpha)
+ * on their first load and stored in the cache as DDS files, so later
+ * loads can upload them directly. Normal maps always use BC3, or BC5 if
+ * `norm_bc5' is set. BC5 only keeps the red and green channels, so that
+ * requires shaders which reconstruct the normal's Z component. Only
+ * affects textures loaded after this call.
+ */
+void
+objmgr_set_tex_cache(objmgr_t *mgr, const char *cache_dir, bool norm_bc5)
+{
+	ASSERT(mgr != NULL);
+
+	if (cache_dir != NULL && !create_directory_recursive(cache_dir)) {
+		logMsg("Can't create texture cache directory %s, texture "
+		    "cache disabled", cache_dir);
+		cache_dir = NULL;
 	}
+	crc64_init();
+
+	mutex_enter(&mgr->lock);
+	free(mgr->cache_dir);
+	mgr->cache_dir = (cache_dir != NULL ? safe_strdup(cache_dir) : NULL);
+	mgr->norm_bc5 = norm_bc5;
 	mutex_exit(&mgr->lock);
 }
 
-static bool
-obj_load_textures(objmgr_t *mgr, objmgr_obj_t *obj)
+void
+objmgr_new_frame(objmgr_t *mgr)
 {
-	const char *tex_filename;
-
 	ASSERT(mgr != NULL);
-	ASSERT(obj != NULL);
-	ASSERT(obj->obj != NULL);
+	mgr->frame_us = 0;
+	mgr->frame_bytes = 0;
+	mgr->frame++;
+	enforce_vram_budget(mgr);
+}
 
-	tex_filename = obj8_get_tex_filename(obj->obj, false);
-	if (tex_filename != NULL && obj->tex == NULL) {
-		obj->tex = add_tex(mgr, tex_filename, obj->allow_dds_albedo);
-		if (obj->tex == NULL)
-			return (false);
+/*
+ * Sets the amount of VRAM which textures may occupy, 0 meaning
+ * unlimited. When over budget, the least recently bound textures are
+ * evicted at the start of the next frame (see objmgr_new_frame, which
+ * must be called every frame for this to work) and transparently
+ * reloaded in the background when bound again. Until reloaded, they
+ * are reported as unbound by objmgr_bind_textures. Only textures loaded
+ * from DDS files or the texture cache (see objmgr_set_tex_cache) are
+ * ever evicted, PNGs which couldn't be cached stay resident.
+ */
+void
+objmgr_set_vram_budget(objmgr_t *mgr, size_t bytes)
+{
+	ASSERT(mgr != NULL);
+	mgr->vram_budget = bytes;
+}
+
+/*
+ * Returns the amount of VRAM taken up by resident textures. For DDS
+ * files loaded through SOIL, this is an estimate.
+ */
+size_t
+objmgr_get_vram_usage(const objmgr_t *mgr)
+{
+	ASSERT(mgr != NULL);
+	return (mgr->vram_used);
+}
+
+static void
+remove_tex(objmgr_t *mgr, objmgr_tex_t *tex)
+{
+	ASSERT(mgr != NULL);
+	ASSERT(tex != NULL);
+	ASSERT3U(tex->refcnt, >, 0);
+
+	mutex_enter(&mgr->lock);
+	tex->refcnt--;
+	if (tex->refcnt == 0) {
+		avl_remove(&mgr->texs, tex);
+		free_tex(tex);
+	}
+	mutex_exit(&mgr->lock);
+}
+
+static bool
+obj_load_textures(objmgr_t *mgr, objmgr_obj_t *obj, bool wait)
+{
+	const char *tex_filename;
+
+	ASSERT(mgr != NULL);
+	ASSERT(obj != NULL);
+	ASSERT(obj->obj != NULL);
+
+	tex_filename = obj8_get_tex_filename(obj->obj, wait);
+	if (tex_filename != NULL && obj->tex == NULL) {
+		obj->tex = add_tex(mgr, tex_filename, TEX_ALBEDO,
+		    obj->allow_dds_albedo);
+		if (obj->tex == NULL)
+			return (false);
 	}
 	if (obj->load_norm) {
-		tex_filename = obj8_get_norm_filename(obj->obj, false);
+		tex_filename = obj8_get_norm_filename(obj->obj, wait);
 		if (tex_filename != NULL && obj->norm == NULL) {
-			obj->norm = add_tex(mgr, tex_filename, false);
+			obj->norm = add_tex(mgr, tex_filename, TEX_NORM,
+			    false);
 			if (obj->norm == NULL)
 				return (false);
 		}
 	}
-	tex_filename = obj8_get_lit_filename(obj->obj, false);
+	tex_filename = obj8_get_lit_filename(obj->obj, wait);
 	if (tex_filename != NULL && obj->lit == NULL) {
-		obj->lit = add_tex(mgr, tex_filename, obj->allow_dds_lit);
+		obj->lit = add_tex(mgr, tex_filename, TEX_LIT,
+		    obj->allow_dds_lit);
 		if (obj->lit == NULL)
 			return (false);
 	}
@@ -300,6 +1258,27 @@ obj_load_textures(objmgr_t *mgr, objmgr_obj_t *obj)
 	return (true);
 }
 
+static void
+free_obj(objmgr_obj_t *obj)
+{
+	ASSERT(obj != NULL);
+	ASSERT0(obj->refcnt);
+
+	thread_join(&obj->loader);
+	if (obj->tex != NULL)
+		remove_tex(obj->mgr, obj->tex);
+	if (obj->norm != NULL)
+		remove_tex(obj->mgr, obj->norm);
+	if (obj->lit != NULL)
+		remove_tex(obj->mgr, obj->lit);
+	if (obj->obj != NULL)
+		obj8_free(obj->obj);
+	free(obj->filename);
+	mutex_destroy(&obj->lock);
+	cv_destroy(&obj->cv);
+	ZERO_FREE(obj);
+}
+
 objmgr_t *
 objmgr_new(void)
 {
@@ -309,7 +1288,10 @@ objmgr_new(void)
 	    offsetof(objmgr_tex_t, node));
 	avl_create(&mgr->objs, obj_compar, sizeof (objmgr_obj_t),
 	    offsetof(objmgr_obj_t, node));
+	list_create(&mgr->resident, sizeof (objmgr_tex_t),
+	    offsetof(objmgr_tex_t, lru_node));
 	mutex_init(&mgr->lock);
+	mutex_init(&mgr->changed_lock);
 
 	return (mgr);
 }
@@ -323,11 +1305,24 @@ objmgr_destroy(objmgr_t *mgr)
 
 	if (mgr == NULL)
 		return;
+	/* render-to-texture caches point back at us and our objects */
+	ASSERT0(mgr->n_rtts);
+
+	if (mgr->manifest_path != NULL && mgr->manifest != NULL) {
+		(void) write_cache_file(mgr->manifest_path,
+		    (const uint8_t *)mgr->manifest, mgr->manifest_len);
+	}
+	free(mgr->manifest_path);
+	free(mgr->manifest);
+	/* all objects go away below, so the references are moot */
+	free(mgr->upd_objs);
+	free(mgr->changed);
+	mutex_destroy(&mgr->changed_lock);
 
 	cookie = NULL;
 	while ((obj = avl_destroy_nodes(&mgr->objs, &cookie)) != NULL) {
-		obj8_free(obj->obj);
-		free(obj);
+		obj->refcnt = 0;
+		free_obj(obj);
 	}
 	avl_destroy(&mgr->objs);
 
@@ -337,58 +1332,189 @@ objmgr_destroy(objmgr_t *mgr)
 		free_tex(tex);
 	}
 	avl_destroy(&mgr->texs);
+	list_destroy(&mgr->resident);
+	pbo_ring_fini(mgr);
+	free(mgr->cache_dir);
 	mutex_destroy(&mgr->lock);
 
 	free(mgr);
 }
 
-objmgr_obj_t *
-objmgr_add_obj(objmgr_t *mgr, const char *filename, bool lazy_load_textures,
-    bool load_norm, bool allow_dds_albedo, bool allow_dds_lit)
+static void
+load_obj(void *arg)
 {
-	const objmgr_obj_t srch = { .filename = filename };
 	objmgr_obj_t *obj;
+	obj_state_t state = OBJ_READY;
+
+	ASSERT(arg != NULL);
+	obj = arg;
+
+	obj->obj = obj8_parse(obj->filename, ZERO_VECT3);
+	if (obj->obj == NULL) {
+		state = OBJ_FAILED;
+	} else if (!obj->lazy_load_textures &&
+	    !obj_load_textures(obj->mgr, obj, true)) {
+		state = OBJ_FAILED;
+	}
+	mutex_enter(&obj->lock);
+	obj->state = state;
+	cv_broadcast(&obj->cv);
+	mutex_exit(&obj->lock);
+}
+
+static bool
+obj_is_ready(const objmgr_obj_t *obj)
+{
+	bool ready;
+
+	mutex_enter((mutex_t *)&obj->lock);
+	ready = (obj->state == OBJ_READY);
+	mutex_exit((mutex_t *)&obj->lock);
+
+	return (ready);
+}
+
+static objmgr_obj_t *
+add_obj_impl(objmgr_t *mgr, const char *filename, bool lazy_load_textures,
+    bool load_norm, bool allow_dds_albedo, bool allow_dds_lit, bool preload)
+{
+	const objmgr_obj_t srch = { .filename = (char *)filename };
+	objmgr_obj_t *obj, *unused = NULL;
 	avl_index_t where;
 
 	ASSERT(mgr != NULL);
 	ASSERT(filename != NULL);
 
 	mutex_enter(&mgr->lock);
-
 	obj = avl_find(&mgr->objs, &srch, &where);
+	if (obj != NULL) {
+		bool failed;
+
+		mutex_enter(&obj->lock);
+		failed = (obj->state == OBJ_FAILED);
+		mutex_exit(&obj->lock);
+		if (failed) {
+			/*
+			 * Give the file another chance. Whoever holds the
+			 * failed object still has to remove it.
+			 */
+			avl_remove(&mgr->objs, obj);
+			obj->in_tree = false;
+			if (obj->preloaded) {
+				obj->preloaded = false;
+				if (--obj->refcnt == 0)
+					unused = obj;
+			}
+			obj = NULL;
+			VERIFY3P(avl_find(&mgr->objs, &srch, &where), ==,
+			    NULL);
+		} else if (preload) {
+			/* already loaded or loading, nothing to do */
+			mutex_exit(&mgr->lock);
+			return (NULL);
+		}
+	}
 	if (obj == NULL) {
 		obj = safe_calloc(1, sizeof (*obj));
-		obj->obj = obj8_parse(filename, ZERO_VECT3);
+		obj->mgr = mgr;
+		obj->filename = safe_strdup(filename);
 		obj->refcnt = 1;
+		obj->preloaded = preload;
+		obj->lazy_load_textures = lazy_load_textures;
 		obj->load_norm = load_norm;
 		obj->allow_dds_albedo = allow_dds_albedo;
 		obj->allow_dds_lit = allow_dds_lit;
-		if (obj->obj == NULL)
-			goto errout;
-		obj->filename = obj8_get_filename(obj->obj);
-		if (!lazy_load_textures && !obj_load_textures(mgr, obj))
-			goto errout;
-
+		mutex_init(&obj->lock);
+		cv_init(&obj->cv);
+		obj->state = OBJ_LOADING;
 		avl_insert(&mgr->objs, obj, where);
+		obj->in_tree = true;
+		VERIFY(thread_create(&obj->loader, load_obj, obj));
+	} else if (obj->preloaded) {
+		/* the caller takes over the preload's reference */
+		obj->preloaded = false;
 	} else {
 		obj->refcnt++;
 	}
+	if (!preload && !obj->recorded && mgr->manifest_path != NULL) {
+		obj->recorded = true;
+		append_format(&mgr->manifest, &mgr->manifest_len,
+		    "obj %d %d %d %s\n", load_norm, allow_dds_albedo,
+		    allow_dds_lit, filename);
+	}
 	mutex_exit(&mgr->lock);
+	/* a failed preload which nobody else held */
+	if (unused != NULL)
+		free_obj(unused);
 
 	return (obj);
-errout:
-	if (obj->obj != NULL)
-		obj8_free(obj->obj);
-	if (obj->tex != NULL)
-		remove_tex(mgr, obj->tex);
-	if (obj->norm != NULL)
-		remove_tex(mgr, obj->norm);
-	if (obj->lit != NULL)
-		remove_tex(mgr, obj->lit);
-	ZERO_FREE(obj);
-	mutex_exit(&mgr->lock);
+}
+
+/*
+ * Starts loading an object, or takes another reference to it if it's
+ * already loaded or loading. This only does a tree lookup and insert
+ * under the manager's lock and returns immediately, the file I/O is done
+ * in the background. Until objmgr_obj_is_ready returns true, the object
+ * must not be passed to objmgr_get_obj8 and the drawing functions skip
+ * it. If loading fails, the object stays in a failed state until
+ * removed by the caller with objmgr_remove_obj, while a later
+ * objmgr_add_obj_async of the same file tries loading it again.
+ */
+objmgr_obj_t *
+objmgr_add_obj_async(objmgr_t *mgr, const char *filename,
+    bool lazy_load_textures, bool load_norm, bool allow_dds_albedo,
+    bool allow_dds_lit)
+{
+	return (add_obj_impl(mgr, filename, lazy_load_textures, load_norm,
+	    allow_dds_albedo, allow_dds_lit, false));
+}
+
+/*
+ * Returns true once the object has finished loading successfully.
+ */
+bool
+objmgr_obj_is_ready(const objmgr_obj_t *obj)
+{
+	ASSERT(obj != NULL);
+	return (obj_is_ready(obj));
+}
+
+/*
+ * Waits for the object to finish loading. Returns true if loading
+ * succeeded, false if it failed.
+ */
+bool
+objmgr_obj_wait(objmgr_obj_t *obj)
+{
+	bool ready;
+
+	ASSERT(obj != NULL);
+
+	mutex_enter(&obj->lock);
+	while (obj->state == OBJ_LOADING)
+		cv_wait(&obj->cv, &obj->lock);
+	ready = (obj->state == OBJ_READY);
+	mutex_exit(&obj->lock);
+
+	return (ready);
+}
+
+/*
+ * Synchronous version of objmgr_add_obj_async. Returns NULL if the
+ * object failed to load.
+ */
+objmgr_obj_t *
+objmgr_add_obj(objmgr_t *mgr, const char *filename, bool lazy_load_textures,
+    bool load_norm, bool allow_dds_albedo, bool allow_dds_lit)
+{
+	objmgr_obj_t *obj = objmgr_add_obj_async(mgr, filename,
+	    lazy_load_textures, load_norm, allow_dds_albedo, allow_dds_lit);
 
-	return (NULL);
+	if (!objmgr_obj_wait(obj)) {
+		objmgr_remove_obj(mgr, obj);
+		return (NULL);
+	}
+	return (obj);
 }
 
 void
@@ -399,24 +1525,108 @@ objmgr_remove_obj(objmgr_t *mgr, objmgr_obj_t *obj)
 	ASSERT(obj->refcnt != 0);
 
 	mutex_enter(&mgr->lock);
-
 	obj->refcnt--;
-	if (obj->refcnt == 0) {
+	if (obj->refcnt != 0) {
+		mutex_exit(&mgr->lock);
+		return;
+	}
+	if (obj->in_tree) {
 		avl_remove(&mgr->objs, obj);
+		obj->in_tree = false;
+	}
+	mutex_exit(&mgr->lock);
+	/* the loader might still need the lock, so free outside of it */
+	free_obj(obj);
+}
 
-		if (obj->tex != NULL)
-			remove_tex(mgr, obj->tex);
-		if (obj->norm != NULL)
-			remove_tex(mgr, obj->norm);
-		if (obj->lit != NULL)
-			remove_tex(mgr, obj->lit);
-		ASSERT(obj->obj != NULL);
-		obj8_free(obj->obj);
-		ZERO_FREE(obj);
+/*
+ * Starts loading all objects (and, unlike lazily loaded objects, their
+ * textures) listed in the manifest at `path', which was recorded by a
+ * previous session. Each preloaded object is kept loaded until either
+ * objmgr_add_obj takes it over or objmgr_preload_finish is called.
+ * This session's object load order is then recorded and written back
+ * to `path' when the manager is destroyed. Call this at plugin start,
+ * before adding any objects. Returns the number of objects whose
+ * loading was started.
+ */
+unsigned
+objmgr_preload_manifest(objmgr_t *mgr, const char *path)
+{
+	FILE *fp;
+	char *line = NULL;
+	size_t cap = 0;
+	unsigned n_started = 0;
+
+	ASSERT(mgr != NULL);
+	ASSERT(path != NULL);
+
+	mutex_enter(&mgr->lock);
+	ASSERT3P(mgr->manifest_path, ==, NULL);
+	mgr->manifest_path = safe_strdup(path);
+	mutex_exit(&mgr->lock);
+
+	fp = fopen(path, "rb");
+	if (fp == NULL) {
+		if (errno != ENOENT) {
+			logMsg("Can't read preload manifest %s: %s", path,
+			    strerror(errno));
+		}
+		return (0);
+	}
+	while (lacf_getline(&line, &cap, fp) > 0) {
+		int load_norm, dds_albedo, dds_lit, off = 0;
+
+		strip_space(line);
+		if (sscanf(line, "obj %d %d %d %n", &load_norm, &dds_albedo,
+		    &dds_lit, &off) != 3 || off == 0 || line[off] == 0) {
+			if (line[0] != 0) {
+				logMsg("%s: malformed line \"%s\"", path,
+				    line);
+			}
+			continue;
+		}
+		if (add_obj_impl(mgr, &line[off], false, load_norm,
+		    dds_albedo, dds_lit, true) != NULL)
+			n_started++;
+	}
+	free(line);
+	fclose(fp);
+
+	return (n_started);
+}
+
+/*
+ * Releases the preloaded objects which haven't been taken over by
+ * objmgr_add_obj, i.e. aren't used by this session. Call once all
+ * objects have been added.
+ */
+void
+objmgr_preload_finish(objmgr_t *mgr)
+{
+	objmgr_obj_t **objs;
+	size_t n_objs = 0;
+
+	ASSERT(mgr != NULL);
+
+	mutex_enter(&mgr->lock);
+	objs = safe_calloc(avl_numnodes(&mgr->objs) + 1, sizeof (*objs));
+	for (objmgr_obj_t *obj = avl_first(&mgr->objs); obj != NULL;
+	    obj = AVL_NEXT(&mgr->objs, obj)) {
+		if (obj->preloaded) {
+			obj->preloaded = false;
+			objs[n_objs++] = obj;
+		}
 	}
 	mutex_exit(&mgr->lock);
+
+	for (size_t i = 0; i < n_objs; i++)
+		objmgr_remove_obj(mgr, objs[i]);
+	free(objs);
 }
 
+/*
+ * The object must be ready, see objmgr_obj_is_ready.
+ */
 obj8_t *
 objmgr_get_obj8(const objmgr_obj_t *obj)
 {
@@ -433,12 +1643,46 @@ objmgr_get_obj_filename(const objmgr_obj_t *obj)
 	return (obj->filename);
 }
 
+static void
+add_tex_mem_stat(librain_mem_stat_t *st, const objmgr_tex_t *tex)
+{
+	librain_mem_stat_t tex_st;
+
+	if (tex == NULL)
+		return;
+	tex_st = librain_mem_acct_get(&tex->mem);
+	st->bytes += tex_st.bytes;
+	st->peak += tex_st.peak;
+}
+
+/*
+ * Returns the memory held by an object's geometry and its resident
+ * textures. Textures shared with other objects are counted in full for
+ * each of them. The peak is the sum of the individual peaks. Returns
+ * zero while the object is still loading.
+ */
+librain_mem_stat_t
+objmgr_get_obj_mem_stat(const objmgr_obj_t *obj)
+{
+	librain_mem_stat_t st = { 0 };
+
+	ASSERT(obj != NULL);
+	if (!obj_is_ready(obj))
+		return (st);
+	st = obj8_get_mem_stat(obj->obj);
+	add_tex_mem_stat(&st, obj->tex);
+	add_tex_mem_stat(&st, obj->norm);
+	add_tex_mem_stat(&st, obj->lit);
+
+	return (st);
+}
+
 static bool
 can_complete_tex_load(const objmgr_tex_t *tex)
 {
 	ASSERT(tex != NULL);
 	mutex_enter((mutex_t *)&tex->lock);
-	bool result = (tex->load_complete && tex->pixels != NULL);
+	bool result = (tex->load_complete && tex->tex == 0);
 	mutex_exit((mutex_t *)&tex->lock);
 	return (result);
 }
@@ -447,11 +1691,24 @@ bool
 objmgr_tex_needs_upload(const objmgr_obj_t *obj)
 {
 	ASSERT(obj != NULL);
+	if (!obj_is_ready(obj))
+		return (false);
 	return ((obj->tex != NULL && can_complete_tex_load(obj->tex)) &&
 	    (obj->norm != NULL && can_complete_tex_load(obj->norm)) &&
 	    (obj->lit != NULL && can_complete_tex_load(obj->lit)));
 }
 
+static void
+touch_tex(objmgr_tex_t *tex)
+{
+	ASSERT(tex->tex != 0);
+	if (tex->last_frame != tex->mgr->frame) {
+		tex->last_frame = tex->mgr->frame;
+		list_remove(&tex->mgr->resident, tex);
+		list_insert_tail(&tex->mgr->resident, tex);
+	}
+}
+
 static unsigned
 bind_texture(objmgr_tex_t *tex, unsigned idx, int *out_idx)
 {
@@ -459,7 +1716,7 @@ bind_texture(objmgr_tex_t *tex, unsigned idx, int *out_idx)
 	ASSERT3U(idx, <, GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS);
 	if (out_idx != NULL) {
 		if (tex != NULL && complete_texture_load(tex)) {
-			ASSERT(tex->tex != 0);
+			touch_tex(tex);
 			glActiveTexture(GL_TEXTURE0 + idx);
 			glBindTexture(GL_TEXTURE_2D, tex->tex);
 			*out_idx = idx;
@@ -478,23 +1735,134 @@ objmgr_bind_textures(objmgr_t *mgr, objmgr_obj_t *obj, unsigned start_idx,
 	ASSERT(mgr != NULL);
 	ASSERT(obj != NULL);
 
-	obj_load_textures(mgr, obj);
+	if (!obj_is_ready(obj)) {
+		start_idx = bind_texture(NULL, start_idx, tex_idx);
+		start_idx = bind_texture(NULL, start_idx, norm_idx);
+		(void) bind_texture(NULL, start_idx, lit_idx);
+		return;
+	}
+	obj_load_textures(mgr, obj, false);
 
 	start_idx = bind_texture(obj->tex, start_idx, tex_idx);
 	start_idx = bind_texture(obj->norm, start_idx, norm_idx);
 	start_idx = bind_texture(obj->lit, start_idx, lit_idx);
 }
 
+static uint64_t
+get_tex_handle(objmgr_tex_t *tex)
+{
+	/* tex can be NULL */
+	if (tex == NULL || !complete_texture_load(tex))
+		return (0);
+	touch_tex(tex);
+	if (tex->handle == 0) {
+		/*
+		 * This makes the texture's state immutable, which is fine,
+		 * since we never touch it again after the upload.
+		 */
+		tex->handle = glGetTextureHandleARB(tex->tex);
+		VERIFY(tex->handle != 0);
+		glMakeTextureHandleResidentARB(tex->handle);
+	}
+	return (tex->handle);
+}
+
+/*
+ * Returns true if objmgr_get_tex_handles can be used, i.e. the driver
+ * supports ARB_bindless_texture.
+ */
+bool
+objmgr_bindless_avail(void)
+{
+	return (GLEW_ARB_bindless_texture);
+}
+
+/*
+ * Bindless alternative to objmgr_bind_textures. Instead of binding the
+ * object's textures to texture units, fills in their resident 64-bit
+ * texture handles, which the caller can pass to its shaders in a UBO,
+ * SSBO or as uniforms, avoiding texture binds between objects. A handle
+ * is 0 if the respective texture doesn't exist or hasn't finished
+ * loading yet. Handles stay valid until the texture is evicted (see
+ * objmgr_set_vram_budget) or the object is removed, so they must be
+ * re-fetched every frame. Requires objmgr_bindless_avail().
+ */
 void
-objmgr_foreach_obj(objmgr_t *mgr, objmgr_foreach_cb_t cb, void *userinfo)
+objmgr_get_tex_handles(objmgr_t *mgr, objmgr_obj_t *obj, uint64_t *tex_h,
+    uint64_t *norm_h, uint64_t *lit_h)
 {
 	ASSERT(mgr != NULL);
-	ASSERT(cb != NULL);
+	ASSERT(obj != NULL);
+	ASSERT(GLEW_ARB_bindless_texture);
+
+	if (!obj_is_ready(obj)) {
+		if (tex_h != NULL)
+			*tex_h = 0;
+		if (norm_h != NULL)
+			*norm_h = 0;
+		if (lit_h != NULL)
+			*lit_h = 0;
+		return;
+	}
+	obj_load_textures(mgr, obj, false);
+
+	if (tex_h != NULL)
+		*tex_h = get_tex_handle(obj->tex);
+	if (norm_h != NULL)
+		*norm_h = get_tex_handle(obj->norm);
+	if (lit_h != NULL)
+		*lit_h = get_tex_handle(obj->lit);
+}
+
+/*
+ * Takes a snapshot of all ready objects into `*objs_p' (growing it and
+ * `*cap_p' as necessary), holding a reference to each of them. Objects
+ * can be added and removed by other threads at any time, so this lets
+ * us walk them without keeping the object tree locked, which callbacks
+ * couldn't cope with. The caller must drop the references using
+ * objmgr_remove_obj. Returns the number of objects in the snapshot. If
+ * `all_ready_p' isn't NULL, it is set to whether all objects were ready.
+ */
+static size_t
+snapshot_ready_objs(objmgr_t *mgr, objmgr_obj_t ***objs_p, size_t *cap_p,
+    bool *all_ready_p)
+{
+	size_t n_objs = 0;
 
+	mutex_enter(&mgr->lock);
+	if (avl_numnodes(&mgr->objs) > *cap_p) {
+		*cap_p = avl_numnodes(&mgr->objs);
+		*objs_p = safe_realloc(*objs_p, *cap_p * sizeof (**objs_p));
+	}
 	for (objmgr_obj_t *obj = avl_first(&mgr->objs); obj != NULL;
 	    obj = AVL_NEXT(&mgr->objs, obj)) {
-		cb(mgr, obj, userinfo);
+		if (obj_is_ready(obj)) {
+			obj->refcnt++;
+			(*objs_p)[n_objs++] = obj;
+		}
 	}
+	if (all_ready_p != NULL)
+		*all_ready_p = (n_objs == avl_numnodes(&mgr->objs));
+	mutex_exit(&mgr->lock);
+
+	return (n_objs);
+}
+
+void
+objmgr_foreach_obj(objmgr_t *mgr, objmgr_foreach_cb_t cb, void *userinfo)
+{
+	objmgr_obj_t **objs = NULL;
+	size_t n_objs, cap = 0;
+
+	ASSERT(mgr != NULL);
+	ASSERT(cb != NULL);
+
+	n_objs = snapshot_ready_objs(mgr, &objs, &cap, NULL);
+	for (size_t i = 0; i < n_objs; i++)
+		cb(mgr, objs[i], userinfo);
+	for (size_t i = 0; i < n_objs; i++)
+		objmgr_remove_obj(mgr, objs[i]);
+	free(objs);
 }
 
 void
@@ -511,15 +1879,60 @@ objmgr_get_drset_needs_update(const objmgr_obj_t *obj)
 	return (obj->drset_needs_update);
 }
 
+/*
+ * Returns true if the drset was updated by this call and the update
+ * changed something, unlike `drset_has_changed', which sticks around
+ * until it is reset.
+ */
+static bool
+drset_update_impl(objmgr_obj_t *obj, bool force)
+{
+	if (!obj_is_ready(obj) || !(obj->drset_needs_update || force))
+		return (false);
+	obj->drset_needs_update = false;
+	obj->drset_has_changed = obj8_drset_update(obj8_get_drset(obj->obj));
+
+	return (obj->drset_has_changed);
+}
+
 void
 objmgr_drset_update(objmgr_obj_t *obj, bool force)
 {
 	ASSERT(obj != NULL);
-	if (obj->drset_needs_update || force) {
-		obj->drset_needs_update = false;
-		obj->drset_has_changed = obj8_drset_update(
-		    obj8_get_drset(obj->obj));
+	(void)drset_update_impl(obj, force);
+}
+
+/*
+ * Resolves missing datarefs of all objects' drsets, see obj8_drset_resolve.
+ * Call this from a flight loop callback. Objects which had any of their
+ * datarefs resolved are marked as needing a drset update. Returns true
+ * if all datarefs of all objects have been resolved.
+ */
+bool
+objmgr_drset_resolve(objmgr_t *mgr, uint64_t deadline)
+{
+	bool all_resolved;
+	objmgr_obj_t **objs = NULL;
+	size_t n_objs, cap = 0;
+
+	ASSERT(mgr != NULL);
+
+	/* objects which are still loading count as unresolved */
+	n_objs = snapshot_ready_objs(mgr, &objs, &cap, &all_resolved);
+	for (size_t i = 0; i < n_objs; i++) {
+		objmgr_obj_t *obj = objs[i];
+		obj8_drset_t *drset = obj8_get_drset(obj->obj);
+		unsigned n_unresolved = obj8_drset_get_num_unresolved(drset);
+
+		if (!obj8_drset_resolve(drset, deadline))
+			all_resolved = false;
+		if (obj8_drset_get_num_unresolved(drset) != n_unresolved)
+			obj->drset_needs_update = true;
+		objmgr_remove_obj(mgr, obj);
 	}
+	free(objs);
+
+	return (all_resolved);
 }
 
 bool
@@ -536,6 +1949,319 @@ objmgr_reset_drset_has_changed(objmgr_obj_t *obj)
 	obj->drset_has_changed = false;
 }
 
+/*
+ * Updates the drsets of all ready objects (see objmgr_drset_update for
+ * `force') and publishes the set of objects whose drset changed in this
+ * update, replacing the previously published set. Meant to be called
+ * from a flight loop callback, so that drawing code only needs to
+ * consume the results using objmgr_foreach_changed_obj. Since the
+ * datarefs must be read on the main thread, the updates all run on the
+ * calling thread.
+ * The object tree is only locked while taking a snapshot of it.
+ */
+void
+objmgr_drset_update_all(objmgr_t *mgr, bool force)
+{
+	size_t n_objs, n_changed = 0, old_n_changed, cap;
+	objmgr_obj_t **objs;
+
+	ASSERT(mgr != NULL);
+
+	n_objs = snapshot_ready_objs(mgr, &mgr->upd_objs, &mgr->upd_cap,
+	    NULL);
+	objs = mgr->upd_objs;
+	for (size_t i = 0; i < n_objs; i++) {
+		objmgr_obj_t *obj = objs[i];
+
+		/*
+		 * Move changed objects to the front. Objects which weren't
+		 * updated this time around don't count, even if their
+		 * `drset_has_changed' is still set from an earlier update.
+		 */
+		if (drset_update_impl(obj, force)) {
+			objs[i] = objs[n_changed];
+			objs[n_changed] = obj;
+			n_changed++;
+		}
+	}
+	for (size_t i = n_changed; i < n_objs; i++)
+		objmgr_remove_obj(mgr, objs[i]);
+
+	mutex_enter(&mgr->changed_lock);
+	mgr->upd_objs = mgr->changed;
+	mgr->changed = objs;
+	old_n_changed = mgr->n_changed;
+	mgr->n_changed = n_changed;
+	cap = mgr->upd_cap;
+	mgr->upd_cap = mgr->changed_cap;
+	mgr->changed_cap = cap;
+	mutex_exit(&mgr->changed_lock);
+
+	/* `upd_objs' now holds the previously published set */
+	for (size_t i = 0; i < old_n_changed; i++)
+		objmgr_remove_obj(mgr, mgr->upd_objs[i]);
+}
+
+/*
+ * Calls `cb' for every object in the changed set published by the last
+ * objmgr_drset_update_all. The callback must not call
+ * objmgr_drset_update_all.
+ */
+void
+objmgr_foreach_changed_obj(objmgr_t *mgr, objmgr_foreach_cb_t cb,
+    void *userinfo)
+{
+	ASSERT(mgr != NULL);
+	ASSERT(cb != NULL);
+
+	mutex_enter(&mgr->changed_lock);
+	for (size_t i = 0; i < mgr->n_changed; i++)
+		cb(mgr, mgr->changed[i], userinfo);
+	mutex_exit(&mgr->changed_lock);
+}
+
+/*
+ * Creates a render-to-texture cache for `group' of `obj' (or the whole
+ * object, if `group' is NULL), rendering into a `w' x `h' RGBA texture.
+ * The cache holds a reference to `obj' until it is destroyed, which must
+ * happen before `mgr' is destroyed. The
+ * actual drawing is done by `draw_cb'. `view_tol' is the distance (in
+ * normalized device coordinates) by which the object's projection may
+ * move, before the texture is considered stale, see objmgr_rtt_update.
+ */
+objmgr_rtt_t *
+objmgr_rtt_new(objmgr_t *mgr, objmgr_obj_t *obj, const char *group,
+    unsigned w, unsigned h, float view_tol, objmgr_rtt_draw_cb_t draw_cb,
+    void *userinfo)
+{
+	objmgr_rtt_t *rtt = safe_calloc(1, sizeof (*rtt));
+
+	ASSERT(mgr != NULL);
+	ASSERT(obj != NULL);
+	ASSERT3U(w, >, 0);
+	ASSERT3U(h, >, 0);
+	ASSERT3F(view_tol, >=, 0);
+	ASSERT(draw_cb != NULL);
+
+	mutex_enter(&mgr->lock);
+	ASSERT(obj->refcnt != 0);
+	obj->refcnt++;
+	mutex_exit(&mgr->lock);
+
+	rtt->mgr = mgr;
+	rtt->obj = obj;
+	if (group != NULL)
+		rtt->group = safe_strdup(group);
+	rtt->w = w;
+	rtt->h = h;
+	rtt->view_tol = view_tol;
+	rtt->draw_cb = draw_cb;
+	rtt->userinfo = userinfo;
+	mgr->n_rtts++;
+
+	glGenTextures(1, &rtt->tex);
+	glBindTexture(GL_TEXTURE_2D, rtt->tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA,
+	    GL_UNSIGNED_BYTE, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenRenderbuffers(1, &rtt->depth_rb);
+	glBindRenderbuffer(GL_RENDERBUFFER, rtt->depth_rb);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	IF_TEXSZ(TEXSZ_ALLOC_BYTES_INSTANCE(objmgr_rtt_tex, rtt,
+	    objmgr_get_obj_filename(obj), 0, 2 * 4 * (size_t)w * h));
+	librain_mem_alloc(LIBRAIN_MEM_OBJMGR_RTT, &rtt->mem,
+	    librain_mem_tex_bytes(GL_RGBA8, w, h, 1) +
+	    librain_mem_tex_bytes(GL_DEPTH_COMPONENT24, w, h, 1));
+
+	return (rtt);
+}
+
+void
+objmgr_rtt_destroy(objmgr_rtt_t *rtt)
+{
+	if (rtt == NULL)
+		return;
+	if (rtt->fbo != 0)
+		glDeleteFramebuffers(1, &rtt->fbo);
+	glDeleteRenderbuffers(1, &rtt->depth_rb);
+	glDeleteTextures(1, &rtt->tex);
+	IF_TEXSZ(TEXSZ_FREE_BYTES_INSTANCE(objmgr_rtt_tex, rtt,
+	    2 * 4 * (size_t)rtt->w * rtt->h));
+	librain_mem_release(&rtt->mem);
+	objmgr_remove_obj(rtt->mgr, rtt->obj);
+	ASSERT(rtt->mgr->n_rtts != 0);
+	rtt->mgr->n_rtts--;
+	free(rtt->group);
+	ZERO_FREE(rtt);
+}
+
+/*
+ * Forces the next objmgr_rtt_update to re-render, e.g. after a change
+ * which the cache can't see, such as the caller's own uniforms.
+ */
+void
+objmgr_rtt_invalidate(objmgr_rtt_t *rtt)
+{
+	ASSERT(rtt != NULL);
+	rtt->valid = false;
+}
+
+/*
+ * Returns the number of times the cache has actually been re-rendered.
+ */
+unsigned
+objmgr_rtt_get_num_renders(const objmgr_rtt_t *rtt)
+{
+	ASSERT(rtt != NULL);
+	return (rtt->n_renders);
+}
+
+/*
+ * Returns the depth renderbuffer which the cache renders with, holding
+ * the depth of the last rendering.
+ */
+GLuint
+objmgr_rtt_get_depth_rb(const objmgr_rtt_t *rtt)
+{
+	ASSERT(rtt != NULL);
+	return (rtt->depth_rb);
+}
+
+/*
+ * Returns true once a texture is either on the GPU or has failed to
+ * load, so it will no longer change the object's appearance.
+ */
+static bool
+tex_is_settled(objmgr_tex_t *tex)
+{
+	bool settled;
+
+	if (tex == NULL)
+		return (true);
+	mutex_enter(&tex->lock);
+	settled = (tex->tex != 0 || tex->load_error);
+	mutex_exit(&tex->lock);
+
+	return (settled);
+}
+
+/*
+ * Measures how far the object's projection has moved between two PVM
+ * matrices, as the largest displacement in normalized device coordinates
+ * of the object's origin and the tips of its unit axes.
+ */
+static float
+pvm_delta(const mat4 a, const mat4 b)
+{
+	static const vec4 pts[] = {
+	    {0, 0, 0, 1}, {1, 0, 0, 1}, {0, 1, 0, 1}, {0, 0, 1, 1}
+	};
+	float delta = 0;
+
+	for (unsigned i = 0; i < ARRAY_NUM_ELEM(pts); i++) {
+		vec4 pa, pb;
+
+		glm_mat4_mulv((vec4 *)a, (float *)pts[i], pa);
+		glm_mat4_mulv((vec4 *)b, (float *)pts[i], pb);
+		/* behind the camera in either, consider it a full change */
+		if (pa[3] <= 0 || pb[3] <= 0)
+			return (INFINITY);
+		for (int j = 0; j < 3; j++) {
+			delta = MAX(delta, fabsf(pa[j] / pa[3] -
+			    pb[j] / pb[3]));
+		}
+	}
+	return (delta);
+}
+
+static void
+rtt_render(objmgr_rtt_t *rtt, const mat4 pvm)
+{
+	GLint old_draw_fbo, old_read_fbo, vp[4];
+	GLfloat clear_color[4];
+
+	/* binding GL_FRAMEBUFFER replaces both, so restore both */
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &old_draw_fbo);
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &old_read_fbo);
+	glGetIntegerv(GL_VIEWPORT, vp);
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, clear_color);
+
+	if (rtt->fbo == 0) {
+		/* FBOs aren't shared between contexts, so create it lazily */
+		glGenFramebuffers(1, &rtt->fbo);
+		glBindFramebufferEXT(GL_FRAMEBUFFER, rtt->fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+		    GL_TEXTURE_2D, rtt->tex, 0);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+		    GL_RENDERBUFFER, rtt->depth_rb);
+		VERIFY3U(glCheckFramebufferStatus(GL_FRAMEBUFFER), ==,
+		    GL_FRAMEBUFFER_COMPLETE);
+	} else {
+		glBindFramebufferEXT(GL_FRAMEBUFFER, rtt->fbo);
+	}
+	glViewport(0, 0, rtt->w, rtt->h);
+	glClearColor(0, 0, 0, 0);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	rtt->draw_cb(rtt->mgr, rtt->obj, rtt->group, pvm, rtt->userinfo);
+
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, old_draw_fbo);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, old_read_fbo);
+	glViewport(vp[0], vp[1], vp[2], vp[3]);
+	glClearColor(clear_color[0], clear_color[1], clear_color[2],
+	    clear_color[3]);
+	rtt->n_renders++;
+}
+
+/*
+ * Returns the cached rendering of the object for `pvm', re-rendering it
+ * only if the object's drset has changed since the last render, or its
+ * projection has moved by more than the view tolerance. Drset changes
+ * are picked up from the drset's own serial (see obj8_drset_get_serial),
+ * so it doesn't matter whether the drset is updated through objmgr or
+ * directly via obj8. Until the object and all its textures are on the GPU,
+ * we re-render every time. Returns 0 while the object is still loading
+ * (see objmgr_add_obj_async). Must be called on the drawing thread.
+ */
+GLuint
+objmgr_rtt_update(objmgr_rtt_t *rtt, const mat4 pvm)
+{
+	objmgr_obj_t *obj;
+	uint64_t serial;
+
+	ASSERT(rtt != NULL);
+	obj = rtt->obj;
+	if (!obj_is_ready(obj))
+		return (0);
+	serial = obj8_drset_get_serial(obj8_get_drset(obj->obj));
+
+	/*
+	 * `rtt->pvm' isn't declared as mat4, since that requires stricter
+	 * alignment than safe_calloc guarantees, so copy it out first.
+	 */
+	if (rtt->valid && rtt->drset_serial == serial) {
+		mat4 last_pvm;
+
+		memcpy(last_pvm, rtt->pvm, sizeof (last_pvm));
+		if (pvm_delta(last_pvm, pvm) <= rtt->view_tol)
+			return (rtt->tex);
+	}
+
+	rtt_render(rtt, pvm);
+	memcpy(rtt->pvm, pvm, sizeof (rtt->pvm));
+	rtt->drset_serial = serial;
+	rtt->valid = (obj8_is_uploaded(obj->obj) && tex_is_settled(obj->tex) &&
+	    tex_is_settled(obj->norm) && tex_is_settled(obj->lit));
+
+	return (rtt->tex);
+}
+
 unsigned
 objmgr_get_num_objs(const objmgr_t *mgr)
 {
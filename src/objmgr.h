@@ -36,13 +36,33 @@ void objmgr_destroy(objmgr_t *mgr);
 objmgr_obj_t *objmgr_add_obj(objmgr_t *mgr, const char *filename,
     bool lazy_load_textures, bool load_norm, bool allow_dds_albedo,
     bool allow_dds_lit);
+objmgr_obj_t *objmgr_add_obj_async(objmgr_t *mgr, const char *filename,
+    bool lazy_load_textures, bool load_norm, bool allow_dds_albedo,
+    bool allow_dds_lit);
+bool objmgr_obj_is_ready(const objmgr_obj_t *obj);
+bool objmgr_obj_wait(objmgr_obj_t *obj);
+
+unsigned objmgr_preload_manifest(objmgr_t *mgr, const char *path);
+void objmgr_preload_finish(objmgr_t *mgr);
 void objmgr_remove_obj(objmgr_t *mgr, objmgr_obj_t *obj);
 
 obj8_t *objmgr_get_obj8(const objmgr_obj_t *obj);
 const char *objmgr_get_obj_filename(const objmgr_obj_t *obj);
+librain_mem_stat_t objmgr_get_obj_mem_stat(const objmgr_obj_t *obj);
 bool objmgr_tex_needs_upload(const objmgr_obj_t *obj);
 void objmgr_bind_textures(objmgr_t *mgr, objmgr_obj_t *obj,
     unsigned start_idx, int *tex_idx, int *norm_idx, int *lit_idx);
+bool objmgr_bindless_avail(void);
+void objmgr_get_tex_handles(objmgr_t *mgr, objmgr_obj_t *obj,
+    uint64_t *tex_h, uint64_t *norm_h, uint64_t *lit_h);
+
+void objmgr_set_tex_cache(objmgr_t *mgr, const char *cache_dir,
+    bool norm_bc5);
+void objmgr_set_tex_upload_budget(objmgr_t *mgr, double max_ms,
+    size_t max_bytes);
+void objmgr_new_frame(objmgr_t *mgr);
+void objmgr_set_vram_budget(objmgr_t *mgr, size_t bytes);
+size_t objmgr_get_vram_usage(const objmgr_t *mgr);
 
 typedef void (*objmgr_foreach_cb_t)(objmgr_t *mgr, objmgr_obj_t *obj,
     void *userinfo);
@@ -51,8 +71,34 @@ void objmgr_foreach_obj(objmgr_t *mgr, objmgr_foreach_cb_t cb, void *userinfo);
 void objmgr_mark_drset_needs_update(objmgr_obj_t *obj);
 bool objmgr_get_drset_needs_update(const objmgr_obj_t *obj);
 void objmgr_drset_update(objmgr_obj_t *obj, bool force);
+bool objmgr_drset_resolve(objmgr_t *mgr, uint64_t deadline);
 bool objmgr_get_drset_has_changed(const objmgr_obj_t *obj);
 void objmgr_reset_drset_has_changed(objmgr_obj_t *obj);
+void objmgr_drset_update_all(objmgr_t *mgr, bool force);
+void objmgr_foreach_changed_obj(objmgr_t *mgr, objmgr_foreach_cb_t cb,
+    void *userinfo);
+
+/*
+ * Render-to-texture cache for objects (or groups of them) which change
+ * rarely, such as placards and switch panels. See objmgr_rtt_update.
+ */
+typedef struct objmgr_rtt_s objmgr_rtt_t;
+/*
+ * Must draw `group' of `obj' (the whole object if `group' is NULL) into
+ * the currently bound framebuffer using `pvm', with the caller's own
+ * program and textures.
+ */
+typedef void (*objmgr_rtt_draw_cb_t)(objmgr_t *mgr, objmgr_obj_t *obj,
+    const char *group, const mat4 pvm, void *userinfo);
+
+objmgr_rtt_t *objmgr_rtt_new(objmgr_t *mgr, objmgr_obj_t *obj,
+    const char *group, unsigned w, unsigned h, float view_tol,
+    objmgr_rtt_draw_cb_t draw_cb, void *userinfo);
+void objmgr_rtt_destroy(objmgr_rtt_t *rtt);
+GLuint objmgr_rtt_update(objmgr_rtt_t *rtt, const mat4 pvm);
+void objmgr_rtt_invalidate(objmgr_rtt_t *rtt);
+unsigned objmgr_rtt_get_num_renders(const objmgr_rtt_t *rtt);
+GLuint objmgr_rtt_get_depth_rb(const objmgr_rtt_t *rtt);
 
 unsigned objmgr_get_num_objs(const objmgr_t *mgr);
 unsigned objmgr_get_num_texs(const objmgr_t *mgr);
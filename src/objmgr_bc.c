@@ -0,0 +1,232 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2023 Saso Kiselkov. All rights reserved.
+ */
+
+/*
+ * Simple block compression encoders for the texture cache in objmgr.c.
+ * Color endpoints are picked from the block's (slightly inset) bounding
+ * box, and every texel then gets the nearest palette entry. That is a
+ * good deal worse than an exhaustive encoder, but fast enough to run on
+ * the texture loader threads, and it only needs to happen once per
+ * texture, after which the result comes from the cache.
+ */
+
+#include <string.h>
+
+#include <acfutils/assert.h>
+#include <acfutils/math.h>
+
+#include "objmgr_bc.h"
+
+static inline void
+put16(uint8_t *p, unsigned v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+}
+
+static inline unsigned
+rgb_to_565(const uint8_t c[3])
+{
+	return (((c[0] >> 3) << 11) | ((c[1] >> 2) << 5) | (c[2] >> 3));
+}
+
+static inline void
+rgb_from_565(unsigned v, int c[3])
+{
+	int r = (v >> 11) & 0x1f, g = (v >> 5) & 0x3f, b = v & 0x1f;
+
+	c[0] = (r << 3) | (r >> 2);
+	c[1] = (g << 2) | (g >> 4);
+	c[2] = (b << 3) | (b >> 2);
+}
+
+/*
+ * Encodes the color part of a BC1/BC3 block, always in 4-color mode.
+ */
+static void
+encode_color(const uint8_t blk[16][4], uint8_t out[8])
+{
+	uint8_t lo[3] = { 255, 255, 255 }, hi[3] = { 0, 0, 0 };
+	unsigned c0, c1;
+	int pal[4][3];
+	uint32_t idx = 0;
+
+	for (int i = 0; i < 16; i++) {
+		for (int c = 0; c < 3; c++) {
+			lo[c] = MIN(lo[c], blk[i][c]);
+			hi[c] = MAX(hi[c], blk[i][c]);
+		}
+	}
+	/* inset the box a little, to reduce the error at the ends */
+	for (int c = 0; c < 3; c++) {
+		int inset = (hi[c] - lo[c]) / 16;
+
+		lo[c] += inset;
+		hi[c] -= inset;
+	}
+	/*
+	 * The endpoints lie on one of the box's diagonals. Pick the one
+	 * following the sign of red's and blue's covariance with green.
+	 */
+	for (int c = 0; c < 3; c += 2) {
+		int mean_c = (lo[c] + hi[c]) / 2, mean_g = (lo[1] + hi[1]) / 2;
+		int cov = 0;
+
+		for (int i = 0; i < 16; i++)
+			cov += (blk[i][c] - mean_c) * (blk[i][1] - mean_g);
+		if (cov < 0) {
+			uint8_t tmp = lo[c];
+			lo[c] = hi[c];
+			hi[c] = tmp;
+		}
+	}
+	c0 = rgb_to_565(hi);
+	c1 = rgb_to_565(lo);
+	if (c0 < c1) {
+		unsigned tmp = c0;
+		c0 = c1;
+		c1 = tmp;
+	}
+	put16(&out[0], c0);
+	put16(&out[2], c1);
+	if (c0 == c1) {
+		memset(&out[4], 0, 4);
+		return;
+	}
+	rgb_from_565(c0, pal[0]);
+	rgb_from_565(c1, pal[1]);
+	for (int c = 0; c < 3; c++) {
+		pal[2][c] = (2 * pal[0][c] + pal[1][c]) / 3;
+		pal[3][c] = (pal[0][c] + 2 * pal[1][c]) / 3;
+	}
+	for (int i = 0; i < 16; i++) {
+		int best = 0, best_d = INT32_MAX;
+
+		for (int j = 0; j < 4; j++) {
+			int d = 0;
+
+			for (int c = 0; c < 3; c++) {
+				int e = blk[i][c] - pal[j][c];
+				d += e * e;
+			}
+			if (d < best_d) {
+				best_d = d;
+				best = j;
+			}
+		}
+		idx |= (uint32_t)best << (2 * i);
+	}
+	for (int i = 0; i < 4; i++)
+		out[4 + i] = (idx >> (8 * i)) & 0xff;
+}
+
+/*
+ * Encodes one channel of a block in the BC3 alpha / BC4 format, using
+ * the 8-value interpolation mode.
+ */
+static void
+encode_channel(const uint8_t blk[16][4], int chan, uint8_t out[8])
+{
+	int a0 = 0, a1 = 255;
+	int pal[8];
+	uint64_t idx = 0;
+
+	for (int i = 0; i < 16; i++) {
+		a0 = MAX(a0, blk[i][chan]);
+		a1 = MIN(a1, blk[i][chan]);
+	}
+	out[0] = a0;
+	out[1] = a1;
+	if (a0 == a1) {
+		memset(&out[2], 0, 6);
+		return;
+	}
+	pal[0] = a0;
+	pal[1] = a1;
+	for (int j = 1; j < 7; j++)
+		pal[j + 1] = ((7 - j) * a0 + j * a1) / 7;
+	for (int i = 0; i < 16; i++) {
+		int best = 0, best_d = INT32_MAX;
+
+		for (int j = 0; j < 8; j++) {
+			int d = ABS(blk[i][chan] - pal[j]);
+
+			if (d < best_d) {
+				best_d = d;
+				best = j;
+			}
+		}
+		idx |= (uint64_t)best << (3 * i);
+	}
+	for (int i = 0; i < 6; i++)
+		out[2 + i] = (idx >> (8 * i)) & 0xff;
+}
+
+size_t
+bc_encoded_size(bc_fmt_t fmt, int w, int h)
+{
+	size_t n_blocks = (size_t)((w + 3) / 4) * ((h + 3) / 4);
+
+	return (n_blocks * (fmt == BC_FMT_BC1 ? 8 : 16));
+}
+
+/*
+ * Encodes a `w' x `h' image of 8-bit texels with `n_chan' (3 or 4)
+ * channels into `out', which must hold bc_encoded_size bytes. Texels
+ * beyond the right and bottom edges repeat the last column and row.
+ */
+void
+bc_encode(bc_fmt_t fmt, const uint8_t *px, int w, int h, unsigned n_chan,
+    uint8_t *out)
+{
+	ASSERT(px != NULL);
+	ASSERT(n_chan == 3 || n_chan == 4);
+	ASSERT(out != NULL);
+
+	for (int by = 0; by < h; by += 4) {
+		for (int bx = 0; bx < w; bx += 4) {
+			uint8_t blk[16][4];
+
+			for (int i = 0; i < 16; i++) {
+				int x = MIN(bx + i % 4, w - 1);
+				int y = MIN(by + i / 4, h - 1);
+				const uint8_t *p = &px[(y * w + x) * n_chan];
+
+				memcpy(blk[i], p, 3);
+				blk[i][3] = (n_chan == 4 ? p[3] : 255);
+			}
+			switch (fmt) {
+			case BC_FMT_BC1:
+				encode_color(blk, out);
+				out += 8;
+				break;
+			case BC_FMT_BC3:
+				encode_channel(blk, 3, out);
+				encode_color(blk, &out[8]);
+				out += 16;
+				break;
+			default:
+				ASSERT3U(fmt, ==, BC_FMT_BC5);
+				encode_channel(blk, 0, out);
+				encode_channel(blk, 1, &out[8]);
+				out += 16;
+				break;
+			}
+		}
+	}
+}
@@ -0,0 +1,43 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2023 Saso Kiselkov. All rights reserved.
+ */
+
+#ifndef	_OBJMGR_BC_H_
+#define	_OBJMGR_BC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+	BC_FMT_BC1,	/* RGB, 8 bytes per block */
+	BC_FMT_BC3,	/* RGBA, 16 bytes per block */
+	BC_FMT_BC5	/* RG, 16 bytes per block */
+} bc_fmt_t;
+
+size_t bc_encoded_size(bc_fmt_t fmt, int w, int h);
+void bc_encode(bc_fmt_t fmt, const uint8_t *px, int w, int h, unsigned n_chan,
+    uint8_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* _OBJMGR_BC_H_ */
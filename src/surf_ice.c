@@ -65,6 +65,7 @@ struct surf_ice_impl_s {
 	uint64_t	last_ice_t;
 	double		prev_render_t;
 	mat4		*pvm;
+	librain_mem_acct_t mem;
 };
 
 static bool_t inited = B_FALSE;
@@ -235,6 +236,8 @@ surf_ice_init(surf_ice_t *surf, obj8_t *obj, const char *group_id)
 		    0, 0, B_FALSE);
 		IF_TEXSZ(TEXSZ_ALLOC_INSTANCE(librain_ice_depth_tex, surf,
 		    NULL, 0, GL_RED, GL_FLOAT, surf->w, surf->h));
+		librain_mem_alloc(LIBRAIN_MEM_ICE_TEX, &priv->mem,
+		    librain_mem_tex_bytes(GL_R32F, surf->w, surf->h, 1));
 	}
 	glGenTextures(1, &priv->norm_tex);
 	glGenFramebuffers(1, &priv->norm_fbo);
@@ -243,6 +246,8 @@ surf_ice_init(surf_ice_t *surf, obj8_t *obj, const char *group_id)
 	setup_color_fbo_for_tex(priv->norm_fbo, priv->norm_tex, 0, 0, B_FALSE);
 	IF_TEXSZ(TEXSZ_ALLOC_INSTANCE(librain_ice_norm_tex, surf,
 	    NULL, 0, GL_RG, GL_UNSIGNED_BYTE, surf->w, surf->h));
+	librain_mem_alloc(LIBRAIN_MEM_ICE_TEX, &priv->mem,
+	    librain_mem_tex_bytes(GL_RG8, surf->w, surf->h, 1));
 
 	glutils_init_2D_quads(&priv->quads, p, t, 4);
 
@@ -294,6 +299,7 @@ surf_ice_fini(surf_ice_t *surf)
 	DESTROY_OP(priv->packbuf, 0, glDeleteBuffers(1, &priv->packbuf));
 	glutils_destroy_quads(&priv->quads);
 	free(priv->group_id);
+	librain_mem_release(&priv->mem);
 
 	aligned_free(priv->pvm);
 	free(priv);
@@ -448,6 +454,9 @@ render_blur(surf_ice_t *surf, double blur_radius)
 			    surf, NULL, 0, GL_RG, GL_UNSIGNED_BYTE,
 			    surf->w, surf->h));
 		}
+		librain_mem_alloc(LIBRAIN_MEM_ICE_TEX, &priv->mem,
+		    librain_mem_tex_bytes(GL_R32F, surf->w, surf->h, 1) +
+		    librain_mem_tex_bytes(GL_RG8, surf->w, surf->h, 1));
 	}
 
 	old_fbo = librain_get_current_fbo();
@@ -469,6 +478,7 @@ render_obj(surf_ice_t *surf, double blur_radius)
 {
 	surf_ice_impl_t *priv = surf->priv;
 	mat4 pvm;
+	vec4 vp;
 
 	if (blur_radius > 0)
 		render_blur(surf, blur_radius);
@@ -507,6 +517,9 @@ render_obj(surf_ice_t *surf, double blur_radius)
 	    dr_getf(&drs.sun_pitch));
 	glUniformMatrix4fv(glGetUniformLocation(render_prog, "acf_orient"), 1,
 	    GL_FALSE, (void *)acf_orient);
+	librain_get_vp(vp);
+	glUniform4f(glGetUniformLocation(render_prog, "vp"),
+	    vp[0], vp[1], vp[2], vp[3]);
 
 	librain_get_pvm(pvm);
 	glDepthMask(GL_FALSE);
@@ -544,6 +557,8 @@ act_ice_state_resync(surf_ice_t *surf, double ice)
 		if (priv->packbuf != 0) {
 			IF_TEXSZ(TEXSZ_FREE_BYTES_INSTANCE(librain_ice_packbuf,
 			    surf, surf->w * surf->h * sizeof (GLfloat)));
+			librain_mem_free(LIBRAIN_MEM_ICE_READBACK, &priv->mem,
+			    surf->w * surf->h * sizeof (GLfloat));
 			glDeleteBuffers(1, &priv->packbuf);
 			if (priv->packbuf_sync != NULL) {
 				glDeleteSync(priv->packbuf_sync);
@@ -564,6 +579,8 @@ act_ice_state_resync(surf_ice_t *surf, double ice)
 			IF_TEXSZ(TEXSZ_ALLOC_BYTES_INSTANCE(librain_ice_packbuf,
 			    surf, NULL, 0, surf->w * surf->h *
 			    sizeof (GLfloat)));
+			librain_mem_alloc(LIBRAIN_MEM_ICE_READBACK, &priv->mem,
+			    surf->w * surf->h * sizeof (GLfloat));
 		}
 		/* If we have a buffer in flight, is it time to grab it? */
 		if (priv->packbuf_sync != NULL) {
@@ -671,6 +688,18 @@ surf_ice_clear(surf_ice_t *surf)
 	free(norm_buf);
 }
 
+/*
+ * Returns the memory taken up by the surface's textures and buffers.
+ */
+librain_mem_stat_t
+surf_ice_get_mem_stat(const surf_ice_t *surf)
+{
+	ASSERT(surf != NULL);
+	if (surf->priv == NULL)
+		return ((librain_mem_stat_t){ 0 });
+	return (librain_mem_acct_get(&surf->priv->mem));
+}
+
 bool_t
 surf_ice_render_pass_needed(void)
 {
@@ -67,6 +67,7 @@ void surf_ice_fini(surf_ice_t *surf);
 void surf_ice_render(surf_ice_t *surf, double ice, bool_t deice_on,
     double blur_radius, bool_t visible);
 void surf_ice_clear(surf_ice_t *surf);
+librain_mem_stat_t surf_ice_get_mem_stat(const surf_ice_t *surf);
 
 bool_t surf_ice_render_pass_needed(void);
 void surf_ice_render_pass_begin(void);